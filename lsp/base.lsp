@@ -596,13 +596,12 @@
   (flambda "return all arguments unevaluated" (x) x))
 
 (define defun
-  (flambda "define a new function" (x)
-	   (let 
-	     (name (car x))
-	     (doc  (cadr x))   ; documentation string
-	     (args (caddr x))  ; function arguments
-	     (code (cadddr x))
-	     (eval (list define name (list lambda doc args code)) (environment)))))
+  (macro "define a new function" (name doc args code)
+	 (list define name (list lambda doc args code))))
+
+(define defmacro
+  (macro "define a new macro" (name doc args code)
+	 (list define name (list macro doc args code))))
 
 (define identity 
   (lambda "return its argument" (x) x))
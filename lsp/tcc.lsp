@@ -21,3 +21,16 @@
               return mk_int(l, get_int(car(args)) * get_int(car(args)));
     }"))
 
+
+; Procedures that only use integers can be translated into C and compiled
+; instead, cc-procedure rebinds the symbol to the compiled subroutine, which
+; only accepts integers. (cc-procedure-source 'triangle) shows the C.
+(define triangle
+  (lambda (n)
+    (let (sum 0)
+      (progn
+        (while (> n 0)
+          (setq sum (+ sum n))
+          (setq n (- n 1)))
+        sum))))
+(cc-procedure 'triangle)
@@ -104,7 +104,7 @@
         (coerce *string* 1.0) 
          "1\\.0*")
     (test = (cdr (assoc 'x '((x . a) (y . b)))) 'a)
-    (test = (eval 'x '((x a) (y b))) '(a))
+    (test equal (eval 'x '((x a) (y b))) '(a))
     (test equal (pair '(x y z) '(a b c)) '((x a) (y b) (z c)))
     (test equal (list 'a 'b 'c) '(a b c))
     (test equal (subst 'm 'b '(a b (a b c) d)) '(a m (a m c) d))
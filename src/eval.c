@@ -20,17 +20,11 @@ static const int dynamic_on = 0; /**< 0 for lexical scoping, !0 for dynamic scop
 static lisp_cell_t *mk(lisp_t * l, lisp_type type, size_t count, ...) {
 	assert(l && type != INVALID && count);
 	lisp_cell_t *ret;
-	gc_list_t *node; /**< new node in linked list of all allocations*/
 	va_list ap;
 	size_t i;
 
-	if (l->gc_collectp++ > COLLECTION_POINT)	/*set to 1 for testing */
-		lisp_gc_mark_and_sweep(l);
-
 	va_start(ap, count);
-	ret  = lisp_calloc(l, sizeof(lisp_cell_t) + (count - 1) * sizeof(cell_data_t));
-	node = lisp_calloc(l, sizeof(*node));
-	ret->type = type;
+	ret = lisp_gc_alloc(l, type, count);
 	for (i = 0; i < count; i++)
 		if (FLOAT == type)
 			ret->p[i].f = va_arg(ap, double);
@@ -39,9 +33,6 @@ static lisp_cell_t *mk(lisp_t * l, lisp_type type, size_t count, ...) {
 		else
 			ret->p[i].v = va_arg(ap, void *);
 	va_end(ap);
-	node->ref = ret;
-	node->next = l->gc_head;
-	l->gc_head = node;
 	lisp_gc_add(l, ret);
 	return ret;
 }
@@ -63,11 +54,13 @@ lisp_cell_t *cdr(lisp_cell_t * con) {
 
 void set_car(lisp_cell_t * con, lisp_cell_t * val) {
 	assert(con && is_cons(con) && val);
+	LISP_GC_BARRIER(con);
 	con->p[0].v = val;
 }
 
 void set_cdr(lisp_cell_t * con, lisp_cell_t * val) {
 	assert(con && is_cons(con) && val);
+	LISP_GC_BARRIER(con);
 	con->p[1].v = val;
 }
 
@@ -88,22 +81,22 @@ int is_nil(lisp_cell_t * x) {
 
 int is_int(lisp_cell_t * x) {
 	assert(x);
-	return x->type == INTEGER;
+	return TYPE_OF(x) == INTEGER;
 }
 
 int is_floating(lisp_cell_t * x) {
 	assert(x);
-	return x->type == FLOAT;
+	return TYPE_OF(x) == FLOAT;
 }
 
 int is_io(lisp_cell_t * x) {
 	assert(x);
-	return x->type == IO && !x->close;
+	return TYPE_OF(x) == IO && !x->close;
 }
 
 int is_cons(lisp_cell_t * x) {
 	assert(x);
-	return x->type == CONS;
+	return TYPE_OF(x) == CONS;
 }
 
 int is_proper_cons(lisp_cell_t * x) {
@@ -113,42 +106,47 @@ int is_proper_cons(lisp_cell_t * x) {
 
 int is_proc(lisp_cell_t * x) {
 	assert(x);
-	return x->type == PROC;
+	return TYPE_OF(x) == PROC;
 }
 
 int is_fproc(lisp_cell_t * x) {
 	assert(x);
-	return x->type == FPROC;
+	return TYPE_OF(x) == FPROC;
+}
+
+int is_macro(lisp_cell_t * x) {
+	assert(x);
+	return TYPE_OF(x) == MACRO;
 }
 
 int is_str(lisp_cell_t * x) {
 	assert(x);
-	return x->type == STRING;
+	return TYPE_OF(x) == STRING;
 }
 
 int is_sym(lisp_cell_t * x) {
 	assert(x);
-	return x->type == SYMBOL;
+	return TYPE_OF(x) == SYMBOL;
 }
 
 int is_subr(lisp_cell_t * x) {
 	assert(x);
-	return x->type == SUBR;
+	return TYPE_OF(x) == SUBR;
 }
 
 int is_hash(lisp_cell_t * x) {
 	assert(x);
-	return x->type == HASH;
+	return TYPE_OF(x) == HASH;
 }
 
 int is_userdef(lisp_cell_t * x) {
 	assert(x);
-	return x->type == USERDEF && !x->close;
+	return TYPE_OF(x) == USERDEF && !x->close;
 }
 
 int is_usertype(lisp_cell_t * x, const int type) {
 	assert(x && type < MAX_USER_TYPES && type >= 0);
-	return x->type == USERDEF && get_user_type(x) == type && !x->close;
+	return TYPE_OF(x) == USERDEF && get_user_type(x) == type && !x->close;
 }
 
 int is_asciiz(lisp_cell_t * x) {
@@ -168,7 +166,7 @@ int is_func(lisp_cell_t * x) {
 
 int is_closed(lisp_cell_t * x) {
 	assert(x);
-	return x->close;
+	return !IS_IMMEDIATE(x) && x->close;
 }
 
 int is_list(lisp_cell_t * x) {
@@ -185,8 +183,12 @@ static lisp_cell_t *mk_asciiz(lisp_t * l, char *s, lisp_type type) {
 	return x;
 }
 
-static lisp_cell_t *mk_sym(lisp_t * l, char *s) {
-	return mk_asciiz(l, s, SYMBOL);
+/**@brief symbols also keep the hash of their name, so the tables they are
+ * looked up in never have to hash it again, and their top level binding,
+ * see get_sym_global*/
+static lisp_cell_t *mk_sym(lisp_t * l, char *s, uint32_t hash) {
+	assert(l && s);
+	return mk(l, SYMBOL, 4, (lisp_cell_t *) s, strlen(s), (uintptr_t) hash, (void *)NULL);
 }
 
 lisp_cell_t *mk_list(lisp_t * l, lisp_cell_t * x, ...) {
@@ -203,6 +205,8 @@ lisp_cell_t *mk_list(lisp_t * l, lisp_cell_t * x, ...) {
 
 lisp_cell_t *mk_int(lisp_t * l, const intptr_t d) {
 	assert(l);
+	if (d >= FIXNUM_MIN && d <= FIXNUM_MAX)
+		return (lisp_cell_t *) (((uintptr_t) d << 1) | FIXNUM_TAG);
 	return mk(l, INTEGER, 1, (lisp_cell_t *) d);
 }
 
@@ -212,30 +216,92 @@ lisp_cell_t *mk_io(lisp_t * l, io_t * x) {
 }
 
 lisp_cell_t *mk_subr(lisp_t * l, lisp_subr_func p, const char *fmt, const char *doc) {
+	return mk_subr_direct(l, NULL, p, fmt, doc);
+}
+
+lisp_cell_t *mk_subr_direct(lisp_t * l, lisp_subr_direct direct, lisp_subr_func p, const char *fmt, const char *doc) {
 	assert(l && p);
-	lisp_cell_t *t = mk(l, SUBR, 4, p, NULL, NULL, NULL);
+	size_t tlen = 0;
 	if (fmt) {
-		size_t tlen = lisp_validate_arg_count(fmt);
+		tlen = lisp_validate_arg_count(fmt);
 		assert((BITS_IN_LENGTH >= 32) && tlen < 0xFFFFFFFFu);
-		t->p[3].v = (void*)tlen;
 	}
-	t->p[1].v = (void *)fmt;
-	t->p[2].v = (void *)mk_str(l, lisp_strdup(l, doc ? doc : ""));
-	return t;
+	assert(!direct || (tlen > 0 && tlen <= SUBR_DIRECT_MAX));
+	/*the doc string is made first so no young object is stored in the
+	 * subroutine after it could have been made old*/
+	lisp_cell_t *d = mk_str(l, lisp_strdup(l, doc ? doc : ""));
+	uint32_t *masks = fmt ? lisp_validate_compile(l, fmt, tlen) : NULL;
+	lisp_cell_t *r = mk(l, SUBR, 6, p, (void *)fmt, d, (void *)tlen, NULL, NULL);
+	r->p[4].prim = (lisp_subr_func)direct;
+	r->p[5].v = masks;
+	return r;
+}
+
+/**@brief make a procedure or F-expression, which keeps how many arguments
+ * it takes so they are not counted each time it is applied, as well as
+ * how often it has been called and what it has been compiled to, see
+ * vm_promote*/
+static lisp_cell_t *mk_function(lisp_t * l, lisp_type type, lisp_cell_t * args, lisp_cell_t * code, lisp_cell_t * env, lisp_cell_t * doc) {
+	uintptr_t fixed = 0;
+	lisp_cell_t *a;
+	for (a = args; is_cons(a); a = cdr(a))
+		fixed++;
+	return mk(l, type, 9, args, code, env, NULL, doc, (void *)(fixed << 1 | !is_nil(a)), NULL, NULL, NULL);
 }
 
 lisp_cell_t *mk_proc(lisp_t * l, lisp_cell_t * args, lisp_cell_t * code, lisp_cell_t * env, lisp_cell_t * doc) {
 	assert(l && args && code && env);
-	return mk(l, PROC, 5, args, code, env, NULL, doc);
+	return mk_function(l, PROC, args, code, env, doc);
 }
 
 lisp_cell_t *mk_fproc(lisp_t * l, lisp_cell_t * args, lisp_cell_t * code, lisp_cell_t * env, lisp_cell_t * doc) {
 	assert(l && args && code && env);
-	return mk(l, FPROC, 5, args, code, env, NULL, doc);
+	return mk_function(l, FPROC, args, code, env, doc);
 }
 
+lisp_cell_t *mk_macro(lisp_t * l, lisp_cell_t * args, lisp_cell_t * code, lisp_cell_t * env, lisp_cell_t * doc) {
+	assert(l && args && code && env);
+	return mk_function(l, MACRO, args, code, env, doc);
+}
+
+/**@brief make a frame extending "parent" with room for "slots" variables,
+ * of which "count" are in use, all of them start off as nil*/
+lisp_cell_t *mk_frame(lisp_t * l, lisp_cell_t * parent, lisp_cell_t * names, size_t slots, size_t count) {
+	assert(l && parent && names && count <= slots);
+	lisp_cell_t *f = lisp_gc_alloc(l, FRAME, FRAME_HEADER + slots);
+	f->p[0].v = parent;
+	f->p[1].v = names;
+	f->p[2].v = (void *)count;
+	for (size_t i = 0; i < slots; i++)
+		f->p[FRAME_HEADER + i].v = l->nil;
+	lisp_gc_add(l, f);
+	return f;
+}
+
+lisp_cell_t *mk_ref(lisp_t * l, lisp_cell_t * sym, size_t depth, size_t slot) {
+	assert(l && sym && is_sym(sym));
+	return mk(l, REF, 3, sym, (void *)depth, (void *)slot);
+}
+
+#if USE_FLONUM
+#define FLONUM_ZERO ((uintptr_t)0x8000000000000002) /**< +0.0, see mk_float*/
+#define ROTL64(X, N) (((X) << (N)) | ((X) >> (64 - (N))))
+#define ROTR64(X, N) (((X) >> (N)) | ((X) << (64 - (N))))
+#endif
+
 lisp_cell_t *mk_float(lisp_t * l, lisp_float_t f) {
 	assert(l);
+#if USE_FLONUM
+	uint64_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	/*bits 62 to 60 of the exponent must be 011 or 100, the one number
+	 *this would give the same encoding as +0.0 to is excluded*/
+	unsigned top = (bits >> 60) & 7;
+	if ((top == 3 || top == 4) && bits != 0x3000000000000000)
+		return (lisp_cell_t *) (uintptr_t) ((ROTL64(bits, 3) & ~IMMEDIATE_MASK) | FLONUM_TAG);
+	if (!bits)
+		return (lisp_cell_t *) FLONUM_ZERO;
+#endif
 	return mk(l, FLOAT, 1, f);
 }
 
@@ -251,7 +317,9 @@ lisp_cell_t *mk_immutable_str(lisp_t * l, const char *s) {
 }
 
 lisp_cell_t *mk_hash(lisp_t * l, hash_table_t * h) {
-	return mk(l, HASH, 1, (lisp_cell_t *) h);
+	lisp_cell_t *ret = mk(l, HASH, 1, (lisp_cell_t *) h);
+	h->owner = ret;
+	return ret;
 }
 
 lisp_cell_t *mk_user(lisp_t * l, void *x, const intptr_t type) {
@@ -266,7 +334,7 @@ unsigned get_length(lisp_cell_t * x) {
 	assert(x);
 	if (is_nil(x))
 		return 0;
-	switch (x->type) {
+	switch (TYPE_OF(x)) {
 	case STRING:
 	case SYMBOL:
 		return (uintptr_t)(x->p[1].v);
@@ -283,11 +351,17 @@ unsigned get_length(lisp_cell_t * x) {
 
 void *get_raw(lisp_cell_t * x) {
 	assert(x);
-	return x->p[0].v;
+	if (IS_FLONUM(x)) { /*the same bits a float cell would hold*/
+		cell_data_t d = { .v = NULL };
+		d.f = get_float(x);
+		return d.v;
+	}
+	/*this relies on right shifts of negative numbers being arithmetic*/
+	return IS_FIXNUM(x) ? (void *) ((intptr_t) x >> 1) : x->p[0].v;
 }
 
 intptr_t get_int(lisp_cell_t * x) {
-	return !x ? 0 : (intptr_t) (x->p[0].v);
+	return !x ? 0 : (intptr_t) get_raw(x);
 }
 
 lisp_subr_func get_subr(lisp_cell_t * x) {
@@ -295,33 +369,111 @@ lisp_subr_func get_subr(lisp_cell_t * x) {
 	return x->p[0].prim;
 }
 
+lisp_subr_direct get_subr_direct(lisp_cell_t * x) {
+	assert(x && is_subr(x));
+	return (lisp_subr_direct)x->p[4].prim;
+}
+
+const uint32_t *get_subr_validation(lisp_cell_t * x) {
+	assert(x && is_subr(x));
+	return x->p[5].v;
+}
+
+lisp_cell_t *subr_call(lisp_t * l, lisp_cell_t * subr, lisp_cell_t ** argv, size_t n) {
+	assert(l && subr && argv);
+	lisp_subr_direct f = get_subr_direct(subr);
+	lisp_cell_t *args = l->nil;
+	if (f && n == get_length(subr)) {
+		lisp_validate_argv(l, subr, argv, n, 1);
+		switch (n) {
+		case 1: return ((lisp_subr_func1)f)(l, argv[0]);
+		case 2: return ((lisp_subr_func2)f)(l, argv[0], argv[1]);
+		case 3: return ((lisp_subr_func3)f)(l, argv[0], argv[1], argv[2]);
+		}
+	}
+	while (n) /*the list each call to the primitive used to make*/
+		args = cons(l, argv[--n], args);
+	lisp_validate_cell(l, subr, args, 1);
+	return (*get_subr(subr)) (l, args);
+}
+
 lisp_cell_t *get_proc_args(lisp_cell_t * x) {
-	assert(x && (is_proc(x) || is_fproc(x)));
+	assert(x && (is_proc(x) || is_fproc(x) || is_macro(x)));
 	return x->p[0].v;
 }
 
 lisp_cell_t *get_proc_code(lisp_cell_t * x) {
-	assert(x && (is_proc(x) || is_fproc(x)));
+	assert(x && (is_proc(x) || is_fproc(x) || is_macro(x)));
 	return x->p[1].v;
 }
 
 lisp_cell_t *get_proc_env(lisp_cell_t * x) {
-	assert(x && (is_proc(x) || is_fproc(x)));
+	assert(x && (is_proc(x) || is_fproc(x) || is_macro(x)));
 	return x->p[2].v;
 }
 
+size_t get_proc_fixed(lisp_cell_t * x) {
+	assert(x && (is_proc(x) || is_fproc(x) || is_macro(x)));
+	return (uintptr_t)x->p[5].v >> 1;
+}
+
+size_t get_proc_count(lisp_cell_t * x) {
+	assert(x && (is_proc(x) || is_fproc(x) || is_macro(x)));
+	return ((uintptr_t)x->p[5].v >> 1) + ((uintptr_t)x->p[5].v & 1);
+}
+
+size_t get_proc_calls(lisp_cell_t * x) {
+	assert(x && is_proc(x));
+	return (uintptr_t)x->p[6].v;
+}
+
+lisp_cell_t *get_proc_native(lisp_cell_t * x) {
+	assert(x && is_proc(x));
+	return x->p[7].v;
+}
+
+lisp_cell_t *get_frame_parent(lisp_cell_t * x) {
+	assert(x && TYPE_OF(x) == FRAME);
+	return x->p[0].v;
+}
+
+static lisp_cell_t *get_frame_names(lisp_cell_t * x) {
+	assert(x && TYPE_OF(x) == FRAME);
+	return x->p[1].v;
+}
+
+size_t get_frame_count(lisp_cell_t * x) {
+	assert(x && TYPE_OF(x) == FRAME);
+	return (uintptr_t)x->p[2].v;
+}
+
+lisp_cell_t *get_ref_sym(lisp_cell_t * x) {
+	assert(x && TYPE_OF(x) == REF);
+	return x->p[0].v;
+}
+
+size_t get_ref_depth(lisp_cell_t * x) {
+	assert(x && TYPE_OF(x) == REF);
+	return (uintptr_t)x->p[1].v;
+}
+
+size_t get_ref_slot(lisp_cell_t * x) {
+	assert(x && TYPE_OF(x) == REF);
+	return (uintptr_t)x->p[2].v;
+}
+
 lisp_cell_t *get_func_docstring(lisp_cell_t * x) {
-	assert(x && is_func(x));
+	assert(x && (is_func(x) || is_macro(x)));
 	return is_subr(x) ? x->p[2].v : x->p[4].v;
 }
 
 char *get_func_format(lisp_cell_t * x) {
 	assert(x && is_func(x));
-	return is_subr(x) ? x->p[1].v : x->p[3].v;
+	return is_subr(x) ? x->p[1].v : NULL;
 }
 
 io_t *get_io(lisp_cell_t * x) {
-	assert(x && x->type == IO);
+	assert(x && TYPE_OF(x) == IO);
 	return (io_t *) (x->p[0].v);
 }
 
@@ -330,18 +482,28 @@ char *get_sym(lisp_cell_t * x) {
 	return (char *)(x->p[0].v);
 }
 
+uint32_t get_sym_hash(lisp_cell_t * x) {
+	assert(x && is_sym(x));
+	return (uintptr_t)(x->p[2].v);
+}
+
+lisp_cell_t *get_sym_global(lisp_cell_t * x) {
+	assert(x && is_sym(x));
+	return x->p[3].v;
+}
+
 char *get_str(lisp_cell_t * x) {
 	assert(x && is_asciiz(x));
 	return (char *)(x->p[0].v);
 }
 
 void *get_user(lisp_cell_t * x) {
-	assert(x && x->type == USERDEF);
+	assert(x && TYPE_OF(x) == USERDEF);
 	return (void *)(x->p[0].v);
 }
 
 int get_user_type(lisp_cell_t * x) {
-	assert(x && x->type == USERDEF);
+	assert(x && TYPE_OF(x) == USERDEF);
 	return (intptr_t) x->p[1].v;
 }
 
@@ -352,6 +514,20 @@ hash_table_t *get_hash(lisp_cell_t * x) {
 
 lisp_float_t get_float(lisp_cell_t * x) {
 	assert(x && is_floating(x));
+#if USE_FLONUM
+	if (IS_FLONUM(x)) {
+		uint64_t bits = (uintptr_t) x;
+		lisp_float_t f;
+		/*bit 60 of the exponent, now the top bit, gives the two
+		 *replaced by the tag: 1 means they were 01, 0 means 10*/
+		if (bits != FLONUM_ZERO)
+			bits = ROTR64((2 - (bits >> 63)) | (bits & ~IMMEDIATE_MASK), 3);
+		else
+			bits = 0;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+#endif
 	return x->p[0].f;
 }
 
@@ -389,20 +565,46 @@ lisp_cell_t *lisp_extend(lisp_t * l, lisp_cell_t * env, lisp_cell_t * sym, lisp_
 	return cons(l, cons(l, sym, val), env);
 }
 
-lisp_cell_t *lisp_intern(lisp_t * l, char *name) {
+/**@brief copy the name of a new symbol into the current name block,
+ * starting another block if it does not fit in what is left of it*/
+static char *intern_name(lisp_t * l, const char *name, size_t len) {
+	assert(l && name);
+	name_block_t *b = l->names;
+	if (!b || b->size - b->used <= len) {
+		size_t size = len >= NAME_BLOCK_SIZE ? len + 1 : NAME_BLOCK_SIZE;
+		b = lisp_calloc(l, sizeof(*b) + size);
+		b->size = size;
+		b->next = l->names;
+		l->names = b;
+	}
+	char *r = memcpy(b->names + b->used, name, len + 1);
+	b->used += len + 1;
+	return r;
+}
+
+lisp_cell_t *lisp_intern(lisp_t * l, const char *name) {
 	assert(l && name);
-	lisp_cell_t *op = hash_lookup(get_hash(l->all_symbols), name);
+	const size_t len = strlen(name);
+	const uint32_t hash = hash_string(name, len);
+	lisp_cell_t *op = hash_lookup_hashed(get_hash(l->all_symbols), name, hash);
 	if (op)
 		return op;
-	op = mk_sym(l, name);
-	hash_insert(get_hash(l->all_symbols), name, op);
+	char *s = intern_name(l, name, len);
+	op = mk_sym(l, s, hash);
+	if (hash_insert_hashed(get_hash(l->all_symbols), s, hash, op) < 0)
+		lisp_out_of_memory(l);
 	return op;
 }
 
-/**@todo make use of lisp_copy to make closures work */
+/**@brief copy the frames of the environment of a closure, what they extend
+ * is the top level environment, which is shared and not copied*/
+static lisp_cell_t *copy_env(lisp_t *l, lisp_cell_t *env) {
+	return TYPE_OF(env) == FRAME ? lisp_copy(l, env) : env;
+}
+
 lisp_cell_t *lisp_copy(lisp_t *l, lisp_cell_t *src) {
 	assert(l && src);
-	switch(src->type) {
+	switch(TYPE_OF(src)) {
 	case SUBR:
 	case SYMBOL:
 		return src; /*symbols, subroutines must be immutable*/
@@ -413,7 +615,11 @@ lisp_cell_t *lisp_copy(lisp_t *l, lisp_cell_t *src) {
 		 * immutable strings*/
 		return mk_str(l, lisp_strdup(l, get_str(src)));
 	case CONS:
-		return cons(l, lisp_copy(l, car(src)), lisp_copy(l, cdr(src)));
+	{
+		lisp_cell_t *c = cons(l, lisp_copy(l, car(src)), lisp_copy(l, cdr(src)));
+		c->resolved = src->resolved; /*so copied code still runs*/
+		return c;
+	}
 	case HASH:
 	{
 		hash_table_t *new = hash_copy(get_hash(src));
@@ -425,12 +631,26 @@ lisp_cell_t *lisp_copy(lisp_t *l, lisp_cell_t *src) {
 		return mk_float(l, get_float(src));
 	case PROC:
 	case FPROC:
-		return mk(l, src->type, 5,
+	case MACRO:
+		return mk_function(l, src->type,
 				lisp_copy(l, get_proc_args(src)),
 				lisp_copy(l, get_proc_code(src)),
-				lisp_copy(l, get_proc_env(src)),
-				NULL,
+				copy_env(l, get_proc_env(src)),
 				get_func_docstring(src));
+	case REF:
+	case CODE:
+		return src;
+	case FRAME:
+	{
+		size_t n = get_frame_count(src);
+		lisp_cell_t *f = mk_frame(l, copy_env(l, get_frame_parent(src)), get_frame_names(src), n, n);
+		for (size_t i = 0; i < n; i++) {
+			lisp_cell_t *v = lisp_copy(l, src->p[FRAME_HEADER + i].v);
+			LISP_GC_BARRIER(f);
+			f->p[FRAME_HEADER + i].v = v;
+		}
+		return f;
+	}
 	case IO:
 	case USERDEF:
 		LISP_RECOVER(l, "%y'cannot-copy%t\n %S", src);
@@ -443,27 +663,120 @@ lisp_cell_t *lisp_copy(lisp_t *l, lisp_cell_t *src) {
 
 /***************************** environment ************************************/
 
-static lisp_cell_t *function_args(lisp_t * l, lisp_cell_t *proc, lisp_cell_t * vals) {
+/**@brief number of variables a procedure with the argument list "args"
+ * binds, a symbol at the end of the list (or in place of it) gets a
+ * variable holding the rest of the arguments*/
+static size_t arg_count(lisp_cell_t * args) {
+	size_t n = 0;
+	for (; is_cons(args); args = cdr(args))
+		n++;
+	return n + !is_nil(args);
+}
+
+/**@brief find the slot of the last of the first "count" names in a frame's
+ * list of names that is "sym", later names shadow earlier ones
+ * @return the slot or REF_FREE if it is not there*/
+static size_t names_find(lisp_cell_t * names, size_t count, lisp_cell_t * sym) {
+	size_t found = REF_FREE;
+	for (size_t i = 0; i < count; i++) {
+		lisp_cell_t *n = is_cons(names) ? car(names) : names;
+		if ((is_cons(n) ? car(n) : n) == sym)
+			found = i;
+		if (is_cons(names))
+			names = cdr(names);
+	}
+	return found;
+}
+
+/**@brief find the (symbol . value) pair of a variable in a hash table
+ * of an environment, the top level one need not be looked in as its
+ * symbols hold their pair themselves*/
+static inline lisp_cell_t *hash_binding(lisp_cell_t * hash, lisp_cell_t * sym) {
+	hash_table_t *h = get_hash(hash);
+	if (h->top && get_sym_global(sym))
+		return get_sym_global(sym);
+	return hash_lookup_hashed(h, get_sym(sym), get_sym_hash(sym));
+}
+
+/**@brief find where a variable is kept by looking its name up in an
+ * environment, a chain of frames ending in an association list which can
+ * also hold hash tables, like the top level environment does
+ * @return the frame or (symbol . value) pair the value is in, with the
+ * field it is in put in "field", or NULL if the variable is unbound*/
+lisp_cell_t *env_find(lisp_cell_t * sym, lisp_cell_t * env, size_t *field) {
+	assert(sym && env && field);
+	lisp_cell_t *t;
+	for (;;) {
+		if (TYPE_OF(env) == FRAME) {
+			size_t i = names_find(get_frame_names(env), get_frame_count(env), sym);
+			if (i != REF_FREE)
+				return *field = FRAME_HEADER + i, env;
+			env = get_frame_parent(env);
+		} else if (is_cons(env)) {
+			if (is_cons(t = car(env)) ? car(t) == sym : is_hash(t) && (t = hash_binding(t, sym)))
+				return *field = 1, t;
+			env = cdr(env);
+		} else {
+			return NULL;
+		}
+	}
+}
+/**@brief find where the variable a REF refers to is kept, the frame it
+ * was resolved to is found without looking at any names. Code is only
+ * resolved against the environment it runs in, but if a REF ends up
+ * somewhere else it is looked up by name instead.
+ * @return see env_find*/
+lisp_cell_t *ref_find(lisp_cell_t * ref, lisp_cell_t * env, size_t *field) {
+	assert(ref && env && field);
+	lisp_cell_t *f = env;
+	size_t slot = get_ref_slot(ref);
+	for (size_t d = get_ref_depth(ref); d; d--) {
+		if (TYPE_OF(f) != FRAME)
+			return env_find(get_ref_sym(ref), env, field);
+		f = get_frame_parent(f);
+	}
+	if (slot == REF_FREE)
+		return env_find(get_ref_sym(ref), f, field);
+	if (TYPE_OF(f) != FRAME || slot >= get_frame_count(f))
+		return env_find(get_ref_sym(ref), env, field);
+	*field = FRAME_HEADER + slot;
+	return f;
+}
+
+/**@brief bind the arguments of a procedure in a new frame, procedures
+ * without any arguments use their environment as it is*/
+lisp_cell_t *function_args(lisp_t * l, lisp_cell_t *proc, lisp_cell_t * vals) {
 	assert(l && proc && vals);
 	lisp_cell_t *env = dynamic_on ? l->cur_env : get_proc_env(proc);
-       	lisp_cell_t *syms = get_proc_args(proc);
-	size_t i = 0, expect = get_length(get_proc_args(proc));
-	if(!expect)
+	lisp_cell_t *f;
+	size_t i, fixed = get_proc_fixed(proc), count = get_proc_count(proc);
+	if (!count)
 		return env;
-	const size_t test = is_sym(syms) ? 0 : 1;
-	for (i = 0; is_cons(syms) && is_cons(vals); syms = cdr(syms), vals = cdr(vals), i++)
-		env = lisp_extend(l, env, car(syms), car(vals));
-	if(!is_nil(syms))
-		env = lisp_extend(l, env, syms, vals);
-	if(test && expect != i)
+	f = mk_frame(l, env, get_proc_args(proc), count, count);
+	for (i = 0; i < fixed && is_cons(vals); vals = cdr(vals), i++)
+		f->p[FRAME_HEADER + i].v = car(vals);
+	if (count > fixed)
+		f->p[FRAME_HEADER + fixed].v = vals;
+	if (i != fixed)
 		LISP_RECOVER(l, "%y'argument-count-error%t\n %S\n '%S", proc, vals);
-	return env;
+	return f;
 }
 
 lisp_cell_t *lisp_extend_top(lisp_t * l, lisp_cell_t * sym, lisp_cell_t * val) {
 	assert(l && sym && val);
-	if (hash_insert(get_hash(l->top_hash), get_str(sym), cons(l, sym, val)) < 0)
+	lisp_cell_t *binding = get_sym_global(sym);
+	if (binding) { /*redefined, in place so whatever found it sees the change*/
+		LISP_REBIND(l, cdr(binding));
+		set_cdr(binding, val);
+		return val;
+	}
+	binding = cons(l, sym, val);
+	if (hash_insert_hashed(get_hash(l->top_hash), get_sym(sym), get_sym_hash(sym), binding) < 0)
 		lisp_out_of_memory(l);
+	if (!sym->uncollectable) { /*special symbols are shared by all interpreters*/
+		LISP_GC_BARRIER(sym);
+		sym->p[3].v = binding;
+	}
 	return val;
 }
 
@@ -473,10 +786,12 @@ lisp_cell_t *lisp_assoc(lisp_cell_t * key, lisp_cell_t * alist) {
 	assert(key && alist);
 	for (; is_cons(alist); alist = cdr(alist))
 		if (is_cons(car(alist))) {	/*normal assoc */
-			if (get_int(CAAR(alist)) == get_int(key))
+			if (get_int(CAAR(alist)) == get_int(key) && is_int(CAAR(alist)) == is_int(key))
 				return car(alist);
 		} else if (is_hash(car(alist)) && is_asciiz(key)) {	/*assoc extended with hashes */
-			lisp_cell_t *lookup = hash_lookup(get_hash(car(alist)), get_str(key));
+			lisp_cell_t *lookup = is_sym(key) ?
+				hash_binding(car(alist), key) :
+				hash_lookup(get_hash(car(alist)), get_str(key));
 			if (lookup)
 				return lookup;
 		}
@@ -485,55 +800,215 @@ lisp_cell_t *lisp_assoc(lisp_cell_t * key, lisp_cell_t * alist) {
 	return gsym_nil();
 }
 
-/******************************** evaluator ***********************************/
+/********************************* resolver ***********************************/
 
-/** @brief "Compile" an expression, that is, perform optimizations
- *         and bind as many variables as possible. This function
- *         is a work in progress.
- *  @bug  This function really, really needs fixing.
- *  @bug  F-Expressions should be prevent compilation of their arguments
- *  @todo Add warning about unbound variables
- **/
-static lisp_cell_t *binding_lambda(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * env) {
-	if (depth > MAX_RECURSION_DEPTH)
-		LISP_RECOVER(l, "%y'recursion-depth-reached%t %d", depth);
+/**@brief The variables in scope at some point in the code being resolved,
+ * innermost first, the frames of the environment the code is resolved
+ * against come after the last of these.*/
+typedef struct scope {
+	lisp_cell_t *names;     /**< list the names are taken from, as for a frame*/
+	size_t count;           /**< number of names in use*/
+	const struct scope *up; /**< enclosing scope, or NULL*/
+} scope_t;
+
+lisp_cell_t *rcons(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
+	lisp_cell_t *r = cons(l, x, y);
+	r->resolved = 1;
+	return r;
+}
+
+static lisp_cell_t *resolve_sym(lisp_t * l, lisp_cell_t * sym, const scope_t * s, lisp_cell_t * env) {
+	size_t depth = 0, slot;
+	for (; s; s = s->up, depth++)
+		if ((slot = names_find(s->names, s->count, sym)) != REF_FREE)
+			return mk_ref(l, sym, depth, slot);
+	for (; TYPE_OF(env) == FRAME; env = get_frame_parent(env), depth++)
+		if ((slot = names_find(get_frame_names(env), get_frame_count(env), sym)) != REF_FREE)
+			return mk_ref(l, sym, depth, slot);
+	return mk_ref(l, sym, depth, REF_FREE);
+}
+
+static lisp_cell_t *resolve(lisp_t * l, unsigned depth, lisp_cell_t * exp, const scope_t * s, lisp_cell_t * env);
+static lisp_cell_t *macro_expand(lisp_t * l, unsigned depth, lisp_cell_t * macro, lisp_cell_t * args);
+
+static lisp_cell_t *resolve_list(lisp_t * l, unsigned depth, lisp_cell_t * exps, const scope_t * s, lisp_cell_t * env) {
+	if (!is_cons(exps))
+		return exps;
+	lisp_cell_t *head = rcons(l, resolve(l, depth, car(exps), s, env), l->nil), *op = head;
+	for (exps = cdr(exps); is_cons(exps); exps = cdr(exps), op = cdr(op))
+		set_cdr(op, rcons(l, resolve(l, depth, car(exps), s, env), l->nil));
+	set_cdr(op, exps); /*anything after a dot is left as it is*/
+	return head;
+}
+
+/**@brief resolve the body of a procedure, in the frame its arguments are
+ * bound in by function_args*/
+static lisp_cell_t *resolve_body(lisp_t * l, unsigned depth, lisp_cell_t * args, lisp_cell_t * body, const scope_t * s, lisp_cell_t * env) {
+	const scope_t inner = { args, arg_count(args), s };
+	return resolve_list(l, depth, body, inner.count ? &inner : s, env);
+}
+
+/**@brief resolve a "let", which binds all of its variables in one frame,
+ * the expression each is bound to sees itself and those bound before it*/
+static lisp_cell_t *resolve_let(lisp_t * l, unsigned depth, lisp_cell_t * exp, const scope_t * s, lisp_cell_t * env) {
+	lisp_cell_t *b, *head = rcons(l, car(exp), l->nil), *op = head;
+	scope_t inner = { cdr(exp), 0, s };
+	for (b = cdr(exp); is_cons(b); b = cdr(b))
+		if (!is_nil(cdr(b)) && (!is_cons(car(b)) || !lisp_check_length(car(b), 2)))
+			return exp; /*the evaluator reports the error*/
+	if (!is_nil(b))
+		return exp;
+	for (b = cdr(exp); !is_nil(cdr(b)); b = cdr(b), op = cdr(op)) {
+		inner.count++;
+		set_cdr(op, rcons(l, rcons(l, CAAR(b),
+			rcons(l, resolve(l, depth, CADAR(b), &inner, env), l->nil)), l->nil));
+	}
+	set_cdr(op, rcons(l, resolve(l, depth, car(b), &inner, env), l->nil));
+	return head;
+}
 
-	if(is_sym(exp)) {
-		lisp_cell_t *t = lisp_assoc(exp, env);
-		return !is_nil(t) ? cdr(t) : exp;
+/**@brief Resolve code before it is run, variables bound by the procedures
+ * and "let"s the code is in become a REF to the frame and slot they will
+ * be in, so no names are looked at to find them, and other variables
+ * become a REF to where the frames end. What cannot be resolved is left as
+ * it is and found by name as before, that is quoted data, the arguments
+ * of F-expressions, "compile" and "macro", forms the evaluator would
+ * reject and the arguments of calls to what is not known until it is
+ * evaluated, which might turn out to be a special form. Calls to macros
+ * that are known are expanded and the expansion is resolved instead. The
+ * code is copied, not changed. */
+static lisp_cell_t *resolve(lisp_t * l, unsigned depth, lisp_cell_t * exp, const scope_t * s, lisp_cell_t * env) {
+	lisp_cell_t *first, *args, *t;
+	size_t field;
+	if (depth > l->max_depth)
+		LISP_RECOVER(l, "%y'recursion-depth-reached%t %d", depth);
+	if (is_sym(exp))
+		return is_nil(exp) ? exp : resolve_sym(l, exp, s, env);
+	if (!is_cons(exp) || exp->resolved)
+		return exp;
+	first = car(exp);
+	args = cdr(exp);
+	depth++;
+	if (first == l->quote || first == l->compile || first == l->macro)
+		return exp;
+	if (first == l->iif || first == l->progn || first == l->dowhile)
+		return rcons(l, first, resolve_list(l, depth, args, s, env));
+	if (first == l->lambda) {
+		lisp_cell_t *doc = NULL;
+		if (get_length(args) < 2)
+			return exp;
+		if (!is_nil(car(args)) && is_str(car(args))) {
+			doc = car(args);
+			args = cdr(args);
+		}
+		t = rcons(l, car(args), resolve_body(l, depth, car(args), cdr(args), s, env));
+		return rcons(l, first, doc ? rcons(l, doc, t) : t);
 	}
-	lisp_cell_t *op = cons(l, l->nil, l->nil);
-	lisp_cell_t *head = op;
-	for (; is_cons(exp); exp = cdr(exp), op = cdr(op)) {
-		lisp_cell_t *code = car(exp), *t = NULL;
-		if (is_sym(car(exp)) && !is_nil(t = lisp_assoc(car(exp), env)))
-			code = cdr(t);
-		else if (is_cons(car(exp)) && (CAAR(exp) != l->quote))
-			code = binding_lambda(l, depth + 1, car(exp), env);
-		else
-			code = car(exp);
-		set_cdr(op, cons(l, code, l->nil));
+	if (first == l->flambda) {
+		if (get_length(args) < 3 || !is_str(car(args)) || !lisp_check_length(CADR(args), 1))
+			return exp;
+		t = rcons(l, CADR(args), resolve_body(l, depth, CADR(args), CDDR(args), s, env));
+		return rcons(l, first, rcons(l, car(args), t));
 	}
-	if (!is_nil(exp))
-		LISP_RECOVER(l, "%r\"compile cannot eval dotted pairs\"%t\n '%S", head);
-	return cdr(head);
+	if (first == l->let)
+		return get_length(args) < 2 ? exp : resolve_let(l, depth, exp, s, env);
+	if (first == l->setq || first == l->define) {
+		if (!lisp_check_length(args, 2) || !is_sym(car(args)))
+			return exp;
+		t = rcons(l, resolve(l, depth, CADR(args), s, env), l->nil);
+		t = rcons(l, first == l->setq ? resolve_sym(l, car(args), s, env) : car(args), t);
+		return rcons(l, first, t);
+	}
+	if (first == l->cond) {
+		lisp_cell_t *head = rcons(l, first, l->nil), *op = head;
+		for (; is_cons(args); args = cdr(args), op = cdr(op))
+			set_cdr(op, rcons(l, resolve_list(l, depth, car(args), s, env), l->nil));
+		set_cdr(op, args);
+		return head;
+	}
+	if (is_cons(first))
+		return rcons(l, resolve(l, depth, first, s, env), args);
+	t = resolve(l, depth, first, s, env);
+	if (is_fproc(first))
+		return rcons(l, t, args);
+	if (is_macro(first))
+		return resolve(l, depth, macro_expand(l, depth, first, args), s, env);
+	if (TYPE_OF(t) == REF && get_ref_slot(t) == REF_FREE) {
+		lisp_cell_t *holder = env_find(first, env, &field);
+		if (holder && is_fproc(holder->p[field].v))
+			return rcons(l, t, args);
+		if (holder && is_macro(holder->p[field].v))
+			return resolve(l, depth, macro_expand(l, depth, holder->p[field].v, args), s, env);
+	}
+	return rcons(l, t, resolve_list(l, depth, args, s, env));
+}
+
+/**@brief F-expressions are given their arguments as they were written,
+ * only code that has been resolved needs to be copied*/
+static lisp_cell_t *unresolve(lisp_t * l, lisp_cell_t * exp) {
+	if (TYPE_OF(exp) == REF)
+		return get_ref_sym(exp);
+	if (!is_cons(exp) || !exp->resolved)
+		return exp;
+	return cons(l, unresolve(l, car(exp)), unresolve(l, cdr(exp)));
+}
+
+/**@brief expand a call to a macro, its body is run with its arguments
+ * bound to the expressions it was given, as they were written, and what
+ * that returns is the code that is run in place of the call*/
+static lisp_cell_t *macro_expand(lisp_t * l, unsigned depth, lisp_cell_t * macro, lisp_cell_t * args) {
+	lisp_cell_t *env, *body, *r = l->nil;
+	lisp_gc_add(l, macro);
+	env = lisp_gc_add(l, function_args(l, macro, lisp_gc_add(l, unresolve(l, args))));
+	for (body = proc_body(l, macro); is_cons(body); body = cdr(body))
+		r = eval(l, depth + 1, car(body), env);
+	return lisp_gc_add(l, r);
+}
+
+/**@brief get the body of a procedure resolved against its environment,
+ * which is done when it is first called unless it was resolved along with
+ * the code that made it*/
+lisp_cell_t *proc_body(lisp_t * l, lisp_cell_t * proc) {
+	if (!proc->p[3].v) {
+		lisp_cell_t *body = get_proc_code(proc);
+		if (!dynamic_on)
+			body = resolve_body(l, 0, get_proc_args(proc), body, NULL, get_proc_env(proc));
+		LISP_GC_BARRIER(proc);
+		proc->p[3].v = body;
+	}
+	return proc->p[3].v;
+}
+
+lisp_cell_t *proc_resolve(lisp_t * l, lisp_cell_t * proc) {
+	lisp_cell_t *body = proc->p[3].v;
+	if (body && TYPE_OF(body) != CODE)
+		return body; /*not compiled yet, and resolved code is not changed*/
+	return resolve_body(l, 0, get_proc_args(proc), get_proc_code(proc), NULL, get_proc_env(proc));
 }
 
+/******************************** evaluator ***********************************/
+
 static lisp_cell_t *evlis(lisp_t * l, unsigned depth, lisp_cell_t * exps, lisp_cell_t * env);
 lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * env) {
 	assert(l);
-	size_t gc_stack_save = l->gc_stack_used;
-	lisp_cell_t *tmp, *first, *proc, *ret = NULL, *vals = l->nil;
+	size_t gc_stack_save = l->gc_stack_used, gc_stack_kept, field;
+	lisp_cell_t *tmp, *first, *proc, *form, *ret = NULL, *vals = l->nil;
 #define DEBUG_RETURN(EXPR) do { ret = (EXPR); goto debug; } while(0);
 	if(!exp || !env)
 		return NULL;
-	if (depth > MAX_RECURSION_DEPTH)
+	if (depth > l->max_depth)
 		LISP_RECOVER(l, "%y'recursion-depth-reached%t %d", 0);
-	lisp_gc_add(l, exp);
-	lisp_gc_add(l, env);
  tail:
 	if(!exp || !env)
 		return NULL;
+	/*only the expression and environment are needed after a tail call,
+	 *anything else made by this invocation is garbage from here on*/
+	l->gc_stack_used = gc_stack_save;
+	lisp_gc_add(l, exp);
+	lisp_gc_add(l, env);
+	/*the environment can be a frame made by this invocation, which nothing
+	 *else refers to, so these two are kept until the next tail call*/
+	gc_stack_kept = l->gc_stack_used;
 	lisp_log_debug(l, "%y'eval%t '%S", exp);
 	if (is_nil(exp))
 		return exp;
@@ -543,7 +1018,7 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 		lisp_throw(l, 1);
 	}
 
-	switch (exp->type) {
+	switch (TYPE_OF(exp)) {
 	case INTEGER:
 	case SUBR:
 	case PROC:
@@ -553,14 +1028,22 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 	case HASH:
 	case FPROC:
 	case USERDEF:
+	case FRAME:
+	case CODE:
+	case MACRO:
 		return exp;	/*self evaluating types */
 	case SYMBOL:
 		/* checks could be added here so special forms are not looked
 		 * up, but only if this improves the speed of things*/
-		if (is_nil(tmp = lisp_assoc(exp, env)))
+		if (!(tmp = env_find(exp, env, &field)))
 			LISP_RECOVER(l, "%r\"unbound symbol\"\n %y'%s%t", get_sym(exp));
-		DEBUG_RETURN(cdr(tmp));
+		DEBUG_RETURN(tmp->p[field].v);
+	case REF:
+		if (!(tmp = ref_find(exp, env, &field)))
+			LISP_RECOVER(l, "%r\"unbound symbol\"\n %y'%s%t", get_sym(get_ref_sym(exp)));
+		DEBUG_RETURN(tmp->p[field].v);
 	case CONS:
+		form = exp;
 		first = car(exp);
 		exp = cdr(exp);
 
@@ -579,12 +1062,13 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 			LISP_RECOVER(l, "%y'evaluation\n %r\"cannot eval dotted pair\"%t\n '%S", exp);
 		if (is_cons(first))
 			first = eval(l, depth + 1, first, env);
-		if (first == l->iif) {
+		switch (FORM_OF(first)) {
+		case FORM_iif:
 			LISP_VALIDATE_ARGS(l, "if", 3, "A A A", exp, 1);
 			exp = !is_nil(eval(l, depth + 1, car(exp), env)) ? CADR(exp) : CADDR(exp);
 			goto tail;
-		}
-		if (first == l->lambda) {
+		case FORM_lambda:
+		{
 			lisp_cell_t *doc;
 			if (get_length(exp) < 2)
 				LISP_RECOVER(l, "%y'lambda\n %r\"argc < 2\"%t\n '%S\"", exp);
@@ -594,19 +1078,23 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 			} else {
 				doc = l->empty_docstr;
 			}
-			l->gc_stack_used = gc_stack_save;
+			l->gc_stack_used = gc_stack_kept;
 			tmp = mk_proc(l, car(exp), cdr(exp), env, doc);
+			if (is_cons(cdr(exp)) && cdr(exp)->resolved) /*along with this code*/
+				tmp->p[3].v = cdr(exp);
 			DEBUG_RETURN(lisp_gc_add(l, tmp));
 		}
-		if (first == l->flambda) {
+		case FORM_flambda:
 			if (get_length(exp) < 3 || !is_str(car(exp)) || !is_cons(CADR(exp)))
 				LISP_RECOVER(l, "%y'flambda\n %r\"expected (string (arg) code...)\"%t\n '%S", exp);
 			if (!lisp_check_length(CADR(exp), 1) || !is_sym(car(CADR(exp))))
 				LISP_RECOVER(l, "%y'flambda\n %r\"only one symbol argument allowed\"%t\n '%S", exp);
-			l->gc_stack_used = gc_stack_save;
-			DEBUG_RETURN(lisp_gc_add(l, mk_fproc(l, CADR(exp), CDDR(exp), env, car(exp))));
-		}
-		if (first == l->cond) {
+			l->gc_stack_used = gc_stack_kept;
+			tmp = mk_fproc(l, CADR(exp), CDDR(exp), env, car(exp));
+			if (is_cons(CDDR(exp)) && CDDR(exp)->resolved)
+				tmp->p[3].v = CDDR(exp);
+			DEBUG_RETURN(lisp_gc_add(l, tmp));
+		case FORM_cond:
 			if (lisp_check_length(exp, 0))
 				DEBUG_RETURN(l->nil);
 			for (tmp = l->nil; is_nil(tmp) && !is_nil(exp); exp = cdr(exp)) {
@@ -619,65 +1107,75 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 				}
 			}
 			DEBUG_RETURN(l->nil);
-		}
-		if (first == l->quote)
+		case FORM_quote:
 			DEBUG_RETURN(car(exp));
-		if (first == l->define) {
+		case FORM_define:
 			LISP_VALIDATE_ARGS(l, "define", 2, "s A", exp, 1);
-			l->gc_stack_used = gc_stack_save;
+			l->gc_stack_used = gc_stack_kept;
 			DEBUG_RETURN(lisp_gc_add(l, lisp_extend_top(l, car(exp), eval(l, depth + 1, CADR(exp), env))));
-		}
-		if (first == l->setq) {
-			lisp_cell_t *pair, *newval;
-			LISP_VALIDATE_ARGS(l, "setq", 2, "s A", exp, 1);
-			if (is_nil(pair = lisp_assoc(car(exp), env)))
+		case FORM_setq:
+		{
+			lisp_cell_t *holder, *newval;
+			if (TYPE_OF(car(exp)) == REF) {
+				holder = ref_find(car(exp), env, &field);
+			} else {
+				LISP_VALIDATE_ARGS(l, "setq", 2, "s A", exp, 1);
+				holder = env_find(car(exp), env, &field);
+			}
+			if (!holder)
 				LISP_RECOVER(l, "%y'setq\n %r\"undefined variable\"%t\n '%S", exp);
 			newval = eval(l, depth + 1, CADR(exp), env);
-			set_cdr(pair, newval);
+			if (TYPE_OF(holder) != FRAME)
+				LISP_REBIND(l, holder->p[field].v);
+			LISP_GC_BARRIER(holder);
+			holder->p[field].v = newval;
 			DEBUG_RETURN(newval);
 		}
-		if (first == l->compile) {
-			lisp_cell_t *doc;
+		case FORM_compile: /*an optimized lambda, compiled before it is first used*/
 			LISP_VALIDATE_ARGS(l, "compile", 3, "Z L A", exp, 1);
-			doc = car(exp);
 			for (tmp = CADR(exp); !is_nil(tmp); tmp = cdr(tmp))
 				if (!is_sym(car(tmp)) || !is_proper_cons(tmp))
 					LISP_RECOVER(l, "%y'lambda\n %r\"expected only symbols (or nil) as arguments\"%t\n %S", exp);
-				else
-					env = lisp_extend(l, env, car(tmp), car(tmp));
-			tmp = binding_lambda(l, depth + 1, CADDR(exp), env);
-			DEBUG_RETURN(mk_proc(l, CADR(exp), cons(l, tmp, l->nil), env, doc));
-		}
-		if (first == l->let) {
-			lisp_cell_t *r = NULL, *s = NULL;
-			if (get_length(exp) < 2)
+			l->gc_stack_used = gc_stack_kept;
+			tmp = lisp_gc_add(l, mk_proc(l, CADR(exp), CDDR(exp), env, car(exp)));
+			if (!dynamic_on)
+				vm_optimize(l, tmp);
+			DEBUG_RETURN(tmp);
+		case FORM_let:
+		{
+			size_t n = get_length(exp);
+			if (n < 2)
 				LISP_RECOVER(l, "%y'let\n %r\"argc < 2\"%t\n '%S", exp);
-			tmp = exp;
-			for (; !is_nil(cdr(exp)); exp = cdr(exp)) {
+			/*each variable is in scope from the expression it is bound to onwards*/
+			tmp = env = mk_frame(l, env, exp, n - 1, 0);
+			for (size_t i = 0; !is_nil(cdr(exp)); exp = cdr(exp), i++) {
 				if (!is_cons(car(exp)) || !lisp_check_length(car(exp), 2))
-					LISP_RECOVER(l, "%y'let\n %r\"expected list of length 2\"%t\n '%S\n '%S", car(exp), tmp);
-				s = env = lisp_extend(l, env, CAAR(exp), l->nil);
-				r = env = lisp_extend(l, env, CAAR(exp), eval(l, depth + 1, CADAR(exp), env));
-				set_cdr(car(s), CDAR(r));
+					LISP_RECOVER(l, "%y'let\n %r\"expected list of length 2\"%t\n '%S\n '%S", car(exp), get_frame_names(tmp));
+				tmp->p[2].v = (void *)(i + 1);
+				lisp_cell_t *val = eval(l, depth + 1, CADAR(exp), env);
+				LISP_GC_BARRIER(tmp);
+				tmp->p[FRAME_HEADER + i].v = val;
 			}
-			DEBUG_RETURN(eval(l, depth + 1, car(exp), env));
+			exp = car(exp);
+			goto tail;
 		}
-		if (first == l->progn) {
+		case FORM_progn:
+		{
 			lisp_cell_t *head = exp;
 			if (is_nil(exp))
 				DEBUG_RETURN(l->nil);
 			for (exp = head; !is_nil(cdr(exp)); exp = cdr(exp)) {
-				l->gc_stack_used = gc_stack_save;
+				l->gc_stack_used = gc_stack_kept;
 				(void)eval(l, depth + 1, car(exp), env);
 			}
 			exp = car(exp);
 			goto tail;
 		}
-
-		if(first == l->dowhile) {
+		case FORM_dowhile:
+		{
 			lisp_cell_t *wh = car(exp), *head = cdr(exp);
 			while(!is_nil(eval(l, depth + 1, wh, env))) {
-				l->gc_stack_used = gc_stack_save;
+				l->gc_stack_used = gc_stack_kept;
 				for(exp = head; is_cons(exp); exp = cdr(exp))
 					(void)eval(l, depth + 1, car(exp), env);
 				if(!is_nil(exp))
@@ -685,30 +1183,96 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 			}
 			DEBUG_RETURN(l->nil);
 		}
-
-		if(first == l->macro) {
-			/**@todo implement me*/
+		case FORM_macro:
+		{
+			lisp_cell_t *doc = l->empty_docstr;
+			if (get_length(exp) < 2)
+				LISP_RECOVER(l, "%y'macro\n %r\"argc < 2\"%t\n '%S\"", exp);
+			if (!is_nil(car(exp)) && is_str(car(exp))) {	/*have docstring */
+				doc = car(exp);
+				exp = cdr(exp);
+			}
+			l->gc_stack_used = gc_stack_kept;
+			DEBUG_RETURN(lisp_gc_add(l, mk_macro(l, car(exp), cdr(exp), env, doc)));
+		}
+		case FORM_NONE:
+			break;
 		}
 
 		proc = eval(l, depth + 1, first, env);
+		if (is_macro(proc)) { /*the call is replaced by its expansion, which is run from now on*/
+			tmp = macro_expand(l, depth, proc, exp);
+			if (!is_cons(tmp))
+				tmp = cons(l, l->progn, cons(l, tmp, l->nil));
+			LISP_GC_BARRIER(form);
+			set_car(form, car(tmp));
+			set_cdr(form, cdr(tmp));
+			form->resolved = 0;
+			exp = form;
+			goto tail;
+		}
+		if (is_subr(proc) && get_subr_direct(proc) && get_length(proc) == get_length(exp)) {
+			lisp_cell_t *argv[SUBR_DIRECT_MAX]; /*no list is made for these*/
+			size_t n = 0;
+			lisp_gc_add(l, proc);
+			for (; is_cons(exp); exp = cdr(exp)) /*kept from the collector until the call*/
+				argv[n++] = lisp_gc_add(l, eval(l, depth + 1, car(exp), env));
+			l->cur_depth = depth;
+			l->cur_env = env;
+			DEBUG_RETURN(subr_call(l, proc, argv, n));
+		}
+		if (is_proc(proc) && get_proc_count(proc) == get_proc_fixed(proc) && get_proc_fixed(proc) == get_length(exp)) {
+			/*their values go straight into the frame, no list is made*/
+			size_t n = get_proc_count(proc);
+			lisp_cell_t *f = dynamic_on ? env : get_proc_env(proc);
+			lisp_gc_add(l, proc);
+			if (n)
+				f = lisp_gc_add(l, mk_frame(l, f, get_proc_args(proc), n, n));
+			for (size_t i = 0; is_cons(exp); exp = cdr(exp), i++) {
+				tmp = eval(l, depth + 1, car(exp), env);
+				LISP_GC_BARRIER(f); /*which could have been made old*/
+				f->p[FRAME_HEADER + i].v = tmp;
+			}
+			l->cur_depth = depth;
+			l->cur_env = env;
+			if (!dynamic_on)
+				DEBUG_RETURN(vm_enter(l, depth, proc, f));
+			env = f;
+			goto body;
+		}
 		if (is_proc(proc) || is_subr(proc)) /*eval their args */
 			vals = evlis(l, depth + 1, exp, env);
 		else if (is_fproc(proc)) /*f-expr do not eval their args */
-			vals = cons(l, exp, l->nil);
+			vals = cons(l, unresolve(l, exp), l->nil);
 		else
 			LISP_RECOVER(l, "%r\"not a procedure\"%t\n '%S", first);
 		l->cur_depth = depth;	/*tucked away for function use */
 		l->cur_env = env;	/*also tucked away */
 		if (is_subr(proc)) {
-			l->gc_stack_used = gc_stack_save;
+			l->gc_stack_used = gc_stack_kept;
 			lisp_gc_add(l, proc);
 			lisp_gc_add(l, vals);
 			lisp_validate_cell(l, proc, vals, 1);
 			DEBUG_RETURN((*get_subr(proc)) (l, vals));
 		}
+		if (is_proc(proc) && !dynamic_on) {
+			l->gc_stack_used = gc_stack_kept;
+			lisp_gc_add(l, proc);
+			lisp_gc_add(l, vals);
+			DEBUG_RETURN(vm_apply(l, depth, proc, vals));
+		}
 		if (is_proc(proc) || is_fproc(proc)) {
 			env = function_args(l, proc, vals);
-			exp = cons(l, l->progn, get_proc_code(proc));
+ body:			/*as progn would evaluate it, without making a form to do so*/
+			l->gc_stack_used = gc_stack_kept;
+			lisp_gc_add(l, proc);
+			lisp_gc_add(l, env);
+			gc_stack_kept = l->gc_stack_used;
+			for (tmp = proc_body(l, proc); is_cons(cdr(tmp)); tmp = cdr(tmp)) {
+				l->gc_stack_used = gc_stack_kept;
+				(void)eval(l, depth + 1, car(tmp), env);
+			}
+			exp = car(tmp);
 			goto tail;
 		}
 		LISP_RECOVER(l, "%r\"not a procedure\"%t\n '%S", first);
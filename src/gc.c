@@ -8,20 +8,34 @@
 #include "private.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**@brief offset of the first slot in a heap block, rounded up so the
+ * slots are suitably aligned*/
+#define HEAP_BLOCK_HEADER \
+	(((sizeof(heap_block_t) + sizeof(lisp_cell_t) - 1) / sizeof(lisp_cell_t)) * sizeof(lisp_cell_t))
+
+/**@brief the size in bytes of a cell with FIELDS fields*/
+#define CELL_SIZE(FIELDS) (sizeof(lisp_cell_t) + ((FIELDS) - 1) * sizeof(cell_data_t))
 
 void lisp_gc_used(lisp_cell_t *x) {
 	assert(x);
-	x->used = 1;
+	if (!IS_IMMEDIATE(x))
+		x->used = 1;
 }
 
 void lisp_gc_not_used(lisp_cell_t *x) {
 	assert(x);
-	x->used = 0;
+	if (!IS_IMMEDIATE(x))
+		x->used = 0;
 }
 
+/**@brief free a lisp cell and anything it owns, cells that belong to the
+ * cell heap only have what they own freed, their slot is reclaimed by the
+ * sweep of the block they are in*/
 static void gc_free(lisp_t * l, lisp_cell_t * x) {
 	assert(l);
-        /*assert(op) *//**< free a lisp cell*/
 	if (!x || x->uncollectable || x->used)
 		return;
 	switch (x->type) {
@@ -29,78 +43,175 @@ static void gc_free(lisp_t * l, lisp_cell_t * x) {
 	case CONS:
 	case FLOAT:
 	case PROC:
-	case SUBR:
 	case FPROC:
-		free(x);
+	case MACRO:
+	case FRAME:
+	case REF:
+		break;
+	case SUBR:
+		free(x->p[5].v); /*its compiled validation format*/
+		break;
+	case CODE:
+		free(x->p[0].v);
 		break;
 	case STRING:
 		free(get_str(x));
-		free(x);
 		break;
-	case SYMBOL:
-		free(get_sym(x));
-		free(x);
+	case SYMBOL: /*names are freed along with the interpreter*/
 		break;
 	case IO:
 		if (!x->close)
 			io_close(get_io(x));
-		free(x);
 		break;
 	case HASH:
 		hash_destroy(get_hash(x));
-		free(x);
 		break;
-	case USERDEF:
+	case USERDEF: /*never in the cell heap, user free functions free the cell*/
 		if (l->ufuncs[get_user_type(x)].free)
 			(l->ufuncs[get_user_type(x)].free) (x);
 		else
 			free(x);
-		break;
+		return;
 	case INVALID:
 	default:
 		FATAL("internal inconsistency");
 		break;
 	}
+	if (!x->heap)
+		free(x);
 }
 
-void lisp_gc_mark(lisp_t * l, lisp_cell_t * op) {
-	assert(l);
-        /*assert(op); *//**<recursively mark reachable cells*/
-	if (!op || op->mark)
+/**@brief get the heap block a cell from the cell heap is in*/
+static heap_block_t *block_of(lisp_cell_t *x) {
+	return (heap_block_t*)((uintptr_t)x & ~(uintptr_t)(HEAP_BLOCK_SIZE - 1));
+}
+
+/**@brief get a slot of a heap block*/
+static lisp_cell_t *block_slot(heap_block_t *b, size_t i) {
+	return (lisp_cell_t*)((char*)b + HEAP_BLOCK_HEADER + i * b->size);
+}
+
+/**@brief push a cell onto one of the growable stacks of cells the
+ * collector keeps
+ * @return zero on success, negative if the stack could not be grown*/
+static int cell_stack_push(lisp_cell_t ***stack, size_t *used, size_t *allocated, lisp_cell_t *x) {
+	if (*used >= *allocated) {
+		size_t len = *allocated ? *allocated * 2 : DEFAULT_LEN;
+		lisp_cell_t **r = realloc(*stack, len * sizeof(**stack));
+		if (!r)
+			return -1;
+		*stack = r;
+		*allocated = len;
+	}
+	(*stack)[(*used)++] = x;
+	return 0;
+}
+
+/**@brief put a marked cell on the grey stack, if it is full the cell is
+ * left marked and found later by gc_rescan()*/
+static void gc_grey_push(lisp_t *l, lisp_cell_t *x) {
+	if (l->gc_grey_used >= GC_GREY_MAX
+	|| cell_stack_push(&l->gc_grey, &l->gc_grey_used, &l->gc_grey_allocated, x) < 0)
+		l->gc_overflow = 1;
+}
+
+/**@brief shade a cell grey, it is marked and its fields are traced later
+ * when the grey stack is drained, cells that refer to nothing are black
+ * straight away, old cells are not traced by a minor collection and
+ * numbers held in the pointer are not cells at all*/
+static void gc_shade(lisp_t *l, lisp_cell_t *x) {
+	if (!x || IS_IMMEDIATE(x) || x->mark || (x->old && l->gc_minor))
+		return;
+	x->mark = 1;
+	switch (x->type) {
+	case SYMBOL:
+		if (x->p[3].v)
+			gc_grey_push(l, x);
 		return;
-	op->mark = 1;
-	switch (op->type) {
 	case INTEGER:
+	case STRING:
+	case IO:
+	case FLOAT:
+		return;
+	default:
+		gc_grey_push(l, x);
+	}
+}
+
+/**@brief shade the values in a hash table, starting at bin "bin" and
+ * looking at no more than "budget" bins, if the table is not finished
+ * with it is remembered so the next slice can carry on where this left off
+ * @return the amount of work done*/
+static size_t gc_scan_hash(lisp_t *l, lisp_cell_t *op, size_t bin, size_t budget) {
+	hash_table_t *h = get_hash(op);
+	hash_entry_t *e;
+	size_t bins = hash_bin_count(h);
+	size_t end = bin >= bins ? bins : /*the table might have shrunk*/
+		bins - bin > budget ? bin + budget : bins;
+	for (size_t i = bin; i < end; i++)
+		if ((e = hash_bin(h, i)))
+			gc_shade(l, e->val);
+	l->gc_partial = end < bins ? op : NULL;
+	l->gc_partial_bin = end;
+	return end - bin + 1;
+}
+
+/**@brief turn a grey cell black by shading everything it refers to
+ * @return the amount of work done*/
+static size_t gc_scan(lisp_t * l, lisp_cell_t * op, size_t budget) {
+	size_t work = 1;
+	op->dirty = 0;
+	switch (op->type) {
 	case SYMBOL:
+		gc_shade(l, op->p[3].v); /*its top level binding*/
+		break;
+	case INTEGER:
 	case STRING:
 	case IO:
 	case FLOAT:
 		break;
 	case SUBR:
-		lisp_gc_mark(l, get_func_docstring(op));
+		gc_shade(l, get_func_docstring(op));
 		break;
 	case FPROC:
 	case PROC:
-		lisp_gc_mark(l, get_proc_args(op));
-		lisp_gc_mark(l, get_proc_code(op));
-		lisp_gc_mark(l, get_proc_env(op));
-		lisp_gc_mark(l, get_func_docstring(op));
+	case MACRO:
+		gc_shade(l, get_proc_args(op));
+		gc_shade(l, get_proc_code(op));
+		gc_shade(l, get_proc_env(op));
+		gc_shade(l, op->p[3].v); /*the resolved body, if any*/
+		gc_shade(l, get_func_docstring(op));
+		gc_shade(l, op->p[7].v); /*the native code, if any*/
+		return 6;
+	case FRAME:
+		gc_shade(l, get_frame_parent(op));
+		gc_shade(l, op->p[1].v);
+		for (size_t i = 0; i < get_frame_count(op); i++)
+			gc_shade(l, op->p[FRAME_HEADER + i].v);
+		return work + get_frame_count(op);
+	case REF:
+		gc_shade(l, get_ref_sym(op));
 		break;
-	case CONS:
-		lisp_gc_mark(l, car(op));
-		lisp_gc_mark(l, cdr(op));
-		break;
-	case HASH:{
-			size_t i;
-			hash_entry_t *cur;
-			hash_table_t *h = get_hash(op);
-			for (i = 0; i < h->len; i++)
-				if (h->table[i])
-					for (cur = h->table[i]; cur; cur = cur->next)
-						lisp_gc_mark(l, cur->val);
-		}
+	case CODE:
+		gc_shade(l, op->p[1].v);
 		break;
-	case USERDEF:
+	case CONS: /*the cdr is followed in a loop, so lists take no stack*/
+		for (;;) {
+			lisp_cell_t *next = cdr(op);
+			gc_shade(l, car(op));
+			if (!next || TYPE_OF(next) != CONS || next->mark
+			|| (next->old && l->gc_minor) || work >= budget) {
+				gc_shade(l, next);
+				return work;
+			}
+			next->mark = 1;
+			next->dirty = 0;
+			op = next;
+			work++;
+		}
+	case HASH:
+		return gc_scan_hash(l, op, 0, budget);
+	case USERDEF: /*the mark function calls lisp_gc_mark, which shades*/
 		if (l->ufuncs[get_user_type(op)].mark)
 			(l->ufuncs[get_user_type(op)].mark) (op);
 		break;
@@ -108,27 +219,356 @@ void lisp_gc_mark(lisp_t * l, lisp_cell_t * op) {
 	default:
 		FATAL("internal inconsistency: unknown type");
 	}
+	return work;
 }
 
-void lisp_gc_sweep_only(lisp_t * l) {
+/**@brief trace every marked cell again, the grey stack overflowed so
+ * some of them have not been traced, this is slow but it is rare and it
+ * needs no memory
+ * @return the amount of work done*/
+static size_t gc_rescan(lisp_t *l) {
+	size_t work = 0;
+	l->gc_overflow = 0;
+	for (size_t i = 0; i < HEAP_CLASSES; i++)
+		for (heap_block_t *b = l->heap_blocks[i]; b; b = b->next)
+			for (size_t j = 0; j < b->count; j++) {
+				lisp_cell_t *x = block_slot(b, j);
+				if (x->type != INVALID && x->mark)
+					work += gc_scan(l, x, SIZE_MAX);
+			}
+	for (gc_list_t *v = l->gc_head; v; v = v->next)
+		if (v->ref->mark)
+			work += gc_scan(l, v->ref, SIZE_MAX);
+	return work;
+}
+
+/**@brief trace grey cells until there are none left or the budget is used up
+ * @return non zero if there are no grey cells left*/
+static int gc_drain(lisp_t *l, size_t budget) {
+	size_t work = 0;
+	l->gc_draining = 1;
+	while (work < budget) {
+		if (l->gc_partial)
+			work += gc_scan_hash(l, l->gc_partial, l->gc_partial_bin, budget - work);
+		else if (l->gc_grey_used)
+			work += gc_scan(l, l->gc_grey[--l->gc_grey_used], budget - work);
+		else if (l->gc_overflow)
+			work += gc_rescan(l);
+		else
+			break;
+	}
+	l->gc_draining = 0;
+	return !l->gc_grey_used && !l->gc_partial && !l->gc_overflow;
+}
+
+void lisp_gc_mark(lisp_t * l, lisp_cell_t * op) {
 	assert(l);
-	if (l->gc_off)
+	gc_shade(l, op);
+	/*an incremental collection traces the cell when it gets to it*/
+	if (!l->gc_draining && l->gc_phase == GC_IDLE)
+		gc_drain(l, SIZE_MAX);
+}
+
+void lisp_gc_write_barrier(lisp_cell_t *x) {
+	assert(x && (x->old || x->mark));
+	x->dirty = 1;
+	if (!x->heap) /*objects outside of the heap are found by walking their list*/
 		return;
+	lisp_t *l = block_of(x)->owner;
+	if (x->old) {
+		if (cell_stack_push(&l->gc_remembered, &l->gc_remembered_used, &l->gc_remembered_allocated, x) < 0)
+			lisp_out_of_memory(l);
+	} else if (l->gc_phase == GC_MARKING) { /*it might already be black*/
+		gc_grey_push(l, x);
+	}
+}
+
+/**@brief get a block ready to hold cells with a given number of fields,
+ * every slot in it is put on its free list*/
+static void block_init(lisp_t *l, heap_block_t *b, size_t fields) {
+	memset(b, 0, sizeof(*b));
+	b->owner  = l;
+	b->fields = fields;
+	b->size   = CELL_SIZE(fields);
+	b->count  = (HEAP_BLOCK_SIZE - HEAP_BLOCK_HEADER) / b->size;
+	for (size_t i = b->count; i-- > 0;) {
+		lisp_cell_t *x = block_slot(b, i);
+		x->type = INVALID;
+		x->p[0].v = b->free;
+		b->free = x;
+	}
+}
+
+/**@brief get a new block for a size class, either one that has been
+ * emptied by a previous sweep or one from a new chunk of memory*/
+static heap_block_t *block_new(lisp_t *l, size_t fields) {
+	heap_block_t *b;
+	if (!l->heap_empty) {
+		/*one spare block is needed to align the others, the chunk
+		 * record itself is kept after the end of the blocks*/
+		char *raw = malloc((HEAP_CHUNK_BLOCKS + 1) * HEAP_BLOCK_SIZE + sizeof(heap_chunk_t));
+		if (!raw)
+			lisp_out_of_memory(l);
+		heap_chunk_t *c = (heap_chunk_t*)(raw + (HEAP_CHUNK_BLOCKS + 1) * HEAP_BLOCK_SIZE);
+		c->raw = raw;
+		uintptr_t aligned = ((uintptr_t)c->raw + HEAP_BLOCK_SIZE - 1) & ~(uintptr_t)(HEAP_BLOCK_SIZE - 1);
+		for (size_t i = 0; i < HEAP_CHUNK_BLOCKS; i++) {
+			b = (heap_block_t*)(aligned + i * HEAP_BLOCK_SIZE);
+			b->next = l->heap_empty;
+			l->heap_empty = b;
+		}
+		c->next = l->heap_chunks;
+		l->heap_chunks = c;
+	}
+	b = l->heap_empty;
+	l->heap_empty = b->next;
+	block_init(l, b, fields);
+	/*an incremental sweep that has yet to get to this class sweeps it*/
+	b->unswept = l->gc_phase == GC_SWEEPING && fields - 1 > l->gc_sweep_class;
+	b->next = l->heap_blocks[fields - 1];
+	l->heap_blocks[fields - 1] = b;
+	b->avail = 1;
+	b->next_avail = l->heap_avail[fields - 1];
+	l->heap_avail[fields - 1] = b;
+	return b;
+}
+
+static lisp_cell_t *heap_alloc(lisp_t *l, size_t fields) {
+	heap_block_t *b = l->heap_avail[fields - 1];
+	lisp_cell_t *x;
+	if (!b)
+		b = block_new(l, fields);
+	if (l->gc_mode == LISP_GC_GENERATIONAL && !b->young) {
+		b->young = 1;
+		b->next_young = l->heap_young;
+		l->heap_young = b;
+	}
+	x = b->free;
+	if (!(b->free = x->p[0].v)) {
+		l->heap_avail[fields - 1] = b->next_avail;
+		b->avail = 0;
+	}
+	b->live++;
+	memset(x, 0, b->size);
+	x->heap = 1;
+	return x;
+}
+
+static void gc_collect(lisp_t *l);
+
+lisp_cell_t *lisp_gc_alloc(lisp_t *l, lisp_type type, size_t fields) {
+	assert(l && type != INVALID && fields);
+	lisp_cell_t *x;
+	if (l->gc_collectp++ > l->gc_next || l->gc_bytes > l->gc_threshold)
+		gc_collect(l);
+	l->gc_bytes += CELL_SIZE(fields);
+	l->gc_stats.allocated[type]++;
+	l->gc_stats.allocated_bytes[type] += CELL_SIZE(fields);
+	if (USE_CELL_HEAP && type != USERDEF && fields <= HEAP_CLASSES) {
+		x = heap_alloc(l, fields);
+	} else { /*user defined types are freed by their free functions*/
+		gc_list_t *node = lisp_calloc(l, sizeof(*node));
+		x = lisp_calloc(l, CELL_SIZE(fields));
+		node->ref = x;
+		node->size = CELL_SIZE(fields);
+		node->next = l->gc_head;
+		l->gc_head = node;
+	}
+	x->type = type;
+	/*new cells must survive an incremental collection that is under way,
+	 * they are traced once their fields have been filled in, or they
+	 * are marked so a sweep that has yet to reach them leaves them be*/
+	if (l->gc_phase == GC_MARKING)
+		gc_shade(l, x);
+	else if (l->gc_phase == GC_SWEEPING && (!x->heap || block_of(x)->unswept))
+		x->mark = 1;
+	return x;
+}
+
+/**@brief decide what happens to a cell during a sweep
+ * @return non zero if the cell is still alive*/
+static int gc_survives(lisp_t *l, lisp_cell_t *x) {
+	if (l->gc_minor && x->old)
+		return 1;
+	if (!x->mark && !x->uncollectable && !x->used)
+		return 0;
+	x->mark = 0;
+	x->dirty = 0;
+	x->old = l->gc_mode == LISP_GC_GENERATIONAL;
+	l->gc_stats.live[x->type] += !l->gc_minor;
+	return 1;
+}
+
+/**@brief account for a cell that is about to be freed*/
+static void gc_freed(lisp_t *l, lisp_cell_t *x, size_t size) {
+	l->gc_bytes -= size;
+	l->gc_stats.freed[x->type]++;
+	l->gc_stats.freed_bytes[x->type] += size;
+}
+
+/**@brief sweep a single block, rebuilding its free list*/
+static void block_sweep(lisp_t *l, heap_block_t *b) {
+	b->free = NULL;
+	b->live = 0;
+	for (size_t i = b->count; i-- > 0;) {
+		lisp_cell_t *x = block_slot(b, i);
+		if (x->type != INVALID) {
+			if (gc_survives(l, x)) {
+				b->live++;
+				continue;
+			}
+			gc_freed(l, x, b->size);
+			gc_free(l, x);
+			x->type = INVALID;
+		}
+		x->p[0].v = b->free;
+		b->free = x;
+	}
+}
+
+/**@brief sweep every block in the heap, blocks left with no live cells
+ * are given back to the pool of empty blocks*/
+static void heap_sweep(lisp_t *l) {
+	for (size_t i = 0; i < HEAP_CLASSES; i++) {
+		l->heap_avail[i] = NULL;
+		for (heap_block_t **p = &l->heap_blocks[i]; *p;) {
+			heap_block_t *b = *p;
+			block_sweep(l, b);
+			b->young = 0;
+			b->avail = 0;
+			if (!b->live) {
+				*p = b->next;
+				b->next = l->heap_empty;
+				l->heap_empty = b;
+				continue;
+			}
+			if (b->free) {
+				b->avail = 1;
+				b->next_avail = l->heap_avail[i];
+				l->heap_avail[i] = b;
+			}
+			l->gc_live += b->live;
+			p = &b->next;
+		}
+	}
+	l->heap_young = NULL;
+}
+
+/**@brief sweep only the blocks allocated from since the last collection,
+ * which is where all the young objects are*/
+static void heap_sweep_young(lisp_t *l) {
+	for (heap_block_t *b = l->heap_young; b; b = b->next_young) {
+		block_sweep(l, b);
+		b->young = 0;
+		if (b->free && !b->avail) {
+			b->avail = 1;
+			b->next_avail = l->heap_avail[b->fields - 1];
+			l->heap_avail[b->fields - 1] = b;
+		}
+	}
+	l->heap_young = NULL;
+}
+
+/**@brief sweep heap blocks until the budget is used up, blocks allocated
+ * from during an incremental sweep are added to the front of their class
+ * so are never reached by it, the cells in them are left alone
+ * @return non zero if every block has been swept*/
+static int heap_sweep_slice(lisp_t *l, size_t budget) {
+	size_t work = 0;
+	while (l->gc_sweep_class < HEAP_CLASSES) {
+		heap_block_t *b = l->gc_sweep_block;
+		if (!b) {
+			if (++l->gc_sweep_class < HEAP_CLASSES)
+				l->gc_sweep_block = l->heap_blocks[l->gc_sweep_class];
+			continue;
+		}
+		if (work >= budget)
+			return 0;
+		block_sweep(l, b);
+		b->unswept = 0;
+		if (b->free && !b->avail) {
+			b->avail = 1;
+			b->next_avail = l->heap_avail[b->fields - 1];
+			l->heap_avail[b->fields - 1] = b;
+		}
+		l->gc_live += b->live;
+		l->gc_sweep_block = b->next;
+		work += b->count;
+	}
+	return 1;
+}
+
+/**@brief sweep the objects that are not in the cell heap*/
+static void list_sweep(lisp_t *l) {
 	for (gc_list_t **p = &l->gc_head; *p != NULL;) {
 		gc_list_t *v = *p;
-		if (v->ref->mark) {
+		if (gc_survives(l, v->ref)) {
+			l->gc_live += !l->gc_minor;
 			p = &v->next;
-			v->ref->mark = 0;
 		} else {
 			*p = v->next;
+			gc_freed(l, v->ref, v->size);
 			gc_free(l, v->ref);
 			free(v);
 		}
 	}
 }
 
+void lisp_gc_release(lisp_t *l) {
+	assert(l);
+	for (gc_list_t *v = l->gc_head, *n; v; v = n) { /*uncollectable cells*/
+		n = v->next;
+		free(v->ref);
+		free(v);
+	}
+	l->gc_head = NULL;
+	for (heap_chunk_t *c = l->heap_chunks, *n; c; c = n) {
+		n = c->next;
+		free(c->raw); /*also frees the chunk record*/
+	}
+	l->heap_chunks = NULL;
+	l->heap_empty = NULL;
+	memset(l->heap_blocks, 0, sizeof(l->heap_blocks));
+	memset(l->heap_avail, 0, sizeof(l->heap_avail));
+	l->heap_young = NULL;
+	free(l->gc_remembered);
+	l->gc_remembered = NULL;
+	l->gc_remembered_used = l->gc_remembered_allocated = 0;
+	free(l->gc_grey);
+	l->gc_grey = NULL;
+	l->gc_grey_used = l->gc_grey_allocated = 0;
+}
+
+static void gc_finish(lisp_t *l);
+
+/**@brief work out how big the heap may get before the next full collection
+ * from how much of it is in use after this one*/
+static void gc_set_threshold(lisp_t *l) {
+	double grown = l->gc_bytes * l->gc_growth;
+	size_t t = grown >= (double)SIZE_MAX ? SIZE_MAX : (size_t)grown;
+	t = MIN(MAX(t, l->gc_heap_min), l->gc_heap_max);
+	if (t <= l->gc_bytes) /*more is in use than the maximum allows*/
+		t = l->gc_bytes + MIN(l->gc_heap_min, SIZE_MAX - l->gc_bytes);
+	l->gc_threshold = t;
+}
+
+void lisp_gc_sweep_only(lisp_t * l) {
+	assert(l);
+	if (l->gc_off)
+		return;
+	gc_finish(l); /*so no object is left marked*/
+	l->gc_live = 0;
+	memset(l->gc_stats.live, 0, sizeof(l->gc_stats.live));
+	heap_sweep(l);
+	list_sweep(l);
+	l->gc_remembered_used = 0;
+	gc_set_threshold(l);
+}
+
 lisp_cell_t *lisp_gc_add(lisp_t * l, lisp_cell_t * op) {
 	assert(l);
+	if (IS_IMMEDIATE(op)) /*there is nothing to keep alive*/
+		return op;
 	if (l->gc_stack_used++ > l->gc_stack_allocated - 1) {
 		l->gc_stack_allocated = l->gc_stack_used * 2;
 		if (l->gc_stack_allocated < l->gc_stack_used)
@@ -139,6 +579,10 @@ lisp_cell_t *lisp_gc_add(lisp_t * l, lisp_cell_t * op) {
 		l->gc_stack = olist;
 	}
 	l->gc_stack[l->gc_stack_used - 1] = op;	/**<anything reachable in here is not freed*/
+	if (l->gc_stack_used > l->gc_stats.gc_stack_max)
+		l->gc_stats.gc_stack_max = l->gc_stack_used;
+	if (l->gc_phase == GC_MARKING) /*the stack is not traced again*/
+		gc_shade(l, op);
 	return op;
 }
 
@@ -157,15 +601,214 @@ void lisp_gc_off(lisp_t * l) {
 	l->gc_off = 1;
 }
 
+int lisp_gc_set_growth(lisp_t *l, double factor) {
+	assert(l);
+	if (!(factor > 1.0)) /*also catches NaN*/
+		return -1;
+	l->gc_growth = factor;
+	if (l->gc_phase == GC_IDLE)
+		gc_set_threshold(l);
+	return 0;
+}
+
+double lisp_gc_get_growth(lisp_t *l) {
+	assert(l);
+	return l->gc_growth;
+}
+
+int lisp_gc_set_heap_limits(lisp_t *l, size_t min, size_t max) {
+	assert(l);
+	if (min > max)
+		return -1;
+	l->gc_heap_min = min;
+	l->gc_heap_max = max;
+	if (l->gc_phase == GC_IDLE)
+		gc_set_threshold(l);
+	return 0;
+}
+
+void lisp_gc_get_heap_limits(lisp_t *l, size_t *min, size_t *max) {
+	assert(l && min && max);
+	*min = l->gc_heap_min;
+	*max = l->gc_heap_max;
+}
+
+/**@brief work out when the collector next needs to run*/
+static void gc_schedule(lisp_t *l) {
+	l->gc_collectp = 0;
+	if (l->gc_phase != GC_IDLE) /*enough slices so tracing keeps ahead of allocation*/
+		l->gc_next = MAX(1, l->gc_budget / GC_SLICE_RATIO);
+	else
+		l->gc_next = l->gc_mode == LISP_GC_GENERATIONAL ? GC_NURSERY_SIZE : SIZE_MAX;
+}
+
+int lisp_gc_set_mode(lisp_t *l, lisp_gc_mode mode) {
+	assert(l);
+	if (mode != LISP_GC_FULL && mode != LISP_GC_GENERATIONAL && mode != LISP_GC_INCREMENTAL)
+		return -1;
+	if (mode != LISP_GC_FULL && !USE_CELL_HEAP)
+		return -1;
+	if (mode == l->gc_mode)
+		return 0;
+	gc_finish(l);
+	l->gc_mode = mode;
+	lisp_gc_mark_and_sweep(l); /*make all the live objects old, or young*/
+	gc_schedule(l);
+	return 0;
+}
+
+lisp_gc_mode lisp_gc_get_mode(lisp_t *l) {
+	assert(l);
+	return l->gc_mode;
+}
+
+void lisp_gc_set_budget(lisp_t *l, size_t work) {
+	assert(l);
+	l->gc_budget = work ? work : GC_SLICE_BUDGET;
+	gc_schedule(l);
+}
+
+size_t lisp_gc_get_budget(lisp_t *l) {
+	assert(l);
+	return l->gc_budget;
+}
+
+/**@brief the stack of the virtual machine is written to without telling
+ * the collector, so an incremental collection looks at it again when it
+ * finishes tracing*/
+static void gc_shade_vm_stack(lisp_t *l) {
+	for (size_t i = 0; i < l->vm_stack_used; i++)
+		gc_shade(l, l->vm_stack[i]);
+}
+
+static void gc_shade_roots(lisp_t *l) {
+	gc_shade(l, l->all_symbols);
+	gc_shade(l, l->top_env);
+	gc_shade(l, l->empty_docstr);
+	for (size_t i = 0; i < l->gc_stack_used; i++)
+		gc_shade(l, l->gc_stack[i]);
+	gc_shade_vm_stack(l);
+}
+
+/**@brief collect the young objects only, anything reachable from the roots
+ * or from an old object written to since the last collection is promoted,
+ * old objects are neither traced nor swept*/
+static void gc_minor(lisp_t *l) {
+	l->gc_minor = 1;
+	gc_shade_roots(l);
+	for (size_t i = 0; i < l->gc_remembered_used; i++)
+		gc_scan(l, l->gc_remembered[i], SIZE_MAX);
+	l->gc_remembered_used = 0;
+	/*user defined types have no write barrier, so old ones are always traced*/
+	for (gc_list_t *v = l->gc_head; v; v = v->next)
+		if (v->ref->old && (v->ref->dirty || v->ref->type == USERDEF))
+			gc_scan(l, v->ref, SIZE_MAX);
+	gc_drain(l, SIZE_MAX);
+	heap_sweep_young(l);
+	list_sweep(l);
+	l->gc_minor = 0;
+	l->gc_stats.minor++;
+}
+
+/**@brief finish tracing for an incremental collection, cells in the cell
+ * heap that were written to after being traced are back on the grey
+ * stack but the others can only be found by walking their list*/
+static void gc_remark(lisp_t *l) {
+	gc_shade_vm_stack(l);
+	for (gc_list_t *v = l->gc_head; v; v = v->next)
+		if (v->ref->mark && (v->ref->dirty || v->ref->type == USERDEF))
+			gc_scan(l, v->ref, SIZE_MAX);
+	gc_drain(l, SIZE_MAX);
+	for (size_t i = 0; i < HEAP_CLASSES; i++)
+		for (heap_block_t *b = l->heap_blocks[i]; b; b = b->next)
+			b->unswept = 1;
+	l->gc_sweep_class = 0;
+	l->gc_sweep_block = l->heap_blocks[0];
+	l->gc_live = 0;
+	memset(l->gc_stats.live, 0, sizeof(l->gc_stats.live));
+	l->gc_phase = GC_SWEEPING;
+}
+
+/**@brief do one slice of an incremental collection, starting one if
+ * there is none in progress, no more than the budget of work is done
+ * other than when tracing finishes*/
+static void gc_slice(lisp_t *l, size_t budget) {
+	switch (l->gc_phase) {
+	case GC_IDLE:
+		gc_shade_roots(l);
+		l->gc_phase = GC_MARKING;
+		l->gc_threshold = SIZE_MAX; /*until this collection is done*/
+		break;
+	case GC_MARKING:
+		if (gc_drain(l, budget))
+			gc_remark(l);
+		break;
+	case GC_SWEEPING:
+		if (heap_sweep_slice(l, budget)) {
+			list_sweep(l);
+			l->gc_phase = GC_IDLE;
+			gc_set_threshold(l);
+			l->gc_stats.incremental++;
+		}
+		break;
+	}
+}
+
+/**@brief run an incremental collection that is in progress to the end*/
+static void gc_finish(lisp_t *l) {
+	while (l->gc_phase != GC_IDLE)
+		gc_slice(l, SIZE_MAX);
+}
+
+/**@brief record how long the collector stopped the program for*/
+static void gc_paused(lisp_t *l, clock_t start) {
+	double t = ((double)(clock() - start)) / CLOCKS_PER_SEC;
+	l->gc_stats.pauses++;
+	l->gc_stats.pause_total += t;
+	l->gc_stats.pause_max = MAX(l->gc_stats.pause_max, t);
+}
+
+/**@brief mark everything reachable then sweep the entire heap*/
+static void gc_full(lisp_t *l) {
+	gc_finish(l);
+	gc_shade_roots(l);
+	gc_drain(l, SIZE_MAX);
+	lisp_gc_sweep_only(l);
+	l->gc_stats.full++;
+}
+
+/**@brief perform whichever collection is due*/
+static void gc_collect(lisp_t *l) {
+	if (l->gc_off)
+		return;
+	clock_t start = clock();
+	switch (l->gc_mode) {
+	case LISP_GC_GENERATIONAL:
+		gc_minor(l);
+		if (l->gc_bytes > l->gc_threshold)
+			gc_full(l);
+		break;
+	case LISP_GC_INCREMENTAL:
+		gc_slice(l, l->gc_budget);
+		break;
+	default:
+		gc_full(l);
+	}
+	gc_schedule(l);
+	gc_paused(l, start);
+}
+
 void lisp_gc_mark_and_sweep(lisp_t * l) {
 	assert(l);
 	if (l->gc_off)
 		return;
-	lisp_gc_mark(l, l->all_symbols);
-	lisp_gc_mark(l, l->top_env);
-	for (size_t i = 0; i < l->gc_stack_used; i++)
-		lisp_gc_mark(l, l->gc_stack[i]);
-	lisp_gc_sweep_only(l);
-	l->gc_collectp = 0;
+	clock_t start = clock();
+	gc_full(l);
+	gc_schedule(l);
+	gc_paused(l, start);
 }
 
+void lisp_gc_get_stats(lisp_t *l, lisp_gc_stats_t *stats) {
+	assert(l && stats);
+	*stats = l->gc_stats;
+}
@@ -3,7 +3,7 @@
  *  @author     Richard Howe (2015)
  *  @license    LGPL v2.1 or Later
  *  @email      howe.r.j.89@gmail.com
- *  @todo Change to linear probing, making this into a generic table for use in the
+ *  @todo Make this into a generic table for use in the
  *        lisp interpreter, make a custom callback for hashing lisp code,
  *        simplifying all of the hash stuff instead of cons the key and value
  *        and storing that. **/
@@ -25,26 +25,95 @@ static int string_compare(const void *a, const void *b) {
 	return strcmp((const char*)a, (const char*)b);
 }
 
+uint32_t hash_string(const char *s, size_t len) {
+	assert(s);
+	const uint64_t h = xxh64(s, len, 0);
+	return h ^ (h >> 32);
+}
+
 static uint32_t string_hash(const void *s) {
 	assert(s);
-	return djb2(s, strlen(s));
+	return hash_string(s, strlen(s));
 }
 
-static uint32_t hash_alg(const hash_table_t * table, const void *s) {
-	assert(table->len);
-	return table->hash(s) % table->len;
+/**@brief internal function to round a requested table size up to a power
+ * of two, so bins can be found with a mask
+ * @return the rounded size or zero on overflow*/
+static size_t hash_round(size_t len) {
+	size_t r = 8;
+	while (r < len && r)
+		r <<= 1;
+	return r;
 }
 
-/**@brief internal function to create a chained hash node**/
-static hash_entry_t *hash_new_pair(char *key, void *val) {
-	if (!key || !val)
-		return NULL;
-	hash_entry_t *np = calloc(1, sizeof(*np));
-	if (!np)
-		return NULL;
-	np->key = (char *)key;
-	np->val = val;
-	return np;
+/**@brief internal function to put an entry whose key is not in the table into
+ * it, entries that are further from their home bin take the place of those
+ * that are nearer to theirs (Robin Hood hashing), so no probe gets too long
+ * @return non zero if the entry did not go into its home bin*/
+static int hash_place(hash_table_t * ht, hash_entry_t e) {
+	const size_t mask = ht->len - 1;
+	const size_t home = e.hash & mask;
+	for (size_t i = home, dist = 0;; i = (i + 1) & mask, dist++) {
+		hash_entry_t *cur = &ht->table[i];
+		if (!cur->key) {
+			*cur = e;
+			return i != home;
+		}
+		size_t cur_dist = (i - (cur->hash & mask)) & mask;
+		if (cur_dist < dist) {
+			hash_entry_t t = *cur;
+			*cur = e;
+			e = t;
+			dist = cur_dist;
+		}
+	}
+}
+
+/**@brief internal function to find the entry holding a key in an array of
+ * bins, the search stops as soon as it reaches an entry nearer to its home
+ * bin than the key would be, as the key would have taken its place. Keys
+ * are compared by pointer first, a symbol is always looked up with the
+ * same name it was inserted with so finding it never touches the string.*/
+static hash_entry_t *hash_probe(const hash_table_t * h, hash_entry_t *table, size_t len, const char *key, uint32_t hash) {
+	const size_t mask = len - 1;
+	for (size_t i = hash & mask, dist = 0;; i = (i + 1) & mask, dist++) {
+		hash_entry_t *cur = &table[i];
+		if (!cur->key || ((i - (cur->hash & mask)) & mask) < dist)
+			return NULL;
+		if (cur->hash == hash && (cur->key == key || !h->compare(cur->key, key)))
+			return cur;
+	}
+}
+
+/**@brief internal function to find the entry holding a key, while the
+ * table is growing a key is either in the new bins or in one of the old
+ * bins that has not been moved yet, never in both. Old bins that have been
+ * moved are left as they are so the probes through them still work.*/
+static hash_entry_t *hash_find(const hash_table_t * h, const char *key, uint32_t hash) {
+	hash_entry_t *cur = hash_probe(h, h->table, h->len, key, hash);
+	if (!cur && h->old) {
+		cur = hash_probe(h, h->old, h->old_len, key, hash);
+		assert(!cur || (size_t)(cur - h->old) >= h->migrated);
+	}
+	return cur;
+}
+
+/**@brief internal function to move up to "bins" bins of the old table into
+ * the new one after it has grown, the old table is freed once all of them
+ * have been moved*/
+static void hash_migrate(hash_table_t * ht, size_t bins) {
+	if (!ht->old)
+		return;
+	for (; bins && ht->migrated < ht->old_len; bins--, ht->migrated++)
+		if (ht->old[ht->migrated].key)
+			hash_place(ht, ht->old[ht->migrated]);
+	if (ht->owner) /*entries the collector has not seen can move to bins it has*/
+		LISP_GC_BARRIER(ht->owner);
+	if (ht->migrated == ht->old_len) {
+		free(ht->old);
+		ht->old = NULL;
+		ht->old_len = ht->migrated = 0;
+	}
 }
 
 hash_table_t *hash_create(const size_t len) {
@@ -52,8 +121,8 @@ hash_table_t *hash_create(const size_t len) {
 }
 
 hash_table_t *hash_create_custom(size_t len, hash_free_key_f k, hash_free_val_f v, hash_compare_key_f c, hash_f h) {
-	if (!len)
-		len++;
+	if (!(len = hash_round(len)))
+		return NULL;
 	hash_table_t *nt = calloc(1, sizeof(*nt));
 	if (!nt)
 		return NULL;
@@ -70,120 +139,105 @@ hash_table_t *hash_create_custom(size_t len, hash_free_key_f k, hash_free_val_f
 void hash_destroy(hash_table_t * h) {
 	if (!h)
 		return;
-	for (size_t i = 0; i < h->len; i++)
-		if (h->table[i]) {
-			hash_entry_t *prev = NULL;
-			for (hash_entry_t *cur = h->table[i]; cur; prev = cur, cur = cur->next) {
-				h->free_key(cur->key);
-				h->free_val(cur->val);
-				free(prev);
-			}
-			free(prev);
+	hash_entry_t *e;
+	for (size_t i = 0; i < hash_bin_count(h); i++)
+		if ((e = hash_bin(h, i))) {
+			h->free_key(e->key);
+			h->free_val(e->val);
 		}
 	free(h->table);
+	free(h->old);
 	free(h);
 }
 
-static hash_table_t *hash_copy_and_resize(hash_table_t *old, const size_t len) {
-	assert(old);
-	hash_table_t *new = hash_create(len);
-	if(!new)
-		return NULL;
-	for (size_t i = 0; i < old->len; i++)
-		if (old->table[i])
-			for (hash_entry_t *cur = old->table[i]; cur; cur = cur->next)
-				if (hash_insert(new, cur->key, cur->val) < 0)
-					goto fail;
-	new->free_key = old->free_key;
-	new->free_val = old->free_val;
-	new->compare = old->compare;
-	new->hash = old->hash;
-	return new;
-fail:
-	hash_destroy(new);
-	return NULL;
-}
-
 hash_table_t *hash_copy(hash_table_t *src) {
 	assert(src);
-	return hash_copy_and_resize(src, src->len);
+	hash_migrate(src, SIZE_MAX);
+	hash_table_t *new = hash_create_custom(src->len, src->free_key, src->free_val, src->compare, src->hash);
+	if (!new)
+		return NULL;
+	memcpy(new->table, src->table, src->len * sizeof(*src->table));
+	new->used = src->used;
+	return new;
 }
 
+/**@brief double the number of bins, the entries are not moved here but a
+ * few at a time by each following insert, so no single insert has to move
+ * the whole table. They are all moved well before the table needs to grow
+ * again, the stored hashes are used to place them so no key is hashed
+ * again.*/
 static int hash_grow(hash_table_t * ht) {
 	assert(ht);
-	if((ht->len * 2) < ht->len)
+	hash_entry_t *new;
+	if ((ht->len * 2) < ht->len)
 		return -1;
-	hash_table_t *new = hash_copy_and_resize(ht, ht->len*2);
-	if (!new)
+	if (!(new = calloc(ht->len * 2, sizeof(*new))))
 		return -1;
-	for (size_t i = 0; i < ht->len; i++)
-		if (ht->table[i]) {
-			hash_entry_t *cur = NULL, *prev = NULL;
-			for (cur = ht->table[i]; cur; prev = cur, cur = cur->next)
-				free(prev);
-			free(prev);
-		}
-	free(ht->table);
-	ht->table = new->table;
-	ht->len = new->len;
-	free(new);
+	hash_migrate(ht, SIZE_MAX); /*only one old table is kept*/
+	ht->old = ht->table;
+	ht->old_len = ht->len;
+	ht->migrated = 0;
+	ht->table = new;
+	ht->len *= 2;
 	return 0;
 }
 
-int hash_insert(hash_table_t * ht, char *key, void *val) {
+/**@brief internal function to insert a key whose hash is known*/
+static int hash_put(hash_table_t * ht, char *key, uint32_t hash, void *val) {
 	assert(ht && key && val);
-	hash_entry_t *cur = NULL, *newt = NULL, *last = NULL;
-
-	if (hash_get_load_factor(ht) >= 0.75f)
-		hash_grow(ht); /**@warning grow must go before any other operation*/
-
-	const uint32_t hash = hash_alg(ht, key);
-	for (cur = ht->table[hash]; cur && cur->key && ht->compare(key, cur->key); cur = cur->next)
-		last = cur;
-
-	if (cur && cur->key && !(ht->compare(key, cur->key))) {
+	hash_migrate(ht, HASH_MIGRATE_BINS);
+	hash_entry_t *cur = hash_find(ht, key, hash);
+	if (cur) {
 		ht->replacements++;
+		cur->key = key; /*the old key need not outlive its value*/
 		cur->val = val;	/*replace */
 	} else {
-		if (!(newt = hash_new_pair(key, val)))
+		/*the table is kept no more than three quarters full*/
+		if ((ht->used + 1) * 4 > ht->len * 3 && hash_grow(ht) < 0)
 			return -1;
+		ht->collisions += hash_place(ht, (hash_entry_t){ .key = key, .val = val, .hash = hash });
 		ht->used++;
-		if (cur == ht->table[hash]) {	/*collisions, insert head */
-			ht->collisions++;
-			newt->next = cur;
-			ht->table[hash] = newt;
-		} else if (!cur) {	/*free bin */
-			last->next = newt;
-		} else {	/*collision, insertions */
-			ht->collisions++;
-			newt->next = cur;
-			last->next = newt;
-		}
 	}
+	if (ht->owner)
+		LISP_GC_BARRIER(ht->owner);
 	return 0;
 }
 
+int hash_insert(hash_table_t * ht, char *key, void *val) {
+	assert(ht && key);
+	return hash_put(ht, key, ht->hash(key), val);
+}
+
+int hash_insert_hashed(hash_table_t * ht, char *key, uint32_t hash, void *val) {
+	assert(ht && key);
+	return hash_put(ht, key, ht->hash == string_hash ? hash : ht->hash(key), val);
+}
+
+size_t hash_bin_count(const hash_table_t *h) {
+	assert(h);
+	return h->len + (h->old ? h->old_len - h->migrated : 0);
+}
+
+hash_entry_t *hash_bin(const hash_table_t *h, size_t i) {
+	assert(h && i < hash_bin_count(h));
+	/*the old bins that have not been moved come after the new ones*/
+	hash_entry_t *e = i < h->len ? &h->table[i] : &h->old[h->migrated + i - h->len];
+	return e->key ? e : NULL;
+}
+
 void *hash_foreach(hash_table_t * h, hash_func func) {
 	assert(h && func);
-	size_t i = 0;
-	hash_entry_t *cur = NULL;
-	if (h->foreach) {
-		i = h->foreach_index;
-		cur = h->foreach_cur;
-		goto resume;
-	}
+	size_t i = h->foreach ? h->foreach_index + 1 : 0;
+	hash_entry_t *e;
 	h->foreach = 1;
-	for (i = 0; i < h->len; i++)
-		if (h->table[i])
-			for (cur = h->table[i]; cur;) {
-				void *ret = (*func) (cur->key, cur->val);
-				if (ret) {
-					h->foreach_index = i;
-					h->foreach_cur = cur;
-					return ret;
-				}
- resume:			cur = cur->next;
+	for (; i < hash_bin_count(h); i++)
+		if ((e = hash_bin(h, i))) {
+			void *ret = (*func) (e->key, e->val);
+			if (ret) {
+				h->foreach_index = i;
+				return ret;
 			}
+		}
 	h->foreach = 0;
 	return NULL;
 }
@@ -225,13 +279,12 @@ size_t hash_get_number_of_bins(const hash_table_t * h) {
 
 void *hash_lookup(const hash_table_t * h, const char *key) {
 	assert(h && key);
-	const uint32_t hash = hash_alg(h, key);
-	hash_entry_t *cur = h->table[hash];
-	while (cur && cur->next && h->compare(cur->key, key))
-		cur = cur->next;
-	if (!cur || !cur->key || h->compare(cur->key, key))
-		return NULL;
-	else
-		return cur->val;
+	hash_entry_t *cur = hash_find(h, key, h->hash(key));
+	return cur ? cur->val : NULL;
 }
 
+void *hash_lookup_hashed(const hash_table_t * h, const char *key, uint32_t hash) {
+	assert(h && key);
+	hash_entry_t *cur = hash_find(h, key, h->hash == string_hash ? hash : h->hash(key));
+	return cur ? cur->val : NULL;
+}
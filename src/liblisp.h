@@ -62,6 +62,10 @@ typedef struct tr_state tr_state_t;     /**< state for translation functions */
 typedef struct cell lisp_cell_t;               /**< a lisp object, or "cell" */
 typedef struct lisp lisp_t;             /**< a full lisp environment */
 typedef lisp_cell_t *(*lisp_subr_func)(lisp_t *, lisp_cell_t *); /**< lisp primitive operations */
+typedef lisp_cell_t *(*lisp_subr_func1)(lisp_t *, lisp_cell_t *); /**< primitive taking one argument directly, see lisp_add_subr_direct*/
+typedef lisp_cell_t *(*lisp_subr_func2)(lisp_t *, lisp_cell_t *, lisp_cell_t *); /**< ...taking two*/
+typedef lisp_cell_t *(*lisp_subr_func3)(lisp_t *, lisp_cell_t *, lisp_cell_t *, lisp_cell_t *); /**< ...taking three*/
+typedef void (*lisp_subr_direct)(void); /**< any of the above, cast to this to be stored */
 typedef void *(*hash_func)(const char *key, void *val); /**< for hash foreach */
 
 typedef void (*lisp_free_func)(lisp_cell_t *);       /**< function to free a user type*/
@@ -175,6 +179,16 @@ LIBLISP_API int match(char *pat, char *str);
  *  @return  uint32_t      the resulting hash **/
 LIBLISP_API uint32_t djb2(const char *s, size_t len);
 
+/** @brief   the XXH64 hash algorithm by Yann Collet, see
+ *           <https://github.com/Cyan4973/xxHash> for more information.
+ *           It works on eight bytes at a time and is what hash tables
+ *           use to hash their keys.
+ *  @param   s      the data to hash
+ *  @param   len    length of s
+ *  @param   seed   a seed, zero will do
+ *  @return  uint64_t      the resulting hash **/
+LIBLISP_API uint64_t xxh64(const void *s, size_t len, uint64_t seed);
+
 /** @brief   get a line text from a file
  *  @param   in    an input file
  *  @return  char* a line of input, without the newline**/
@@ -275,7 +289,9 @@ LIBLISP_API hash_table_t *hash_create_custom(size_t len, hash_free_key_f k, hash
  *  @param   h table to destroy or NULL**/
 LIBLISP_API void hash_destroy(hash_table_t *h);
 
-/** @brief   insert a value into an initialized hash table
+/** @brief   insert a value into an initialized hash table, the key is
+ *           not copied and must last as long as the value is in the
+ *           table, replacing the value of a key also replaces the key
  *  @param   ht    table to insert key-value pair into
  *  @param   key   key to associate with a value
  *  @param   val   value to lookup
@@ -618,12 +634,12 @@ LIBLISP_API lisp_cell_t *lisp_extend(lisp_t *l, lisp_cell_t *env, lisp_cell_t *s
 /**@brief  add a new symbol to the list of all symbols, two interned
  *         symbols containing the same name will compare equal with
  *         a pointer comparison, they will be the same object. The
- *         lisp environment will try to free this name!
+ *         name is copied, the caller still owns "name".
  * @param  l    an initialized lisp structure, used for error handling
  *              and keeping track of interned symbols
  * @param  name name of symbol
  * @return lisp_cell_t* a unique symbol cell*/
-LIBLISP_API lisp_cell_t *lisp_intern(lisp_t *l, char *name);
+LIBLISP_API lisp_cell_t *lisp_intern(lisp_t *l, const char *name);
 
 /**@brief  true if 'x' is equal to nil
  * @param  x   value to perform check on
@@ -665,6 +681,11 @@ LIBLISP_API int  is_proc(lisp_cell_t *x);
  * @return int zero if check fails, non zero if check passes */
 LIBLISP_API int  is_fproc(lisp_cell_t *x);
 
+/**@brief  true if 'x' is a macro
+ * @param  x   value to perform check on
+ * @return int zero if check fails, non zero if check passes */
+LIBLISP_API int  is_macro(lisp_cell_t *x);
+
 /**@brief  true if 'x' is a string
  * @param  x   value to perform check on
  * @return int zero if check fails, non zero if check passes */
@@ -794,6 +815,17 @@ LIBLISP_API lisp_cell_t *mk_proc(lisp_t *l, lisp_cell_t *args, lisp_cell_t *code
  * @return lisp_cell_t* a new f-expression */
 LIBLISP_API lisp_cell_t *mk_fproc(lisp_t *l, lisp_cell_t *args, lisp_cell_t *code, lisp_cell_t *env, lisp_cell_t *doc);
 
+/**@brief  make a lisp macro cell, a macro is applied to the code of a call
+ *         to it, unevaluated, and returns the code that replaces the call,
+ *         so each call is expanded once.
+ * @param  l    lisp environment for error handling and garbage collection
+ * @param  args the argument list of the macro, as for a lambda
+ * @param  code the code of the macro
+ * @param  env  the environment in which to expand the macro in
+ * @param  doc  the documentation string for the macro
+ * @return lisp_cell_t* a new macro */
+LIBLISP_API lisp_cell_t *mk_macro(lisp_t *l, lisp_cell_t *args, lisp_cell_t *code, lisp_cell_t *env, lisp_cell_t *doc);
+
 /**@brief  make lisp cell (string) from a string
  * @param  l lisp environment for error handling and garbage collection
  * @param  s a string, the lisp interpreter *will* try to free this
@@ -1064,6 +1096,15 @@ LIBLISP_API void lisp_out_of_memory(lisp_t *l);
  * @return lisp_cell_t* the top level lisp environment */
 LIBLISP_API lisp_cell_t *lisp_environment(lisp_t *l);
 
+/**@brief  Get what a symbol is bound to in an environment, such as the one
+ *         a procedure was made in (see get_proc_env()), without evaluating
+ *         anything or reporting an error if it is unbound
+ * @param  l   lisp session the environment belongs to
+ * @param  sym symbol to look up
+ * @param  env environment to look in
+ * @return lisp_cell_t* what "sym" is bound to, NULL if it is unbound */
+LIBLISP_API lisp_cell_t *lisp_lookup(lisp_t *l, lisp_cell_t *sym, lisp_cell_t *env);
+
 /**@brief  This is a convince function that takes a pointer to an array of
  *         structures, the structures contain the information needed
  *         for a call to lisp_add_subr().
@@ -1179,6 +1220,23 @@ LIBLISP_API lisp_cell_t *lisp_add_cell(lisp_t *l, const char *sym, lisp_cell_t *
  *                otherwise. You shouldn't do anything with pointer**/
 LIBLISP_API lisp_cell_t *lisp_add_subr(lisp_t *l, const char *name, lisp_subr_func func, const char *fmt, const char *doc);
 
+/** @brief  Add a primitive that is passed its arguments directly instead
+ *          of in a list, so calling it makes no garbage. How many arguments
+ *          it takes is fixed by its format string, from one up to three.
+ *          A version of the primitive that takes a list is needed as well,
+ *          it is what get_subr returns and is called whenever the
+ *          arguments are to hand as a list anyway.
+ *  @param  l     lisp environment to add primitive to
+ *  @param  name  name to call the function primitive by
+ *  @param  func  a lisp_subr_func1, lisp_subr_func2 or lisp_subr_func3,
+ *                as the format says, cast to a lisp_subr_direct
+ *  @param  shim  the same primitive taking a list of arguments
+ *  @param  fmt   format string that is passed to lisp_validate_args, this
+ *                cannot be NULL
+ *  @param  doc   documentation string (can be NULL)
+ *  @return lisp_cell_t* as for lisp_add_subr**/
+LIBLISP_API lisp_cell_t *lisp_add_subr_direct(lisp_t *l, const char *name, lisp_subr_direct func, lisp_subr_func shim, const char *fmt, const char *doc);
+
 /** @brief  Initialize a lisp environment. By default it will read
  *          from stdin, print to stdout and log errors to stderr.
  *  @return lisp*    A fully initialized lisp environment or NULL**/
@@ -1295,6 +1353,60 @@ LIBLISP_API int lisp_set_logging(lisp_t *l, io_t *logging);
  *  @param  ed     the line editor function**/
 LIBLISP_API void lisp_set_line_editor(lisp_t *l, lisp_editor_func ed);
 
+/**@brief A function that compiles a procedure into machine code, such as
+ *        the one the Tiny C Compiler module sets, see
+ *        lisp_set_native_compiler. It is given a procedure that has been
+ *        called often enough to be worth it.
+ * @return a subroutine taking the same arguments as the procedure, or NULL
+ *         if it cannot be compiled, in which case it is not tried again*/
+typedef lisp_cell_t *(*lisp_native_compiler)(lisp_t *l, lisp_cell_t *proc);
+
+/** @brief  set the function procedures are compiled into machine code with
+ *          once they are called often enough, see lisp_set_tiers
+ *  @param  l        an initialized lisp environment
+ *  @param  compiler the function to use, or NULL for none**/
+LIBLISP_API void lisp_set_native_compiler(lisp_t *l, lisp_native_compiler compiler);
+
+/** @brief  Procedures count how often they are called and are promoted to
+ *          faster ways of running them as the count goes up. They are
+ *          compiled to byte code when first called, then are compiled
+ *          again with the optimizations "compile" does, and are then
+ *          compiled to machine code if there is a native compiler. The
+ *          optimized code has the primitives and small procedures the
+ *          top level variables it uses are bound to built into it, it is
+ *          optimized again when it is next called if one of those
+ *          variables is defined again or set, which is why promotion
+ *          beyond byte code is off until this is called. The "tiers"
+ *          primitive does the same from lisp, "procedure-tier" gets the
+ *          count and tier of a procedure.
+ *  @param  l        an initialized lisp environment
+ *  @param  optimize calls after which a procedure is optimized, zero for never
+ *  @param  native   calls after which it is compiled to machine code, zero
+ *                   for never**/
+LIBLISP_API void lisp_set_tiers(lisp_t *l, size_t optimize, size_t native);
+
+/** @brief  Set how deep code may recurse before it fails with an error.
+ *          Procedures that have been compiled call each other on the stack
+ *          of the virtual machine, which grows as needed up to "stack"
+ *          cells, so they can go as deep as memory allows. Everything
+ *          else, eval, macros, F-expressions and primitives such as
+ *          "apply" that call back into the interpreter, uses the C stack
+ *          and counts towards "depth". Raising "depth" far above its
+ *          default of 4096 risks overflowing the C stack. The
+ *          "recursion-limits" primitive does the same from lisp.
+ *  @param  l      an initialized lisp environment
+ *  @param  depth  recursion allowed on the C stack, it must not be zero
+ *  @param  stack  most cells the stack of the virtual machine can grow
+ *                 to, SIZE_MAX for as many as memory allows
+ *  @return int    zero on success, negative if a limit is zero or too large**/
+LIBLISP_API int lisp_set_recursion_limits(lisp_t *l, size_t depth, size_t stack);
+
+/** @brief  Get the recursion limits, see lisp_set_recursion_limits()
+ *  @param  l      an initialized lisp environment
+ *  @param  depth  set to the recursion allowed on the C stack
+ *  @param  stack  set to the most cells the virtual machine can use**/
+LIBLISP_API void lisp_get_recursion_limits(lisp_t *l, size_t *depth, size_t *stack);
+
 /** @brief  set the internal signal handling variable of a lisp environment,
  *          this is a way for a function such as a signal handler or another
  *          thread to halt the interpreter.
@@ -1404,6 +1516,48 @@ LIBLISP_API void lisp_gc_mark(lisp_t *l, lisp_cell_t *op);
  * @param l      the lisp environment to perform the mark and sweep in**/
 LIBLISP_API void lisp_gc_mark_and_sweep(lisp_t *l);
 
+/**@brief The strategies the garbage collector can use, generational
+ *        collection is the default when the library is built with a
+ *        cell heap (see USE_CELL_HEAP in the makefile).*/
+typedef enum {
+	LISP_GC_FULL,         /**< mark and sweep the entire heap each time*/
+	LISP_GC_GENERATIONAL, /**< often collect just the recently allocated objects*/
+	LISP_GC_INCREMENTAL   /**< collect in small slices interleaved with allocation*/
+} lisp_gc_mode;
+
+/**@brief  Change the strategy used by the garbage collector, this performs
+ *         a full collection (if the collector is on) so the heap is in a
+ *         state the new strategy expects.
+ * @param  l    the lisp environment to change the strategy of
+ * @param  mode the new strategy
+ * @return int  zero on success, negative if the strategy is not supported
+ *              by this build of the library*/
+LIBLISP_API int lisp_gc_set_mode(lisp_t *l, lisp_gc_mode mode);
+
+/**@brief  Get the strategy currently in use by the garbage collector
+ * @param  l   the lisp environment to query
+ * @return lisp_gc_mode the strategy in use*/
+LIBLISP_API lisp_gc_mode lisp_gc_get_mode(lisp_t *l);
+
+/**@brief  Set the amount of work the incremental collector does each time
+ *         it runs, this is the number of cells (or hash table bins) traced
+ *         or swept and it bounds how long the interpreter is paused for.
+ *         A slice runs every "work / 4" allocations so tracing always
+ *         keeps ahead of the program, smaller budgets mean shorter but
+ *         more frequent pauses. Finishing the trace of a collection is
+ *         the exception, objects outside of the cell heap (user defined
+ *         types and large cells) written to during the collection are
+ *         traced again in one go.
+ * @param  l    the lisp environment to set the budget in
+ * @param  work cells to trace or sweep per slice, zero restores the default*/
+LIBLISP_API void lisp_gc_set_budget(lisp_t *l, size_t work);
+
+/**@brief  Get the amount of work the incremental collector does each time
+ *         it runs, see lisp_gc_set_budget()
+ * @param  l      the lisp environment to query
+ * @return size_t cells traced or swept per slice*/
+LIBLISP_API size_t lisp_gc_get_budget(lisp_t *l);
+
 /**@brief  Get the status of the garbage collector in a lisp environment,
  *         that is whether it is currently enabled. It defaults to being
  *         on.
@@ -1424,6 +1578,72 @@ LIBLISP_API void lisp_gc_on(lisp_t *l);
  * @param l lisp environment to disable garbage collection in*/
 LIBLISP_API void lisp_gc_off(lisp_t *l);
 
+/**@brief  Set how far the heap may grow between full collections, the
+ *         next one happens when the memory held by cells reaches the
+ *         amount still in use after the last one multiplied by this
+ *         factor. Larger factors favor throughput, smaller ones favor a
+ *         small footprint. Memory owned by cells, such as the contents
+ *         of strings and hash tables, is not counted.
+ * @param  l      lisp environment to tune the collector of
+ * @param  factor growth factor, it must be greater than one
+ * @return int    zero on success, negative if the factor is invalid*/
+LIBLISP_API int lisp_gc_set_growth(lisp_t *l, double factor);
+
+/**@brief  Get the heap growth factor, see lisp_gc_set_growth()
+ * @param  l      lisp environment to query
+ * @return double the growth factor in use*/
+LIBLISP_API double lisp_gc_get_growth(lisp_t *l);
+
+/**@brief  Bound the heap size, in bytes, at which a full collection is
+ *         run. No full collection happens while the heap is smaller than
+ *         "min", and the heap is not allowed to grow past "max" without
+ *         one. When more than "max" bytes are still in use after a
+ *         collection the next one happens once another "min" bytes have
+ *         been allocated.
+ * @param  l   lisp environment to tune the collector of
+ * @param  min smallest heap size to collect at
+ * @param  max largest heap size to collect at, use SIZE_MAX for no limit
+ * @return int zero on success, negative if "min" is greater than "max"*/
+LIBLISP_API int lisp_gc_set_heap_limits(lisp_t *l, size_t min, size_t max);
+
+/**@brief  Get the heap size limits, see lisp_gc_set_heap_limits()
+ * @param  l   lisp environment to query
+ * @param  min set to the smallest heap size to collect at
+ * @param  max set to the largest heap size to collect at*/
+LIBLISP_API void lisp_gc_get_heap_limits(lisp_t *l, size_t *min, size_t *max);
+
+#define LISP_GC_STATS_TYPES (16) /**< length of the per type arrays in lisp_gc_stats_t*/
+
+/**@brief Statistics kept by the garbage collector and the allocator. The
+ *        per type arrays are indexed by the type of a cell, as returned
+ *        by the "type-of" primitive, and the byte counts are for the cells
+ *        themselves, not for the strings or hash tables they own.*/
+typedef struct {
+	size_t full,        /**< full collections, including forced ones*/
+	       minor,       /**< minor collections of just the young objects*/
+	       incremental, /**< incremental collections finished*/
+	       pauses,      /**< times the collector stopped the program, slices included*/
+	       gc_stack_max; /**< most objects ever on the temporary object stack*/
+	double pause_total, /**< processor time spent collecting, in seconds*/
+	       pause_max;   /**< longest time spent collecting in one go, in seconds*/
+	size_t allocated[LISP_GC_STATS_TYPES],       /**< cells allocated*/
+	       allocated_bytes[LISP_GC_STATS_TYPES], /**< bytes allocated*/
+	       freed[LISP_GC_STATS_TYPES],           /**< cells freed*/
+	       freed_bytes[LISP_GC_STATS_TYPES],     /**< bytes freed*/
+	       live[LISP_GC_STATS_TYPES]; /**< cells alive after the last full or incremental collection*/
+} lisp_gc_stats_t;
+
+/**@brief  Get a copy of the statistics kept by the garbage collector
+ * @param  l     lisp environment to get the statistics of
+ * @param  stats filled in with the statistics*/
+LIBLISP_API void lisp_gc_get_stats(lisp_t *l, lisp_gc_stats_t *stats);
+
+/**@brief  Get the name of a type of cell, for use in reports such as the
+ *         per type statistics kept by the garbage collector
+ * @param  type the type of a cell, as returned by the "type-of" primitive
+ * @return const char* the name of the type, or NULL if it is not a type*/
+LIBLISP_API const char *lisp_type_name(unsigned type);
+
 /************************ test environment ***********************************/
 
 /** @brief  A full lisp interpreter environment in a function call. It will
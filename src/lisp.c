@@ -29,6 +29,13 @@ lisp_cell_t *lisp_environment(lisp_t *l) {
 	return l->top_env;
 }
 
+lisp_cell_t *lisp_lookup(lisp_t *l, lisp_cell_t *sym, lisp_cell_t *env) {
+	assert(l && sym && env);
+	size_t field;
+	lisp_cell_t *holder = env_find(sym, env, &field);
+	return holder ? holder->p[field].v : NULL;
+}
+
 void lisp_out_of_memory(lisp_t *l) {
 	LISP_HALT(l, "%y'allocation-failed%\n %r\"%s\"%t", strerror(errno));
 }
@@ -58,7 +65,12 @@ int lisp_add_module_subroutines(lisp_t *l, const lisp_module_subroutines_t *ms,
 
 lisp_cell_t *lisp_add_subr(lisp_t * l, const char *name, lisp_subr_func func, const char *fmt, const char *doc) {
 	assert(l && name && func);	/*fmt and doc are optional */
-	return lisp_extend_top(l, lisp_intern(l, lisp_strdup(l, name)), mk_subr(l, func, fmt, doc));
+	return lisp_extend_top(l, lisp_intern(l, name), mk_subr(l, func, fmt, doc));
+}
+
+lisp_cell_t *lisp_add_subr_direct(lisp_t * l, const char *name, lisp_subr_direct func, lisp_subr_func shim, const char *fmt, const char *doc) {
+	assert(l && name && func && shim && fmt);
+	return lisp_extend_top(l, lisp_intern(l, name), mk_subr_direct(l, func, shim, fmt, doc));
 }
 
 lisp_cell_t *lisp_get_all_symbols(lisp_t * l) {
@@ -68,7 +80,7 @@ lisp_cell_t *lisp_get_all_symbols(lisp_t * l) {
 
 lisp_cell_t *lisp_add_cell(lisp_t * l, const char *sym, lisp_cell_t * val) {
 	assert(l && sym && val);
-	return lisp_extend_top(l, lisp_intern(l, lisp_strdup(l, sym)), val);
+	return lisp_extend_top(l, lisp_intern(l, sym), val);
 }
 
 void lisp_destroy(lisp_t * l) {
@@ -78,15 +90,18 @@ void lisp_destroy(lisp_t * l) {
 	l->gc_off = 0;
 	if (l->gc_stack)
 		lisp_gc_sweep_only(l), free(l->gc_stack);
+	free(l->vm_stack);
 	if (lisp_get_logging(l))
 		io_close(lisp_get_logging(l));
 	if (lisp_get_output(l))
 		io_close(lisp_get_output(l));
 	if (lisp_get_input(l))
 		io_close(lisp_get_input(l));
-	free(l->input);
-	free(l->output);
-	free(l->logging);
+	lisp_gc_release(l);
+	for (name_block_t *b = l->names, *n; b; b = n) {
+		n = b->next;
+		free(b);
+	}
 	free(l);
 }
 
@@ -94,18 +109,19 @@ lisp_cell_t *lisp_read(lisp_t * l, io_t * i) {
 	assert(l && i);
 	lisp_cell_t *ret;
 	int restore_used, r;
+	size_t vm_stack_save = l->vm_stack_used;
 	jmp_buf restore;
 	if (l->recover_init) {
 		memcpy(restore, l->recover, sizeof(jmp_buf));
 		restore_used = 1;
 	}
 	if ((r = setjmp(l->recover))) {
-		LISP_RECOVER_RESTORE(restore_used, l, restore);
+		LISP_RECOVER_RESTORE(restore_used, l, restore, vm_stack_save);
 		return r > 0 ? l->error : NULL;
 	}
 	l->recover_init = 1;
 	ret = reader(l, i);
-	LISP_RECOVER_RESTORE(restore_used, l, restore);
+	LISP_RECOVER_RESTORE(restore_used, l, restore, vm_stack_save);
 	return ret;
 }
 
@@ -124,13 +140,17 @@ lisp_cell_t *lisp_eval(lisp_t * l, lisp_cell_t * exp) {
 		memcpy(restore, l->recover, sizeof(jmp_buf));
 		restore_used = 1;
 	}
+	size_t vm_stack_save = l->vm_stack_used;
 	if ((r = setjmp(l->recover))) {
-		LISP_RECOVER_RESTORE(restore_used, l, restore);
+		LISP_RECOVER_RESTORE(restore_used, l, restore, vm_stack_save);
 		return r > 0 ? l->error : NULL;
 	}
 	l->recover_init = 1;
+	size_t gc_stack_save = l->gc_stack_used;
 	lisp_cell_t *ret = eval(l, 0, exp, l->top_env);
-	LISP_RECOVER_RESTORE(restore_used, l, restore);
+	l->gc_stack_used = gc_stack_save; /*only the result is kept*/
+	lisp_gc_add(l, ret);
+	LISP_RECOVER_RESTORE(restore_used, l, restore, vm_stack_save);
 	return ret;
 }
 
@@ -140,6 +160,7 @@ lisp_cell_t *lisp_eval_string(lisp_t * l, const char *evalme) {
 	io_t *in = NULL;
 	lisp_cell_t *ret;
 	volatile int restore_used = 0, r;
+	size_t gc_stack_save, vm_stack_save;
 	jmp_buf restore;
 	if (!(in = io_sin(evalme, strlen(evalme))))
 		return NULL;
@@ -147,15 +168,19 @@ lisp_cell_t *lisp_eval_string(lisp_t * l, const char *evalme) {
 		memcpy(restore, l->recover, sizeof(jmp_buf));
 		restore_used = 1;
 	}
+	vm_stack_save = l->vm_stack_used;
 	if ((r = setjmp(l->recover))) {
 		io_close(in);
-		LISP_RECOVER_RESTORE(restore_used, l, restore);
+		LISP_RECOVER_RESTORE(restore_used, l, restore, vm_stack_save);
 		return r > 0 ? l->error : NULL;
 	}
 	l->recover_init = 1;
+	gc_stack_save = l->gc_stack_used;
 	ret = eval(l, 0, reader(l, in), l->top_env);
+	l->gc_stack_used = gc_stack_save; /*only the result is kept*/
+	lisp_gc_add(l, ret);
 	io_close(in);
-	LISP_RECOVER_RESTORE(restore_used, l, restore);
+	LISP_RECOVER_RESTORE(restore_used, l, restore, vm_stack_save);
 	return ret;
 }
 
@@ -230,6 +255,32 @@ void lisp_set_line_editor(lisp_t * l, lisp_editor_func ed) {
 	l->editor = ed;
 }
 
+void lisp_set_native_compiler(lisp_t * l, lisp_native_compiler compiler) {
+	assert(l);
+	l->native_compiler = compiler;
+}
+
+void lisp_set_tiers(lisp_t * l, size_t optimize, size_t native) {
+	assert(l);
+	l->tier_optimize = optimize;
+	l->tier_native = native;
+}
+
+int lisp_set_recursion_limits(lisp_t * l, size_t depth, size_t stack) {
+	assert(l);
+	if (!depth || depth >= UINT_MAX || !stack)
+		return -1;
+	l->max_depth = depth;
+	l->max_vm_stack = stack;
+	return 0;
+}
+
+void lisp_get_recursion_limits(lisp_t * l, size_t *depth, size_t *stack) {
+	assert(l && depth && stack);
+	*depth = l->max_depth;
+	*stack = l->max_vm_stack;
+}
+
 void lisp_set_signal(lisp_t * l, int sig) {
 	assert(l);
 	l->sig = sig;
@@ -143,6 +143,9 @@ ISX_LIST /*defines lisp subroutines for checking whether a string only contains
 	X("documentation",  subr_doc_string, "x",   "return the documentation string from a procedure")\
 	X("errno",      subr_errno,      "",    "return the current errno")\
 	X("gc",         subr_gc,         "",    "force the collection of garbage")\
+	X("gc-growth",  subr_gc_growth,  NULL,  "get the heap growth factor allowed between collections, or set it to a number greater than one")\
+	X("gc-heap-limits", subr_gc_heap_limits, NULL, "get the smallest and largest heap sizes a collection happens at, or set them (nil for no largest size)")\
+	X("gc-stats",   subr_gc_stats,   "",    "return a hash of statistics about the garbage collector and allocator")\
 	X("ilog2",      subr_ilog2,      "d",   "compute the binary logarithm of an integer")\
 	X("ipow",       subr_ipow,       "d d", "compute the integer exponentiation of two numbers")\
 	X("set-locale", subr_setlocale,  "d Z", "set the locale, this affects global state!")\
@@ -359,6 +362,79 @@ static lisp_cell_t *subr_gc(lisp_t * l, lisp_cell_t * args)
 	return gsym_tee();
 }
 
+static lisp_cell_t *subr_gc_growth(lisp_t * l, lisp_cell_t * args)
+{
+	if (lisp_check_length(args, 1) && is_arith(car(args))) {
+		if (lisp_gc_set_growth(l, get_a2f(car(args))) < 0)
+			LISP_RECOVER(l, "\"growth factor must be greater than one\"\n '%S", args);
+	} else if (!lisp_check_length(args, 0)) {
+		LISP_RECOVER(l, "\"expected () or (number)\"\n '%S", args);
+	}
+	return mk_float(l, lisp_gc_get_growth(l));
+}
+
+static lisp_cell_t *subr_gc_heap_limits(lisp_t * l, lisp_cell_t * args)
+{
+	size_t min, max;
+	if (lisp_check_length(args, 2) && is_int(car(args)) && (is_int(CADR(args)) || is_nil(CADR(args)))) {
+		intptr_t lo = get_int(car(args)), hi = is_nil(CADR(args)) ? 0 : get_int(CADR(args));
+		if (lo < 0 || hi < 0 || lisp_gc_set_heap_limits(l, lo, is_nil(CADR(args)) ? SIZE_MAX : (size_t)hi) < 0)
+			LISP_RECOVER(l, "\"invalid heap limits\"\n '%S", args);
+	} else if (!lisp_check_length(args, 0)) {
+		LISP_RECOVER(l, "\"expected () or (integer integer-or-nil)\"\n '%S", args);
+	}
+	lisp_gc_get_heap_limits(l, &min, &max);
+	return cons(l, mk_int(l, min), cons(l, max > INTPTR_MAX ? gsym_nil() : mk_int(l, max), gsym_nil()));
+}
+
+/**@brief insert a value into a hash, in the same way "hash-insert" does*/
+static void stats_insert(lisp_t * l, lisp_cell_t * h, const char *key, lisp_cell_t * val)
+{
+	lisp_cell_t *k = mk_str(l, lisp_strdup(l, key));
+	if (hash_insert(get_hash(h), get_str(k), cons(l, k, val)) < 0)
+		lisp_out_of_memory(l);
+}
+
+static lisp_cell_t *stats_hash(lisp_t * l)
+{
+	hash_table_t *ht = hash_create(16);
+	if (!ht)
+		lisp_out_of_memory(l);
+	return mk_hash(l, ht);
+}
+
+/**@brief make a hash of a per type statistic, keyed by type name*/
+static lisp_cell_t *stats_per_type(lisp_t * l, const size_t *counts)
+{
+	lisp_cell_t *h = stats_hash(l);
+	for (unsigned i = 0; i < LISP_GC_STATS_TYPES; i++)
+		if (lisp_type_name(i))
+			stats_insert(l, h, lisp_type_name(i), mk_int(l, counts[i]));
+	return h;
+}
+
+static lisp_cell_t *subr_gc_stats(lisp_t * l, lisp_cell_t * args)
+{
+	UNUSED(args);
+	lisp_gc_stats_t s;
+	lisp_cell_t *h;
+	lisp_gc_get_stats(l, &s);
+	h = stats_hash(l);
+	stats_insert(l, h, "full",         mk_int(l, s.full));
+	stats_insert(l, h, "minor",        mk_int(l, s.minor));
+	stats_insert(l, h, "incremental",  mk_int(l, s.incremental));
+	stats_insert(l, h, "pauses",       mk_int(l, s.pauses));
+	stats_insert(l, h, "pause-total",  mk_float(l, s.pause_total));
+	stats_insert(l, h, "pause-max",    mk_float(l, s.pause_max));
+	stats_insert(l, h, "gc-stack-max", mk_int(l, s.gc_stack_max));
+	stats_insert(l, h, "allocated",       stats_per_type(l, s.allocated));
+	stats_insert(l, h, "allocated-bytes", stats_per_type(l, s.allocated_bytes));
+	stats_insert(l, h, "freed",           stats_per_type(l, s.freed));
+	stats_insert(l, h, "freed-bytes",     stats_per_type(l, s.freed_bytes));
+	stats_insert(l, h, "live",            stats_per_type(l, s.live));
+	return h;
+}
+
 static lisp_cell_t *subr_ilog2(lisp_t * l, lisp_cell_t * args)
 {
 	return mk_int(l, ilog2(get_int(car(args))));
@@ -477,7 +553,7 @@ static lisp_cell_t *subr_crc(lisp_t * l, lisp_cell_t * args)
 
 static lisp_cell_t *subr_hash(lisp_t * l, lisp_cell_t * args)
 {
-	return mk_int(l, djb2(get_str(car(args)), get_length(car(args))));
+	return mk_int(l, (intptr_t)xxh64(get_str(car(args)), get_length(car(args)), 0));
 }
 
 int lisp_module_initialize(lisp_t *l)
@@ -9,8 +9,11 @@
 #include <assert.h>
 #include <libtcc.h>
 #include <lispmod.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #define SUBROUTINE_XLIST\
         X("cc",                    subr_compile,      NULL, "compile a string as C code")\
@@ -20,6 +23,8 @@
         X("cc-add-include-path",   subr_add_include_path, NULL, "add an include path for the C compiler")\
         X("cc-add-system-include-path", subr_add_sysinclude_path, NULL, "add a system include path for the C compiler")\
         X("cc-set-library-path",   subr_set_lib_path, NULL, "add a library path for the C compiler to look in")\
+        X("cc-procedure",          subr_cc_procedure, "s", "compile the procedure a symbol is bound to into machine code, if it only does integer arithmetic and only calls itself as a tail call, and rebind the symbol to the result")\
+        X("cc-procedure-source",   subr_cc_procedure_source, "s", "get the C the procedure a symbol is bound to is translated into by cc-procedure")\
 
 #define X(NAME, SUBR, VALIDATION, DOCSTRING) static lisp_cell_t * SUBR (lisp_t *l, lisp_cell_t *args);
 SUBROUTINE_XLIST		/*function prototypes for all of the built-in subroutines */
@@ -116,6 +121,503 @@ static lisp_cell_t *subr_set_lib_path(lisp_t * l, lisp_cell_t * args)
 	return gsym_tee();
 }
 
+/********************************* translator *********************************/
+
+/* Procedures that only do integer arithmetic, tests, loops, and calls to
+ * themselves can be translated into C and compiled into a subroutine with
+ * a compiler state of their own. Every variable is a C integer named
+ * after its position, "v0" onwards, with the arguments first. Each
+ * expression is translated into statements that put its value into one
+ * of these variables, so "if", "cond", "while" and "let" become C
+ * statements. Anything else, such as a float, a global variable or a
+ * call to another procedure, stops the translation.
+ *
+ * A call to itself has to be a tail call, which becomes a jump back to
+ * the start of the procedure. Compiled code would otherwise recurse on the
+ * C stack, which is far smaller than the stack the byte code recurses on,
+ * so a procedure that recurses any other way is left as byte code and
+ * compiling it never changes how deep it can recurse. */
+
+#define JIT_MAX_VARIABLES (1024) /**< C variables a translation can use*/
+
+typedef enum {
+	JIT_VALUE,  /**< an operator giving an integer*/
+	JIT_DIVIDE, /**< as JIT_VALUE, failing if the divisor is invalid*/
+	JIT_TEST    /**< an operator giving t or nil*/
+} jit_kind_t;
+
+/* The operators that can be translated, with the statement each becomes.
+ * A call is only translated if the symbol is bound, where the procedure was
+ * made, to the primitive it was bound to when this module was loaded, see
+ * jit_operator.*/
+#define JIT_OPERATOR_XLIST\
+	X("+",  2, JIT_VALUE,  "v%u = v%u + v%u;")\
+	X("-",  2, JIT_VALUE,  "v%u = v%u - v%u;")\
+	X("*",  2, JIT_VALUE,  "v%u = v%u * v%u;")\
+	X("/",  2, JIT_DIVIDE, "v%u = v%u / v%u;")\
+	X("%",  2, JIT_DIVIDE, "v%u = v%u %% v%u;")\
+	X("&",  2, JIT_VALUE,  "v%u = v%u & v%u;")\
+	X("|",  2, JIT_VALUE,  "v%u = v%u | v%u;")\
+	X("^",  2, JIT_VALUE,  "v%u = v%u ^ v%u;")\
+	X("<<", 2, JIT_VALUE,  "v%u = (intptr_t)((uintptr_t)v%u << ((uintptr_t)v%u & JIT_SHIFT_MASK));")\
+	X(">>", 2, JIT_VALUE,  "v%u = (intptr_t)((uintptr_t)v%u >> ((uintptr_t)v%u & JIT_SHIFT_MASK));")\
+	X("~",  1, JIT_VALUE,  "v%u = ~v%u;")\
+	X("<",  2, JIT_TEST,   "v%u = v%u < v%u;")\
+	X(">",  2, JIT_TEST,   "v%u = v%u > v%u;")\
+	X("=",  2, JIT_TEST,   "v%u = v%u == v%u;")\
+	X("eq", 2, JIT_TEST,   "v%u = v%u == v%u;")
+
+static struct {
+	const char *name;
+	unsigned arity;
+	jit_kind_t kind;
+	const char *c;
+	lisp_subr_func subr; /**< what "name" was bound to*/
+} jit_operators[] = {
+#define X(NAME, ARITY, KIND, C) { NAME, ARITY, KIND, C, NULL },
+	JIT_OPERATOR_XLIST
+#undef X
+	{ NULL, 0, JIT_VALUE, NULL, NULL }
+};
+
+typedef struct {
+	char *s;
+	size_t used, allocated;
+	int failed;
+} jit_buffer_t; /**< C source being written*/
+
+typedef struct {
+	lisp_t *l;
+	jit_buffer_t body;    /**< the body of the procedure as C*/
+	lisp_cell_t *proc,    /**< the procedure, calls to it are made directly*/
+		    *failed,  /**< expression that could not be translated*/
+		    *names[JIT_MAX_VARIABLES]; /**< variables in scope*/
+	unsigned vars[JIT_MAX_VARIABLES], /**< the C variable of each name*/
+		 scope,       /**< number of names in scope*/
+		 count,       /**< C variables used*/
+		 args;        /**< arguments of the procedure*/
+	int ready[JIT_MAX_VARIABLES]; /**< has the variable been bound yet*/
+} jit_t;
+
+typedef struct jitted {
+	TCCState *st;
+	char *format;
+	struct jitted *next;
+} jitted_t; /**< compiled procedures, kept until the module is unloaded*/
+
+static jitted_t *jitted;
+static lisp_mutex_t jitted_lock = LISP_MUTEX_INITIALIZER;
+
+static int jit_printf(jit_buffer_t *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+	if (b->failed)
+		return -1;
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(b->s ? b->s + b->used : NULL, b->allocated - b->used, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			return b->failed = 1, -1;
+		if (b->used + n < b->allocated)
+			break;
+		size_t allocated = (b->allocated + n + 1) * 2;
+		char *s = realloc(b->s, allocated);
+		if (!s)
+			return b->failed = 1, -1;
+		b->s = s;
+		b->allocated = allocated;
+	}
+	b->used += n;
+	return n;
+}
+
+/**@brief the translation of "exp" has failed, which is reported*/
+static int jit_fail(jit_t *j, lisp_cell_t *exp)
+{
+	if (!j->failed)
+		j->failed = exp;
+	return 0;
+}
+
+static int jit_variable(jit_t *j, unsigned *v)
+{
+	if (j->count >= JIT_MAX_VARIABLES)
+		return 0;
+	*v = j->count++;
+	return 1;
+}
+
+/**@brief find the C variable a symbol in scope is*/
+static int jit_find(jit_t *j, lisp_cell_t *sym, unsigned *v)
+{
+	for (unsigned i = j->scope; i; i--)
+		if (j->names[i - 1] == sym) {
+			*v = j->vars[i - 1];
+			return j->ready[i - 1];
+		}
+	return 0;
+}
+
+static int jit_in_scope(jit_t *j, lisp_cell_t *sym)
+{
+	for (unsigned i = j->scope; i; i--)
+		if (j->names[i - 1] == sym)
+			return 1;
+	return 0;
+}
+
+/**@brief find the operator a call is to, which has to be what its symbol
+ * was bound to when the module was loaded, and not a variable, either of
+ * the procedure or of the environment it was made in, such as a closure
+ * @return index into jit_operators, or -1 if it is not an operator*/
+static int jit_operator(jit_t *j, lisp_cell_t *head, unsigned argc)
+{
+	lisp_cell_t *f;
+	if (!is_sym(head) || jit_in_scope(j, head))
+		return -1;
+	for (int i = 0; jit_operators[i].name; i++) {
+		if (strcmp(jit_operators[i].name, get_sym(head)) || jit_operators[i].arity != argc)
+			continue;
+		f = lisp_lookup(j->l, head, get_proc_env(j->proc));
+		return f && is_subr(f) && get_subr(f) == jit_operators[i].subr ? i : -1;
+	}
+	return -1;
+}
+
+/**@brief is a call to the procedure being translated, through a symbol
+ * that is not a variable and is bound to it where it was made*/
+static int jit_self(jit_t *j, lisp_cell_t *head)
+{
+	if (!is_sym(head) || jit_in_scope(j, head))
+		return 0;
+	return lisp_lookup(j->l, head, get_proc_env(j->proc)) == j->proc;
+}
+
+static int jit_expression(jit_t *j, lisp_cell_t *exp, unsigned to, int tail);
+static int jit_statement(jit_t *j, lisp_cell_t *exp);
+
+/**@brief translate the arguments of a call into new variables*/
+static int jit_arguments(jit_t *j, lisp_cell_t *args, unsigned *v)
+{
+	for (unsigned i = 0; is_cons(args); args = cdr(args), i++)
+		if (!jit_variable(j, &v[i]) || !jit_expression(j, car(args), v[i], 0))
+			return 0;
+	return 1;
+}
+
+/**@brief translate an expression used as a test, "to" is set to 0 if it
+ * is nil and 1 otherwise. Integers are never nil.*/
+static int jit_test(jit_t *j, lisp_cell_t *exp, unsigned to)
+{
+	unsigned v[2];
+	int op;
+	if (exp == gsym_nil() || exp == gsym_tee())
+		return jit_printf(&j->body, "v%u = %d;\n", to, exp == gsym_tee()) >= 0;
+	if (is_cons(exp) && is_list(exp)
+	    && (op = jit_operator(j, car(exp), get_length(cdr(exp)))) >= 0
+	    && jit_operators[op].kind == JIT_TEST) {
+		if (!jit_arguments(j, cdr(exp), v))
+			return 0;
+		jit_printf(&j->body, jit_operators[op].c, to, v[0], v[1]);
+		return jit_printf(&j->body, "\n") >= 0;
+	}
+	if (!jit_expression(j, exp, to, 0))
+		return 0;
+	return jit_printf(&j->body, "v%u = 1;\n", to) >= 0;
+}
+
+/**@brief translate a list of expressions, the last of which gives the
+ * value put in "to", and is in a tail position if "tail" is set*/
+static int jit_sequence(jit_t *j, lisp_cell_t *exps, unsigned to, int tail)
+{
+	if (!is_cons(exps) || !is_list(exps))
+		return jit_fail(j, exps);
+	for (; is_cons(cdr(exps)); exps = cdr(exps))
+		if (!jit_statement(j, car(exps)))
+			return 0;
+	return jit_expression(j, car(exps), to, tail);
+}
+
+/**@brief translate a "let", each variable is in scope from the
+ * expression it is bound to onwards, but may not be used until it has
+ * been bound, as it is nil until then*/
+static int jit_let(jit_t *j, lisp_cell_t *exp, unsigned to, int tail)
+{
+	unsigned scope = j->scope;
+	int r = 0;
+	lisp_cell_t *b;
+	for (b = cdr(exp); is_cons(cdr(b)); b = cdr(b)) {
+		unsigned v;
+		if (!is_list(car(b)) || get_length(car(b)) != 2 || !is_sym(car(car(b))) || j->scope >= JIT_MAX_VARIABLES)
+			goto done;
+		if (!jit_variable(j, &v))
+			goto done;
+		j->names[j->scope] = car(car(b));
+		j->vars[j->scope] = v;
+		j->ready[j->scope++] = 0;
+		if (!jit_expression(j, car(cdr(car(b))), v, 0))
+			goto done;
+		j->ready[j->scope - 1] = 1;
+	}
+	r = jit_expression(j, car(b), to, tail);
+ done:
+	j->scope = scope;
+	return r || jit_fail(j, exp);
+}
+
+static int jit_expression(jit_t *j, lisp_cell_t *exp, unsigned to, int tail)
+{
+	lisp_cell_t *head, *args;
+	unsigned v[3], n;
+	int op;
+	if (is_int(exp)) {
+		if (get_int(exp) == INTPTR_MIN)
+			return jit_printf(&j->body, "v%u = INTPTR_MIN;\n", to) >= 0;
+		return jit_printf(&j->body, "v%u = %jd;\n", to, (intmax_t)get_int(exp)) >= 0;
+	}
+	if (is_sym(exp) && jit_find(j, exp, &v[0]))
+		return jit_printf(&j->body, "v%u = v%u;\n", to, v[0]) >= 0;
+	if (!is_cons(exp) || !is_list(exp))
+		return jit_fail(j, exp);
+	head = car(exp);
+	args = cdr(exp);
+	n = get_length(args);
+	if (head == gsym_iif()) {
+		if (n != 3 || !jit_variable(j, &v[0]) || !jit_test(j, car(args), v[0]))
+			return jit_fail(j, exp);
+		jit_printf(&j->body, "if (v%u) {\n", v[0]);
+		if (!jit_expression(j, car(cdr(args)), to, tail))
+			return 0;
+		jit_printf(&j->body, "} else {\n");
+		if (!jit_expression(j, car(cdr(cdr(args))), to, tail))
+			return 0;
+		return jit_printf(&j->body, "}\n") >= 0;
+	}
+	if (head == gsym_cond()) { /*the last clause must always be taken*/
+		unsigned clauses = 0;
+		for (; is_cons(args); args = cdr(args), clauses++) {
+			lisp_cell_t *c = car(args);
+			if (!is_list(c) || get_length(c) != 2)
+				return jit_fail(j, exp);
+			if (car(c) == gsym_tee())
+				break;
+			if (!jit_variable(j, &v[0]) || !jit_test(j, car(c), v[0]))
+				return jit_fail(j, exp);
+			jit_printf(&j->body, "if (v%u) {\n", v[0]);
+			if (!jit_expression(j, car(cdr(c)), to, tail))
+				return 0;
+			jit_printf(&j->body, "} else {\n");
+		}
+		if (!is_cons(args) || !jit_expression(j, car(cdr(car(args))), to, tail))
+			return jit_fail(j, exp);
+		while (clauses--)
+			jit_printf(&j->body, "}\n");
+		return !j->body.failed;
+	}
+	if (head == gsym_progn())
+		return jit_sequence(j, args, to, tail);
+	if (head == gsym_setq()) {
+		if (n != 2 || !is_sym(car(args)) || !jit_find(j, car(args), &v[0]))
+			return jit_fail(j, exp);
+		if (!jit_expression(j, car(cdr(args)), v[0], 0))
+			return 0;
+		return jit_printf(&j->body, "v%u = v%u;\n", to, v[0]) >= 0;
+	}
+	if (head == gsym_let())
+		return n < 1 ? jit_fail(j, exp) : jit_let(j, exp, to, tail);
+	if (n == j->args && jit_self(j, head)) { /*the arguments are v0 onwards*/
+		unsigned call[JIT_MAX_VARIABLES];
+		if (!tail || !jit_arguments(j, args, call))
+			return jit_fail(j, exp);
+		for (unsigned i = 0; i < n; i++)
+			jit_printf(&j->body, "v%u = v%u;\n", i, call[i]);
+		return jit_printf(&j->body, "goto top;\n") >= 0;
+	}
+	if ((op = jit_operator(j, head, n)) < 0 || jit_operators[op].kind == JIT_TEST)
+		return jit_fail(j, exp);
+	if (!jit_arguments(j, args, v))
+		return 0;
+	if (jit_operators[op].kind == JIT_DIVIDE) /*as the primitives check*/
+		jit_printf(&j->body, "if (!v%u || (v%u == INTPTR_MIN && v%u == -1)) jit_error(l, v%u, v%u);\n", v[1], v[0], v[1], v[0], v[1]);
+	if (n == 1)
+		jit_printf(&j->body, jit_operators[op].c, to, v[0]);
+	else
+		jit_printf(&j->body, jit_operators[op].c, to, v[0], v[1]);
+	return jit_printf(&j->body, "\n") >= 0;
+}
+
+/**@brief translate an expression whose value is not used, which can be a
+ * "while" loop, as its value is nil*/
+static int jit_statement(jit_t *j, lisp_cell_t *exp)
+{
+	unsigned v;
+	if (!jit_variable(j, &v))
+		return jit_fail(j, exp);
+	if (!is_cons(exp) || car(exp) != gsym_dowhile())
+		return jit_expression(j, exp, v, 0);
+	if (!is_list(exp) || get_length(exp) < 2)
+		return jit_fail(j, exp);
+	jit_printf(&j->body, "for (;;) {\n");
+	if (!jit_test(j, car(cdr(exp)), v))
+		return 0;
+	jit_printf(&j->body, "if (!v%u) break;\n", v);
+	for (exp = cdr(cdr(exp)); is_cons(exp); exp = cdr(exp))
+		if (!jit_statement(j, car(exp)))
+			return 0;
+	return jit_printf(&j->body, "}\n") >= 0;
+}
+
+/**@brief called by compiled code when it fails, with the dividend and
+ * divisor of a division*/
+static void jit_error(lisp_t *l, intptr_t x, intptr_t y)
+{
+	LISP_RECOVER(l, "\"invalid divisor values\"\n '%S", mk_list(l, mk_int(l, x), mk_int(l, y), NULL));
+}
+
+/**@brief translate a procedure into C, which has a function "entry" that
+ * is the subroutine and is put in "source", "name" is what is logged
+ * @return zero if it could not be translated, which is logged*/
+static int jit_translate(lisp_t *l, lisp_cell_t *proc, const char *name, jit_buffer_t *source)
+{
+	jit_t *j;
+	lisp_cell_t *a;
+	unsigned result, i;
+	if (!(j = calloc(1, sizeof(*j))))
+		return 0;
+	j->l = l;
+	j->proc = proc;
+	for (a = get_proc_args(proc); is_cons(a); a = cdr(a)) {
+		if (!is_sym(car(a)) || j->args >= JIT_MAX_VARIABLES / 2)
+			goto fail;
+		j->names[j->scope] = car(a);
+		j->vars[j->scope] = j->args++;
+		j->ready[j->scope++] = 1;
+	}
+	if (!is_nil(a)) /*it takes a list of the rest of its arguments*/
+		goto fail;
+	j->count = j->args;
+	if (!jit_variable(j, &result) || !jit_sequence(j, get_proc_code(proc), result, 1) || j->body.failed)
+		goto fail;
+
+	jit_printf(source, "#include <stdint.h>\n"
+		"#define JIT_SHIFT_MASK (sizeof(intptr_t) * 8 - 1) /*as the primitives shift*/\n"
+		"void *mk_int(void *l, intptr_t d);\n"
+		"intptr_t get_int(void *x);\n"
+		"void *car(void *x);\n"
+		"void *cdr(void *x);\n"
+		"void jit_error(void *l, intptr_t x, intptr_t y);\n"
+		"static intptr_t body(void *l");
+	for (i = 0; i < j->args; i++)
+		jit_printf(source, ", intptr_t v%u", i);
+	jit_printf(source, ") {\n");
+	for (i = j->args; i < j->count; i++)
+		jit_printf(source, "intptr_t v%u;\n", i);
+	jit_printf(source, "top:\n%s", j->body.s);
+	jit_printf(source, "return v%u;\n}\nvoid *entry(void *l, void *args) {\n", result);
+	for (i = 0; i < j->args; i++)
+		jit_printf(source, "intptr_t v%u = get_int(car(args));\nargs = cdr(args);\n", i);
+	jit_printf(source, "return mk_int(l, body(l");
+	for (i = 0; i < j->args; i++)
+		jit_printf(source, ", v%u", i);
+	jit_printf(source, "));\n}\n");
+	free(j->body.s);
+	free(j);
+	return !source->failed;
+ fail:
+	if (j->failed)
+		lisp_log_note(l, "'cc-procedure \"cannot translate\" '%s '%S", name, j->failed);
+	else
+		lisp_log_note(l, "'cc-procedure \"cannot translate\" '%s", name);
+	free(j->body.s);
+	free(j);
+	return 0;
+}
+
+/**@brief translate a procedure and compile it into a subroutine that only
+ * takes integers, what it is compiled into is kept until the module is
+ * unloaded
+ * @return the subroutine, or NULL if it could not be made*/
+static lisp_cell_t *jit_compile(lisp_t *l, lisp_cell_t *proc, const char *name)
+{
+	jit_buffer_t source = { NULL, 0, 0, 0 };
+	lisp_cell_t *doc;
+	jitted_t *c = NULL;
+	lisp_subr_func func;
+	unsigned n = get_length(get_proc_args(proc));
+	if (!jit_translate(l, proc, name, &source))
+		goto fail;
+	if (!(c = calloc(1, sizeof(*c))) || !(c->format = calloc(n + 1, 2)))
+		goto fail;
+	for (unsigned i = 0; i < n; i++) /*only integers were translated for*/
+		strcat(c->format, i ? " d" : "d");
+	c->st = tcc_new();
+	tcc_set_output_type(c->st, TCC_OUTPUT_MEMORY);
+	tcc_add_symbol(c->st, "mk_int", (const void *)mk_int);
+	tcc_add_symbol(c->st, "get_int", (const void *)get_int);
+	tcc_add_symbol(c->st, "car", (const void *)car);
+	tcc_add_symbol(c->st, "cdr", (const void *)cdr);
+	tcc_add_symbol(c->st, "jit_error", (const void *)jit_error);
+	if (tcc_compile_string(c->st, source.s) < 0
+	    || tcc_relocate(c->st, TCC_RELOCATE_AUTO) < 0
+	    || !(func = (lisp_subr_func) tcc_get_symbol(c->st, "entry"))) {
+		tcc_delete(c->st);
+		goto fail;
+	}
+	free(source.s);
+	lisp_mutex_lock(&jitted_lock);
+	c->next = jitted;
+	jitted = c;
+	lisp_mutex_unlock(&jitted_lock);
+	doc = get_func_docstring(proc);
+	return mk_subr(l, func, c->format, doc && is_asciiz(doc) ? get_str(doc) : NULL);
+ fail:
+	if (c)
+		free(c->format);
+	free(c);
+	free(source.s);
+	return NULL;
+}
+
+/**@brief the native compiler procedures are promoted to when they have
+ * been called often enough, see lisp_set_tiers*/
+static lisp_cell_t *jit_native(lisp_t *l, lisp_cell_t *proc)
+{
+	return jit_compile(l, proc, "lambda");
+}
+
+/**@brief get the procedure "sym" is bound to, which is logged if it is not
+ * one*/
+static lisp_cell_t *jit_procedure(lisp_t *l, lisp_cell_t *sym)
+{
+	lisp_cell_t *proc = lisp_eval(l, sym);
+	if (proc && is_proc(proc))
+		return proc;
+	lisp_log_note(l, "'cc-procedure \"not a procedure\" '%s", get_sym(sym));
+	return NULL;
+}
+
+static lisp_cell_t *subr_cc_procedure(lisp_t * l, lisp_cell_t * args)
+{
+	lisp_cell_t *proc, *r;
+	if (!(proc = jit_procedure(l, car(args))) || !(r = jit_compile(l, proc, get_sym(car(args)))))
+		return gsym_error();
+	lisp_add_cell(l, get_sym(car(args)), r);
+	return r;
+}
+
+static lisp_cell_t *subr_cc_procedure_source(lisp_t * l, lisp_cell_t * args)
+{
+	jit_buffer_t source = { NULL, 0, 0, 0 };
+	lisp_cell_t *proc = jit_procedure(l, car(args));
+	if (!proc || !jit_translate(l, proc, get_sym(car(args)), &source)) {
+		free(source.s);
+		return gsym_error();
+	}
+	return mk_str(l, source.s);
+}
+
 int lisp_module_initialize(lisp_t *l)
 {
 	assert(l);
@@ -138,8 +640,15 @@ int lisp_module_initialize(lisp_t *l)
 	tcc_set_output_type(st, TCC_OUTPUT_MEMORY);
 	lisp_add_cell(l, "*compile-state*", mk_user(l, st, ud_tcc));
 
+	for (int i = 0; jit_operators[i].name; i++) {
+		lisp_cell_t *f = lisp_eval(l, lisp_intern(l, jit_operators[i].name));
+		if (f && is_subr(f))
+			jit_operators[i].subr = get_subr(f);
+	}
+
 	if(lisp_add_module_subroutines(l, primitives, 0) < 0)
 		goto fail;
+	lisp_set_native_compiler(l, jit_native);
 	return 0;
  fail:
 	return -1;
@@ -149,7 +658,16 @@ int lisp_module_initialize(lisp_t *l)
 static void construct(void) __attribute__ ((constructor));
 static void destruct(void) __attribute__ ((destructor));
 static void construct(void) {}
-static void destruct(void) {}
+static void destruct(void)
+{
+	while (jitted) {
+		jitted_t *next = jitted->next;
+		tcc_delete(jitted->st);
+		free(jitted->format);
+		free(jitted);
+		jitted = next;
+	}
+}
 #elif _WIN32
 #include <windows.h>
 BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
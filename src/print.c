@@ -93,10 +93,9 @@ static int print_hash(lisp_t *l, io_t *o, unsigned depth, hash_table_t *ht) {
 	hash_entry_t *cur;
 	if((ret = lisp_printf(l, o, depth, "{")) < 0)
 		return -1;
-	for(i = 0; i < ht->len; i++)
-		if(ht->table[i])
+	for(i = 0; i < hash_bin_count(ht); i++)
 		/**@warning messy hash stuff*/
-		for(cur = ht->table[i]; cur; cur = cur->next) {
+		if((cur = hash_bin(ht, i))) {
 			int n = 0;
 			io_putc(' ', o);
 			if(is_cons(cur->val) && is_sym(car(cur->val)))
@@ -202,7 +201,7 @@ int printer(lisp_t *l, io_t *o, lisp_cell_t *op, unsigned depth) {
 		lisp_log_error(l, "%r'print-depth-exceeded %d%t", (intptr_t) depth);
 		return -1;
 	}
-	switch(op->type) {
+	switch(TYPE_OF(op)) {
 	case INTEGER:
 		lisp_printf(l, o, depth, "%m%d", get_int(op));
 		break;
@@ -212,13 +211,13 @@ int printer(lisp_t *l, io_t *o, lisp_cell_t *op, unsigned depth) {
 	case CONS:
 		if(depth && o->pretty)
 			lisp_printf(l, o, depth, "\n%@ ");
-		if(op->mark) {
-			op->mark = 0;
+		if(op->printing) {
+			op->printing = 0;
 			lisp_printf(l, o, depth, "%g<recurse:%d>%t", (intptr_t)op);
 			return 0;
 		}
 		tmp = op;
-		op->mark = 1;
+		op->printing = 1;
 		io_putc('(', o);
 		for(;;) {
 			printer(l, o, car(op), depth + 1);
@@ -227,17 +226,17 @@ int printer(lisp_t *l, io_t *o, lisp_cell_t *op, unsigned depth) {
 				break;
 			}
 			op = cdr(op);
-			if(op->mark) {
-				lisp_printf(l, o, depth, "%g <recurse:%d>%t)", (intptr_t)op);
-				break;
-			}
 			if(!is_cons(op)) {
 				lisp_printf(l, o, depth, " . %S)", op);
 				break;
 			}
+			if(op->printing) {
+				lisp_printf(l, o, depth, "%g <recurse:%d>%t)", (intptr_t)op);
+				break;
+			}
 			io_putc(' ', o);
 		}
-		tmp->mark = 0;
+		tmp->printing = 0;
 		break;
 	case SYMBOL:
 		if(is_nil(op)) lisp_printf(l, o, depth, "%rnil");
@@ -246,13 +245,23 @@ int printer(lisp_t *l, io_t *o, lisp_cell_t *op, unsigned depth) {
 	case STRING:
 		print_escaped_string(l, o, depth, get_str(op));
 		break;
+	case REF: /*resolved code prints as it was written*/
+		lisp_printf(l, o, depth, "%y%s", get_sym(get_ref_sym(op)));
+		break;
 	case SUBR:
 		lisp_printf(l, o, depth, "%B<subroutine:%d>", get_int(op));
 		break;
-	case PROC: case FPROC:
+	case FRAME:
+		lisp_printf(l, o, depth, "%B<frame:%d>", (intptr_t)get_frame_count(op));
+		break;
+	case CODE:
+		lisp_printf(l, o, depth, "%B<code:%d>", get_int(op));
+		break;
+	case PROC: case FPROC: case MACRO:
 		lisp_printf(l, o, depth+1,
-			is_proc(op) ? "(%ylambda%t %S %S " :
-				      "(%yflambda%t %S %S ",
+			is_proc(op)  ? "(%ylambda%t %S %S " :
+			is_fproc(op) ? "(%yflambda%t %S %S " :
+				       "(%ymacro%t %S %S ",
 					get_func_docstring(op), get_proc_args(op));
 		for(tmp = get_proc_code(op); !is_nil(tmp); tmp = cdr(tmp)) {
 			printer(l, o, car(tmp), depth+1);
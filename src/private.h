@@ -22,9 +22,29 @@ extern "C" {
 #define DEFAULT_LEN       (256)   /**< just an arbitrary number*/
 #define LARGE_DEFAULT_LEN (4096)  /**< just another arbitrary number*/
 #define MAX_USER_TYPES    (256)   /**< max number of user defined types*/
-#define COLLECTION_POINT  (1<<20) /**< run gc after this many allocs*/
+#define GC_HEAP_MIN       (1<<24) /**< default heap size in bytes a full gc is never run below*/
+#define GC_HEAP_MAX       SIZE_MAX /**< default heap size in bytes a full gc is always run above*/
+#define GC_GROWTH         (2.0)   /**< default heap growth allowed between full collections*/
+#define GC_NURSERY_SIZE   (1<<16) /**< minor collection after this many allocs*/
+#define GC_SLICE_BUDGET   (1<<12) /**< default work done by an incremental collector slice*/
+#define GC_SLICE_RATIO    (4)     /**< incremental work done for each cell allocated*/
+#define GC_GREY_MAX       (1<<20) /**< most cells on the grey stack before it overflows*/
 #define BITS_IN_LENGTH    (32)    /**< number of bits in a length field*/
-#define MAX_RECURSION_DEPTH (4096) /**< maximum recursion depth*/
+#define MAX_RECURSION_DEPTH (4096) /**< default recursion depth on the C stack, see lisp_set_recursion_limits*/
+#define MAX_VM_STACK      (1<<22) /**< default cells the stack of the virtual machine grows to*/
+#define HEAP_CLASSES      (8)     /**< largest cell, in fields, served by the cell heap*/
+#define HEAP_BLOCK_SIZE   (1<<13) /**< size of a cell heap block, a power of two*/
+#define HEAP_CHUNK_BLOCKS (16)    /**< number of blocks requested from the system at once*/
+#define HASH_MIGRATE_BINS (4)     /**< bins moved to a growing hash table per insert*/
+#define NAME_BLOCK_SIZE   (1<<14) /**< bytes of symbol names held in each name block*/
+
+/**@brief When true (the default) cells are allocated from blocks of
+ * identically sized slots, otherwise each cell is allocated with its own
+ * call to calloc and tracked in a linked list, which is slower but is more
+ * useful when debugging the interpreter with tools like valgrind. */
+#ifndef USE_CELL_HEAP
+#define USE_CELL_HEAP (1)
+#endif
 
 /**@warning the following list must be kept in sync with the
  * gsym_X functions defined in there liblisp.h header (such as gsym_nil,
@@ -36,15 +56,34 @@ extern "C" {
 	X(cond,    "cond")    X(error,   "error")  X(let,     "let")\
        	X(compile, "compile") X(macro,   "macro")  X(dowhile, "while")\
 
+/**@brief The special forms, a subset of CELL_XLIST. The symbol of each
+ * holds its index in its "form" field, every other cell holds FORM_NONE,
+ * so eval finds the form with one switch instead of comparing the head
+ * of every expression against each of them in turn.*/
+#define FORM_XLIST \
+	X(quote)   X(iif)     X(lambda)  X(flambda) X(define)  X(setq)\
+	X(progn)   X(cond)    X(let)     X(compile) X(macro)   X(dowhile)
+
+typedef enum {
+	FORM_NONE, /**< not a special form*/
+#define X(CNAME) FORM_ ## CNAME,
+	FORM_XLIST
+#undef X
+} lisp_form; /**< special form of a symbol, there must be fewer than 16*/
+
 /**@brief This restores a jmp_buf stored in lisp environment if it
- *	has been copied out to make way for another jmp_buf.
+ *	has been copied out to make way for another jmp_buf, along with
+ *	the stack of the virtual machine, which after an error still holds
+ *	the activations that were abandoned.
  * @param USED is RBUF used?
  * @param ENV  lisp environment to restore jmp_buf to
- * @param RBUF jmp_buf to restore**/
-#define LISP_RECOVER_RESTORE(USED, ENV, RBUF)\
+ * @param RBUF jmp_buf to restore
+ * @param VM   elements of the virtual machine stack in use before**/
+#define LISP_RECOVER_RESTORE(USED, ENV, RBUF, VM)\
 	do {\
 		if((USED)) memcpy((ENV)->recover, (RBUF), sizeof(jmp_buf));\
 		else (ENV)->recover_init = 0;\
+		(ENV)->vm_stack_used = (VM);\
 	} while(0)
 
 typedef enum {
@@ -58,10 +97,14 @@ typedef enum {
 	IO,      /**< Input/Output port*/
 	HASH,    /**< Associative hash table*/
 	FPROC,   /**< F-Expression*/
-/*	MACRO,   // Macro */
 	FLOAT,   /**< Floating point number; could be float or double*/
-	USERDEF  /**< User defined types*/
-	/**@todo CLOSURE, MACRO (replaces FPROC), VECTORs (array of same type, strings really
+	USERDEF, /**< User defined types*/
+	FRAME,   /**< Variables of a procedure call or "let", see mk_frame*/
+	REF,     /**< Variable in code resolved to a frame and slot, see resolve*/
+	CODE,    /**< Body of a procedure compiled to byte code, see vm.c*/
+	MACRO    /**< Procedure run on the code of a call, which is then replaced
+	              by the code it returns, see macro_expand in eval.c*/
+	/**@todo CLOSURE, VECTORs (array of same type, strings really
 	 * should be a vector of chars). */
 } lisp_type;     /**< A lisp object*/
 
@@ -91,35 +134,75 @@ struct cell {
 		mark:    1,        /**< mark for garbage collection*/
 		uncollectable: 1,  /**< do not free object?*/
 		close:   1,        /**< object closed/invalid?*/
-		used:    1; /**< object is in use by something outside lisp interpreter*/
+		used:    1, /**< object is in use by something outside lisp interpreter*/
+		heap:    1, /**< allocated from a cell heap block, not by calloc*/
+		old:     1, /**< survived a collection, minor collections do not trace it*/
+		dirty:   1, /**< marked or old object written to since it was last traced*/
+		printing: 1, /**< being printed, used to detect cycles*/
+		resolved: 1, /**< cons made by resolving code, see resolve in eval.c*/
+		form:    4; /**< special form a symbol names, see FORM_XLIST*/
 	cell_data_t p[1]; /**< uses the "struct hack",
 	                     c99 does not quite work here*/
 } /*__attribute__((packed)) <- saves a bit of space */;
 
+/**@brief Integers that fit into a pointer with a bit to spare are not
+ * allocated, they are held in the cell pointer itself shifted up by one
+ * with the lowest bit set, as described above. Cells are always aligned so
+ * no pointer to a real cell has that bit set. Anything that looks inside a
+ * cell that could be an integer or a float must check for this first,
+ * TYPE_OF does that and should be used instead of reading the type field
+ * directly. */
+#define FIXNUM_TAG  ((uintptr_t)1)
+#define FIXNUM_MIN  (INTPTR_MIN / 2) /**< smallest integer not allocated*/
+#define FIXNUM_MAX  (INTPTR_MAX / 2) /**< largest integer not allocated*/
+#define IS_FIXNUM(X) ((uintptr_t)(X) & FIXNUM_TAG)
+
+/**@brief On 64-bit targets using doubles most floats are not allocated
+ * either, the same way as Ruby "flonums". A double whose exponent lies
+ * within about 2^-255 to 2^255 (or that is +0.0) has its bits rotated left
+ * by three, putting two bits of the exponent that can be recomputed in the
+ * bottom of the word, which are replaced with the tag "10". Other floats
+ * get a cell as before. See mk_float and get_float. */
+#if !defined(USE_SINGLE_PRECISION_FLOATS) && UINTPTR_MAX == UINT64_MAX
+#define USE_FLONUM (1)
+#else
+#define USE_FLONUM (0)
+#endif
+#define FLONUM_TAG   ((uintptr_t)2)
+#define IMMEDIATE_MASK ((uintptr_t)3) /**< tag bits, clear in pointers*/
+#define IS_FLONUM(X) (((uintptr_t)(X) & IMMEDIATE_MASK) == FLONUM_TAG)
+#define IS_IMMEDIATE(X) ((uintptr_t)(X) & IMMEDIATE_MASK)
+#define TYPE_OF(X) (IS_IMMEDIATE(X) ? (IS_FIXNUM(X) ? INTEGER : FLOAT) : (lisp_type)(X)->type)
+#define FORM_OF(X) (IS_IMMEDIATE(X) ? FORM_NONE : (lisp_form)(X)->form) /**< special form of a cell, see FORM_XLIST*/
+
 /** @brief This describes an entry in a hash table, which is an
  *	 implementation detail of the hash, so should not be
- *	 counted upon. It represents a node in a chained hash
- *	 table */
-typedef struct hash_entry {      /**< linked list of entries in a bin*/
-	char *key;              /**< ASCII nul delimited string*/
+ *	 counted upon. Entries are stored directly in the table, which
+ *	 uses open addressing with Robin Hood hashing. */
+typedef struct hash_entry {      /**< a bin in the table*/
+	char *key;              /**< ASCII nul delimited string, NULL if the bin is empty*/
 	void *val;              /**< arbitrary value*/
-	struct hash_entry *next; /**< next item in list*/
+	uint32_t hash;          /**< full hash of the key, so it is never recomputed*/
 } hash_entry_t;
 
 struct hash_table {	        /**< a hash table*/
-	hash_entry_t **table; /**< table of linked lists*/
+	hash_entry_t *table; /**< bins, the length is a power of two*/
+	hash_entry_t *old;   /**< bins being moved into "table" after it grew, or NULL*/
 	size_t len,  /**< number of 'bins' in the hash table*/
+	       old_len,      /**< number of bins in "old"*/
+	       migrated,     /**< bins of "old" below this have been moved*/
 	       collisions,   /**< number of collisions */
 	       replacements, /**< number of entries replaced*/
-	       used          /**< number of bins used*/;
+	       used          /**< number of entries in the table*/;
 	/*state used for the foreach loop*/
 	unsigned foreach :1;  /**< if true, we are in a foreach loop*/
+	unsigned top :1;      /**< top level environment, see get_sym_global*/
 	size_t foreach_index; /**< index into foreach loop*/
-	void *foreach_cur;    /**< current entry in foreach loop*/
 	hash_free_key_f free_key; /**< called to free a key */
 	hash_free_val_f free_val; /**< called to free a value */
 	hash_compare_key_f compare; /**< called to compare a key */
 	hash_f hash; /**< called to hash a key*/
+	lisp_cell_t *owner; /**< cell wrapping this table, if any, for the write barrier*/
 };
 
 /** @brief A structure that is used to wrap up the I/O operations
@@ -160,8 +243,56 @@ struct tr_state {
 typedef struct gc_list {
 	lisp_cell_t *ref; /**< reference to cell for the garbage collector to act on*/
 	struct gc_list *next; /**< next in list*/
+	size_t size; /**< size of the cell in bytes*/
 } gc_list_t;
 
+/** @brief A block of the cell heap, it holds a number of equally sized
+ *	 slots which are either free (they have the type INVALID and are
+ *	 chained together through their first field) or in use. Blocks are
+ *	 aligned on HEAP_BLOCK_SIZE boundaries and the slots follow this
+ *	 header. */
+typedef struct heap_block {
+	struct heap_block *next, /**< next block in the same size class*/
+		*next_avail,     /**< next block with free slots*/
+		*next_young;     /**< next block allocated from since the last collection*/
+	lisp_t *owner;           /**< interpreter this block belongs to*/
+	lisp_cell_t *free;       /**< list of free slots in this block*/
+	size_t fields, /**< number of fields each cell in this block has*/
+	       size,   /**< size of each slot in bytes*/
+	       count,  /**< number of slots in this block*/
+	       live;   /**< number of slots in use*/
+	unsigned avail: 1, /**< on the list of blocks with free slots?*/
+		 young: 1, /**< on the list of blocks with young cells?*/
+		 unswept: 1; /**< not yet reached by an incremental sweep*/
+} heap_block_t;
+
+/** @brief The state an incremental collection is in, objects are traced
+ *	 and then swept a slice at a time between allocations. */
+typedef enum {
+	GC_IDLE,     /**< no incremental collection in progress*/
+	GC_MARKING,  /**< tracing objects reachable from the roots*/
+	GC_SWEEPING  /**< freeing objects that were not reached*/
+} gc_phase_t;
+
+/** @brief A chunk of memory obtained from the system, which is carved up
+ *	 into heap blocks, it is only returned when the interpreter is
+ *	 destroyed. This record lives at the end of the chunk it describes.*/
+typedef struct heap_chunk {
+	void *raw; /**< memory as returned by the allocator, not aligned*/
+	struct heap_chunk *next; /**< next chunk in list*/
+} heap_chunk_t;
+
+/** @brief Symbol names are copied into these blocks when they are
+ *	 interned, so they sit next to each other in memory. Names live as
+ *	 long as the interpreter, which frees the blocks when it is
+ *	 destroyed. */
+typedef struct name_block {
+	struct name_block *next; /**< block filled before this one*/
+	size_t size, /**< bytes available in "names"*/
+	       used; /**< bytes of "names" in use*/
+	char names[]; /**< the names, each terminated by a NUL*/
+} name_block_t;
+
 /** @brief functions the interpreter uses for user defined types */
 typedef struct {
 	/**@todo I should provide a framework for overloading various other
@@ -188,16 +319,52 @@ struct lisp {
 		*logging,     /**< interpreter logging/error stream*/
 		*cur_env,     /**< current interpreter depth*/
 		*empty_docstr,/**< empty doc string */
-		**gc_stack;   /**< garbage collection stack for working items*/
-	gc_list_t *gc_head;   /**< linked list of all allocated objects*/
+		**gc_stack,   /**< garbage collection stack for working items*/
+		**vm_stack,   /**< values and activations of the virtual machine*/
+		**gc_remembered, /**< old objects written to since the last collection*/
+		**gc_grey,    /**< marked objects whose fields have not been traced*/
+		*gc_partial;  /**< hash table an incremental slice stopped part way through*/
+	gc_list_t *gc_head;   /**< linked list of objects not in the cell heap*/
+	heap_block_t *heap_blocks[HEAP_CLASSES], /**< blocks in each size class*/
+		*heap_avail[HEAP_CLASSES], /**< blocks with free slots, per class*/
+		*heap_empty,  /**< blocks with no live cells, usable by any class*/
+		*heap_young,  /**< blocks allocated from since the last collection*/
+		*gc_sweep_block; /**< next block an incremental sweep looks at*/
+	heap_chunk_t *heap_chunks; /**< system memory the blocks came from*/
+	name_block_t *names; /**< symbol names, the block being filled first*/
 	char *token    /**< one token of put back for parser*/,
 		*buf   /**< input buffer for parser*/;
 	size_t buf_allocated,/**< size of buffer "l->buf"*/
 		buf_used,     /**< amount of buffer used by current string*/
 		gc_stack_allocated, /**< length of buffer of GC stack*/
 		gc_stack_used,      /**< elements used in GC stack*/
+		vm_stack_allocated, /**< length of the virtual machine stack*/
+		vm_stack_used,      /**< elements of the virtual machine stack in use*/
+		gc_remembered_allocated, /**< length of the remembered set*/
+		gc_remembered_used, /**< elements used in the remembered set*/
+		gc_grey_allocated, /**< length of the grey stack*/
+		gc_grey_used, /**< elements used in the grey stack*/
+		gc_partial_bin, /**< bin to carry on tracing gc_partial from*/
+		gc_sweep_class, /**< size class an incremental sweep is in*/
+		gc_budget,    /**< work done in each incremental slice*/
+		gc_next,      /**< allocations until the collector next runs*/
+		gc_live,      /**< objects alive after the last full collection*/
+		gc_bytes,     /**< bytes held by allocated cells, swept or not*/
+		gc_threshold, /**< full collection when gc_bytes goes above this*/
+		gc_heap_min,  /**< gc_threshold is never set below this*/
+		gc_heap_max,  /**< gc_threshold is never set above this*/
 		gc_collectp;  /**< garbage collect after it goes too high*/
+	double gc_growth;     /**< gc_bytes is multiplied by this to get gc_threshold*/
+	lisp_gc_mode gc_mode; /**< the collection strategy in use*/
+	lisp_gc_stats_t gc_stats; /**< garbage collector statistics*/
+	gc_phase_t gc_phase;  /**< progress of an incremental collection*/
 	lisp_editor_func editor; /**< line editor to use, optional*/
+	lisp_native_compiler native_compiler; /**< see lisp_set_native_compiler*/
+	size_t tier_optimize, /**< calls before a procedure is optimized, see lisp_set_tiers*/
+	       tier_native,   /**< calls before it is compiled to machine code*/
+	       rebound,       /**< see LISP_REBIND*/
+	       max_depth,     /**< recursion depth allowed on the C stack, see lisp_set_recursion_limits*/
+	       max_vm_stack;  /**< most cells the stack of the virtual machine grows to*/
 	lisp_user_defined_funcs_t ufuncs[MAX_USER_TYPES]; /**< for user defined types*/
 	int user_defined_types_used;   /**< number of user defined types allocated*/
 	int sig;   /**< set by signal handlers or other threads*/
@@ -208,6 +375,9 @@ struct lisp {
 		color_on:     1, /**< REPL Colorize output*/
 		prompt_on:    1, /**< REPL '>' Turn prompt on*/
 		gc_off:       1, /**< turn the garbage collector off*/
+		gc_minor:     1, /**< a minor collection is in progress*/
+		gc_draining:  1, /**< grey objects are being traced*/
+		gc_overflow:  1, /**< marked objects did not fit on the grey stack*/
 		editor_on:    1; /**< REPL Turn the line editor on*/
 	unsigned cur_depth; /**< current recursion depth of the interpreter*/
 };
@@ -223,11 +393,327 @@ struct lisp {
  * @return cell* the added cell, or NULL when an internal allocation failed**/
 lisp_cell_t *lisp_gc_add(lisp_t *l, lisp_cell_t *op);
 
+/**@brief  Allocate a new cell, with all of its fields set to zero,
+ *	 this does not add it to the garbage collection stack.
+ * @param  l      the lisp environment to allocate in
+ * @param  type   type of the new cell
+ * @param  fields number of fields the cell needs, at least one
+ * @return cell*  a new cell, this function does not return on failure**/
+lisp_cell_t *lisp_gc_alloc(lisp_t *l, lisp_type type, size_t fields);
+
+/**@brief Return all the memory held by the cell heap, and by the cells the
+ *	final sweep leaves as they are uncollectable, to the system, this
+ *	should only be called when the interpreter is being destroyed after
+ *	the final sweep.
+ * @param l      the lisp environment to release the heap of**/
+void lisp_gc_release(lisp_t *l);
+
+/**@brief Record that a pointer is being stored in an old or marked
+ *	object, so the next minor collection traces it, or so an incremental
+ *	collection traces it again, use LISP_GC_BARRIER instead of calling
+ *	this directly.
+ * @param x      an old or marked object being written to **/
+void lisp_gc_write_barrier(lisp_cell_t *x);
+
+/**@brief This must be used whenever a pointer to a cell is written into
+ *	a cell that already exists, so that a generational collection
+ *	does not miss the only reference to a young object, and so an
+ *	incremental collection does not miss an object stored in a cell
+ *	it has already traced.
+ * @param X      the cell being written to**/
+#define LISP_GC_BARRIER(X)\
+	do {\
+		if (((X)->old || (X)->mark) && !(X)->dirty) lisp_gc_write_barrier((X));\
+	} while(0)
+
 /**@brief This only performs a sweep, no objects are marked, this effectively
  *	invalidates the lisp environment!
  * @param l      the lisp environment to sweep and invalidate**/
 void lisp_gc_sweep_only(lisp_t *l);
 
+/**@brief Hash a string the same way hash tables made with hash_create do,
+ *	the hash of a symbol is worked out once with this and kept in it.
+ * @param  s      string to hash
+ * @param  len    length of s
+ * @return uint32_t the hash**/
+uint32_t hash_string(const char *s, size_t len);
+
+/**@brief Look up a key whose hash_string hash is already known, tables
+ *	that use their own hash function hash the key as usual.
+ * @param  h      hash table to look in
+ * @param  key    key to look up
+ * @param  hash   hash_string of the key
+ * @return void*  the value found or NULL**/
+void *hash_lookup_hashed(const hash_table_t *h, const char *key, uint32_t hash);
+
+/**@brief Insert a key whose hash_string hash is already known, see
+ *	hash_lookup_hashed.
+ * @param  h      hash table to insert into
+ * @param  key    key to insert, which is not copied
+ * @param  hash   hash_string of the key
+ * @param  val    value to insert
+ * @return int    negative on failure**/
+int hash_insert_hashed(hash_table_t *h, char *key, uint32_t hash, void *val);
+
+/**@brief Get the hash of the name of a symbol, as given by hash_string,
+ *	which is worked out once when the symbol is interned.
+ * @param  x        a symbol
+ * @return uint32_t the hash of its name**/
+uint32_t get_sym_hash(lisp_cell_t *x);
+
+/**@brief Get the (symbol . value) pair a symbol is bound to in the top
+ *	level environment of the interpreter it was interned in, the same
+ *	pair the top level hash holds, so a global variable is found with one
+ *	load. Top level variables should be made with lisp_extend_top, which
+ *	keeps the two in step, and not by writing to the hash directly.
+ * @param  x           a symbol
+ * @return lisp_cell_t* the pair, or NULL if the symbol is not bound at the
+ *	top level or is one of the special symbols every interpreter shares**/
+lisp_cell_t *get_sym_global(lisp_cell_t *x);
+
+/**@brief Frames hold the variables bound by a procedure call or by "let",
+ *	in the order they are named in. A frame has the environment it
+ *	extends, the list the names of its variables are taken from (the
+ *	arguments of a procedure, or the bindings of a "let" where each name
+ *	is the first element of a binding), the number of variables in use
+ *	and then their values, in that order. Frames chain to their parent
+ *	until an association list is reached, such as the top level
+ *	environment. */
+#define FRAME_HEADER (3) /**< fields of a frame before its values*/
+
+/**@brief Slot of a REF to a variable that is not in any frame, which is
+ *	looked up by name after skipping the frames in front of it.*/
+#define REF_FREE ((size_t)-1)
+
+/**@brief Get the environment a frame extends
+ * @param  x     a frame
+ * @return cell* its parent environment**/
+lisp_cell_t *get_frame_parent(lisp_cell_t *x);
+
+/**@brief Get the number of variables in use in a frame
+ * @param  x      a frame
+ * @return size_t number of values following FRAME_HEADER**/
+size_t get_frame_count(lisp_cell_t *x);
+
+/**@brief Get the symbol a REF was resolved from
+ * @param  x     a REF
+ * @return cell* the symbol it refers to**/
+lisp_cell_t *get_ref_sym(lisp_cell_t *x);
+
+/**@brief Get the number of frames a REF skips before its variable
+ * @param  x      a REF
+ * @return size_t depth of the frame the variable is in**/
+size_t get_ref_depth(lisp_cell_t *x);
+
+/**@brief Get the slot of the frame a REF refers to
+ * @param  x      a REF
+ * @return size_t slot in the frame, or REF_FREE**/
+size_t get_ref_slot(lisp_cell_t *x);
+
+/**@brief Make a REF
+ * @param  l      the lisp environment to allocate in
+ * @param  sym    symbol the variable was resolved from
+ * @param  depth  number of frames to skip before its variable
+ * @param  slot   slot of that frame, or REF_FREE
+ * @return cell*  a new REF**/
+lisp_cell_t *mk_ref(lisp_t *l, lisp_cell_t *sym, size_t depth, size_t slot);
+
+/**@brief cons for resolved code, which is marked so it can be told apart
+ * from code as it was written
+ * @param  l      the lisp environment to allocate in
+ * @param  x      car
+ * @param  y      cdr
+ * @return cell*  a new cons, marked as resolved**/
+lisp_cell_t *rcons(lisp_t *l, lisp_cell_t *x, lisp_cell_t *y);
+
+/**@brief Make a frame extending an environment, all of its values are nil
+ * @param  l      the lisp environment to allocate in
+ * @param  parent environment the frame extends
+ * @param  names  list the names of the variables are taken from
+ * @param  slots  number of values the frame has room for
+ * @param  count  number of those in use, no more than slots
+ * @return cell*  a new frame**/
+lisp_cell_t *mk_frame(lisp_t *l, lisp_cell_t *parent, lisp_cell_t *names, size_t slots, size_t count);
+
+/**@brief Find where a variable is kept by looking its name up
+ * @param  sym    name of the variable
+ * @param  env    environment to look in
+ * @param  field  set to the field of the cell returned the value is in
+ * @return cell*  frame or (symbol . value) pair holding it, NULL if unbound**/
+lisp_cell_t *env_find(lisp_cell_t *sym, lisp_cell_t *env, size_t *field);
+
+/**@brief Find where the variable a REF refers to is kept
+ * @param  ref    a REF
+ * @param  env    environment to look in
+ * @param  field  set to the field of the cell returned the value is in
+ * @return cell*  see env_find**/
+lisp_cell_t *ref_find(lisp_cell_t *ref, lisp_cell_t *env, size_t *field);
+
+/**@brief Bind the arguments of a procedure or F-expression
+ * @param  l      the lisp environment
+ * @param  proc   procedure being applied
+ * @param  vals   list of values of its arguments
+ * @return cell*  environment its body is run in**/
+lisp_cell_t *function_args(lisp_t *l, lisp_cell_t *proc, lisp_cell_t *vals);
+
+/**@brief Get the number of arguments a procedure or F-expression cannot do
+ *	without, counted when it was made
+ * @param  x      a procedure or F-expression
+ * @return size_t number of symbols in its argument list**/
+size_t get_proc_fixed(lisp_cell_t *x);
+
+/**@brief Get the number of variables a procedure or F-expression binds its
+ *	arguments to, which is one more than get_proc_fixed if it takes the
+ *	rest of its arguments as a list
+ * @param  x      a procedure or F-expression
+ * @return size_t the number of variables in a frame made to apply it**/
+size_t get_proc_count(lisp_cell_t *x);
+
+/**@brief Get the number of times a procedure has been called, see vm_promote
+ * @param  x      a procedure
+ * @return size_t the number of calls**/
+size_t get_proc_calls(lisp_cell_t *x);
+
+/**@brief Get the subroutine a procedure has been compiled to by the native
+ *	compiler, see lisp_set_native_compiler
+ * @param  x      a procedure
+ * @return cell*  the subroutine, nil if it could not be compiled, or NULL
+ *	if that has not been tried**/
+lisp_cell_t *get_proc_native(lisp_cell_t *x);
+
+/**@brief Get the body of a procedure with its variables resolved
+ * @param  l      the lisp environment
+ * @param  proc   a procedure or F-expression
+ * @return cell*  a list of expressions, the body of the procedure**/
+lisp_cell_t *proc_body(lisp_t *l, lisp_cell_t *proc);
+
+/**@brief Resolve the body of a procedure again, for code it is to be
+ *	copied into, as what proc_body keeps is replaced by the CODE the
+ *	body is compiled to.
+ * @param  l      the lisp environment
+ * @param  proc   a procedure
+ * @return cell*  a new list of expressions, the body of the procedure**/
+lisp_cell_t *proc_resolve(lisp_t *l, lisp_cell_t *proc);
+
+/**@brief CODE cells hold the byte code a procedure body is compiled to
+ *	(in memory they own) in their first field and a list of every cell
+ *	the code refers to in the second, so the collector can find them.*/
+#define CODE_FIELDS (2)
+
+/**@brief This must be used whenever a top level variable is bound to
+ *	something else, optimized code may have primitives and procedures
+ *	the variable was bound to built into it, counting the times one of
+ *	those is replaced lets vm_compile know when to optimize it again.
+ * @param L      the lisp environment
+ * @param OLD    what the variable was bound to**/
+#define LISP_REBIND(L, OLD)\
+	do {\
+		if (is_proc((OLD)) || is_subr((OLD))) (L)->rebound++;\
+	} while(0)
+
+/**@brief Compile the body of a procedure if that has not been done yet,
+ *	which happens when it is first applied, optimized code, or code that
+ *	copies variables into closures, that is out of date (see LISP_REBIND)
+ *	is compiled again.
+ * @param  l      the lisp environment
+ * @param  proc   a procedure
+ * @return cell*  the CODE the body is compiled to**/
+lisp_cell_t *vm_compile(lisp_t *l, lisp_cell_t *proc);
+
+/**@brief Compile the body of a procedure with the optimizations done for
+ *	"compile": calls to primitives on constants are worked out, branches
+ *	that cannot be taken are left out, small procedures are copied in
+ *	place of calls to them and unbound variables are noted. What the top
+ *	level variables used are bound to when this is done is assumed not
+ *	to change, until LISP_REBIND says otherwise.
+ * @param  l      the lisp environment
+ * @param  proc   a procedure
+ * @return cell*  the CODE the body is compiled to**/
+lisp_cell_t *vm_optimize(lisp_t *l, lisp_cell_t *proc);
+
+/**@brief How a procedure is run, it goes up through these as it is
+ *	called more often, see lisp_set_tiers*/
+typedef enum {
+	TIER_INTERPRETED, /**< not compiled yet*/
+	TIER_COMPILED,    /**< compiled to byte code, see vm_compile*/
+	TIER_OPTIMIZED,   /**< compiled with the optimizations of vm_optimize*/
+	TIER_NATIVE       /**< compiled to machine code by the native compiler*/
+} proc_tier_t;
+
+/**@brief Get the tier a procedure is in
+ * @param  proc   a procedure
+ * @return proc_tier_t how the procedure is run**/
+proc_tier_t vm_tier(lisp_cell_t *proc);
+
+/**@brief Apply a procedure to a list of values, running its compiled body
+ *	on the virtual machine.
+ * @param  l      the lisp environment
+ * @param  depth  current evaluation depth, not to exceed a limit
+ * @param  proc   a procedure
+ * @param  vals   list of values of its arguments
+ * @return cell*  the result**/
+lisp_cell_t *vm_apply(lisp_t *l, unsigned depth, lisp_cell_t *proc, lisp_cell_t *vals);
+
+/**@brief Run the compiled body of a procedure whose arguments have
+ *	already been bound, as vm_apply does once it has bound them.
+ * @param  l      the lisp environment
+ * @param  depth  current evaluation depth, not to exceed a limit
+ * @param  proc   a procedure
+ * @param  env    the environment made by binding its arguments
+ * @return cell*  the result**/
+lisp_cell_t *vm_enter(lisp_t *l, unsigned depth, lisp_cell_t *proc, lisp_cell_t *env);
+
+/**@brief Most arguments a primitive can be passed directly, see
+ *	lisp_add_subr_direct*/
+#define SUBR_DIRECT_MAX (3)
+
+/**@brief Make a primitive that takes its arguments directly, see
+ *	lisp_add_subr_direct, mk_subr makes one with "direct" as NULL.
+ *	A primitive holds the function taking a list, its format string,
+ *	documentation, number of arguments, the direct function and
+ *	then its compiled format string.**/
+lisp_cell_t *mk_subr_direct(lisp_t *l, lisp_subr_direct direct, lisp_subr_func p, const char *fmt, const char *doc);
+
+/**@brief Get the function of a primitive that takes its arguments
+ *	directly, which is NULL if it only takes a list.**/
+lisp_subr_direct get_subr_direct(lisp_cell_t *x);
+
+/**@brief Get the validation format of a primitive as compiled by
+ *	lisp_validate_compile, NULL if it has no format or no arguments**/
+const uint32_t *get_subr_validation(lisp_cell_t *x);
+
+/**@brief Call a primitive with arguments taken from an array. Those that
+ *	take as many arguments directly are passed them as they are, a list
+ *	is made only for the others.
+ * @param  l      the lisp environment
+ * @param  subr   a primitive
+ * @param  argv   its arguments, which must be kept from the collector
+ * @param  n      the number of them
+ * @return cell*  the result**/
+lisp_cell_t *subr_call(lisp_t *l, lisp_cell_t *subr, lisp_cell_t **argv, size_t n);
+
+/**@brief Can a call to a primitive be worked out before it is run, which
+ *	is so for the arithmetic and comparison primitives given numbers
+ *	they cannot fail on.
+ * @param  subr   a primitive
+ * @param  argv   its arguments
+ * @param  n      the number of them
+ * @return int    non zero if subr_call can be used when compiling**/
+int subr_foldable(lisp_cell_t *subr, lisp_cell_t **argv, size_t n);
+
+/**@brief Get the number of bins hash_bin can be asked for, this is used
+ *	instead of walking the table directly.
+ * @param  h      hash table to query
+ * @return size_t number of bins**/
+size_t hash_bin_count(const hash_table_t *h);
+
+/**@brief Get the entry in a bin of a hash table, a table should only be
+ *	walked with this and hash_bin_count.
+ * @param  h      hash table to look in
+ * @param  i      bin, less than hash_bin_count(h)
+ * @return hash_entry_t* the entry in the bin, or NULL if it is empty**/
+hash_entry_t *hash_bin(const hash_table_t *h, size_t i);
+
 /**@brief Read in a lisp expression
  * @param l      a lisp environment
  * @param i      the input port
@@ -269,6 +755,41 @@ lisp_cell_t *lisp_extend_top(lisp_t *l, lisp_cell_t *sym, lisp_cell_t *val);
  * @return argument count**/
 size_t lisp_validate_arg_count(const char *fmt);
 
+/**@brief  Compile a validation format string into an array with a mask
+ *         of the types each argument may have, so the string is not
+ *         parsed again each time a primitive is called.
+ * @param  l   an initialized lisp environment
+ * @param  fmt validation format string
+ * @param  len the number of arguments it has, see lisp_validate_arg_count
+ * @return uint32_t* an array of "len" masks, or NULL if "len" is zero, it
+ *         is freed along with the primitive it is compiled for**/
+uint32_t *lisp_validate_compile(lisp_t *l, const char *fmt, size_t len);
+
+/**@brief  Validate the arguments of a primitive, as lisp_validate_cell does,
+ *         when they are in an array instead of a list.
+ * @param  l       an initialized lisp environment
+ * @param  subr    a primitive
+ * @param  argv    its arguments
+ * @param  n       the number of them
+ * @param  recover throw an error if they are not valid
+ * @return int non zero if they are valid**/
+int lisp_validate_argv(lisp_t *l, lisp_cell_t *subr, lisp_cell_t **argv, size_t n, int recover);
+
+/**@brief  Check the arguments of a function as lisp_validate_cell does,
+ *         without reporting anything if they are not valid.
+ * @param  x    a function
+ * @param  args its arguments as a list
+ * @return int non zero if they are valid**/
+int lisp_check_cell(lisp_cell_t *x, lisp_cell_t *args);
+
+/**@brief  Check the arguments of a primitive as lisp_validate_argv does,
+ *         without reporting anything if they are not valid.
+ * @param  subr a primitive
+ * @param  argv its arguments
+ * @param  n    the number of them
+ * @return int non zero if they are valid**/
+int lisp_check_argv(lisp_cell_t *subr, lisp_cell_t **argv, size_t n);
+
 /**@brief  Coerce an object from one type to another type, if possible
  * @param  l    an initialized lisp environment
  * @param  type the type to convert to
@@ -221,8 +221,7 @@ static lisp_cell_t *new_sym(lisp_t *l, const char *token, size_t end) { /**@bug
 	char *tnew = lisp_calloc(l, end+1);
 	memcpy(tnew, token, end);
 	ret = lisp_intern(l, tnew);
-	if(get_sym(ret) != tnew)
-		free(tnew);
+	free(tnew);
 	return ret;
 }
 
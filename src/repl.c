@@ -112,6 +112,7 @@ int lisp_repl(lisp_t * l, char *prompt, int editor_on) {
 	io_t *ofp, *efp;
 	char *line = NULL;
 	int r = 0;
+	size_t gc_stack_save = l->gc_stack_used, vm_stack_save = l->vm_stack_used;
 	ofp = lisp_get_output(l);
 	efp = lisp_get_logging(l);
 	ofp->pretty = efp->pretty = 1;
@@ -120,6 +121,8 @@ int lisp_repl(lisp_t * l, char *prompt, int editor_on) {
 		l->recover_init = 0;
 		return r;
 	}
+	l->gc_stack_used = gc_stack_save; /*anything left there is garbage*/
+	l->vm_stack_used = vm_stack_save;
 	l->recover_init = 1;
 	if (editor_on && l->editor) {	/*handle line editing functionality */
 		while ((line = l->editor(prompt))) {
@@ -150,9 +153,11 @@ int lisp_repl(lisp_t * l, char *prompt, int editor_on) {
 				break;
 			lisp_printf(l, ofp, 0, "%S\n", ret);
 			l->gc_stack_used = 0;
+			l->vm_stack_used = 0;
 		}
 	}
 	l->gc_stack_used = 0;
+	l->vm_stack_used = 0;
 	l->recover_init = 0;
 	return r;
 }
@@ -165,7 +170,7 @@ int main_lisp_env(lisp_t * l, int argc, char **argv) {
 	for (i = argc - 1; i + 1; i--)	/*add command line args to list */
 		if (!(ob = cons(l, mk_str(l, lstrdup_or_abort(argv[i])), ob)))
 			return -1;
-	if (!lisp_extend_top(l, lisp_intern(l, lstrdup_or_abort("args")), ob))
+	if (!lisp_extend_top(l, lisp_intern(l, "args"), ob))
 		return -1;
 
         lisp_add_cell(l, "*version*",           mk_str(l, lstrdup_or_abort(XSTRINGIFY(VERSION))));
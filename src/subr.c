@@ -31,18 +31,14 @@
 	X("apply",       subr_apply,     NULL,   "apply a function to an argument list")\
 	X("assoc",       subr_assoc,     "A c",  "lookup a variable in an 'a-list'")\
 	X("base",        subr_base,      "d d",  "convert a integer into a string in a base")\
-	X("car",         subr_car,       "L",    "return the first object in a list")\
-	X("cdr",         subr_cdr,       "L",    "return every object apart from the first in a list")\
 	X("is-closed",   subr_is_closed, NULL,   "is a object closed?")\
 	X("close",       subr_close,     "P",    "close a port, invalidating it")\
 	X("coerce",      subr_coerce,    NULL,   "coerce a variable from one type to another")\
-	X("cons",        subr_cons,      "A A",  "allocate a new cons cell with two arguments")\
 	X("copy",        subr_copy,      "A",    "perform a recursive copy of an expression, if possible")\
 	X("define-eval", subr_define_eval, "s A", "extend the top level environment with a computed symbol")\
 	X("depth",       subr_depth,     "",      "get the current evaluation depth")\
 	X("environment", subr_environment, "",    "get the current environment")\
 	X("is-eof",      subr_eofp,      "P",    "is the EOF flag set on a port?")\
-	X("eq",          subr_eq,        "A A",  "equality operation")\
 	X("eval",        subr_eval,      NULL,   "evaluate an expression")\
 	X("ferror",      subr_ferror,    "P",    "is the error flag set on a port")\
 	X("flush",       subr_flush,     NULL,   "flush a port")\
@@ -54,53 +50,86 @@
 	X("get-io-str",  subr_get_io_str,"P",    "get a copy of a string from an IO string port")\
 	X("hash-create", subr_hash_create,   NULL,   "create a new hash")\
 	X("hash-info",   subr_hash_info,     "h",    "get information about a hash")\
-	X("hash-insert", subr_hash_insert,   "h Z A", "insert a variable into a hash")\
-	X("hash-lookup", subr_hash_lookup,   "h Z",  "loop up a variable in a hash")\
 	X("is-input",    subr_inp,       "A",    "is an object an input port?")\
-	X("length",      subr_length,    "A",    "return the length of a list or string")\
 	X("match",       subr_match,     "Z Z",  "perform a primitive match on a string")\
 	X("open",        subr_open,      "d Z",  "open a port (either a file or a string) for reading *or* writing")\
 	X("is-output",   subr_outp,      "A",    "is an object an output port?")\
 	X("print",       subr_print,     "o A",  "print out an s-expression")\
+	X("procedure-tier", subr_procedure_tier, "p", "get how often a procedure has been called and how it is run")\
 	X("put-char",    subr_putchar,   "o d",  "write a character to a output port")\
 	X("put",         subr_puts,      "o Z",  "write a string to a output port")\
 	X("raw",         subr_raw,       "A",    "get the raw value of an object")\
 	X("read",        subr_read,      "I",    "read in an s-expression from a port or a string")\
+	X("recursion-limits", subr_recursion_limits, NULL, "get the recursion depth allowed for eval and the cells the virtual machine stack can grow to, or set them (nil for no limit on the stack)")\
 	X("remove",      subr_remove,    "Z",    "remove a file")\
 	X("rename",      subr_rename,    "Z Z",  "rename a file")\
 	X("reverse",     subr_reverse,   NULL,   "reverse a string, list or hash")\
-	X("scar",        subr_scar,      "Z",    "return the first character in a string")\
-	X("scdr",        subr_scdr,      "Z",    "return a string excluding the first character")\
-	X("scons",       subr_scons,     "Z Z",  "concatenate two string")\
 	X("seek",        subr_seek,      "P d d", "perform a seek on a port (moving the port position indicator)")\
-	X("set-car",     subr_setcar,    "c A",  "destructively set the first cell of a cons cell")\
-	X("set-cdr",     subr_setcdr,    "c A",  "destructively set the second cell of a cons cell")\
 	X("signal",      subr_signal,     "d",    "raise a signal")\
-	X("&",           subr_band,      "d d",  "bit-wise and of two integers")\
-	X("~",           subr_binv,      "d",    "bit-wise inversion of an integers")\
-	X("|",           subr_bor,       "d d",  "bit-wise or of two integers")\
-	X("^",           subr_bxor,      "d d",  "bit-wise xor of two integers")\
-	X("<<",          subr_lshift,    "d d",  "logical left shift an integer")\
-	X(">>",          subr_rshift,    "d d",  "logical right shift an integer")\
-	X("/",           subr_div,       "a a",  "divide operation")\
-	X("=",           subr_eq,        "A A",  "equality operation")\
-	X(">",           subr_greater,   NULL,   "greater operation")\
-	X("<",           subr_less,      NULL,   "less than operation")\
-	X("%",           subr_mod,       "d d",  "modulo operation")\
-	X("*",           subr_prod,      "a a",  "multiply two numbers")\
-	X("-",           subr_sub,       "a a",  "subtract two numbers")\
-	X("+",           subr_sum,       "a a",  "add two numbers")\
 	X("substring",   subr_substring, NULL,   "create a substring from a string")\
 	X("tell",        subr_tell,      "P",    "return the position indicator of a port")\
+	X("tiers",       subr_tiers,     "d d",  "set the call counts at which procedures are optimized and compiled natively, zero disables, code is optimized again if a procedure it uses is redefined")\
 	X("top-environment", subr_top_env, "",   "return the top level environment")\
 	X("trace",       subr_trace,     "d",    "set the log level, from no errors printed, to copious debugging information")\
-	X("tr",          subr_tr,        "Z Z Z Z", "translate a string given a format and mode")\
-	X("type-of",     subr_typeof,    "A",    "return an integer representing the type of an object")
+	X("tr",          subr_tr,        "Z Z Z Z", "translate a string given a format and mode")
+
+/* X-Macro of primitives that take their arguments directly instead of in a
+ * list, so calling them makes no garbage, the format is as above with the
+ * number of arguments, which the validation string has to agree with, after
+ * the subroutine. Each also gets a version taking a list, see SUBR_SHIM */
+#define DIRECT_SUBROUTINE_XLIST\
+	X("car",         subr_car,         1, "L",     "return the first object in a list")\
+	X("cdr",         subr_cdr,         1, "L",     "return every object apart from the first in a list")\
+	X("cons",        subr_cons,        2, "A A",   "allocate a new cons cell with two arguments")\
+	X("eq",          subr_eq,          2, "A A",   "equality operation")\
+	X("hash-insert", subr_hash_insert, 3, "h Z A", "insert a variable into a hash")\
+	X("hash-lookup", subr_hash_lookup, 2, "h Z",   "loop up a variable in a hash")\
+	X("length",      subr_length,      1, "A",     "return the length of a list or string")\
+	X("scar",        subr_scar,        1, "Z",     "return the first character in a string")\
+	X("scdr",        subr_scdr,        1, "Z",     "return a string excluding the first character")\
+	X("scons",       subr_scons,       2, "Z Z",   "concatenate two string")\
+	X("set-car",     subr_setcar,      2, "c A",   "destructively set the first cell of a cons cell")\
+	X("set-cdr",     subr_setcdr,      2, "c A",   "destructively set the second cell of a cons cell")\
+	X("&",           subr_band,        2, "d d",   "bit-wise and of two integers")\
+	X("~",           subr_binv,        1, "d",     "bit-wise inversion of an integers")\
+	X("|",           subr_bor,         2, "d d",   "bit-wise or of two integers")\
+	X("^",           subr_bxor,        2, "d d",   "bit-wise xor of two integers")\
+	X("<<",          subr_lshift,      2, "d d",   "logical left shift an integer")\
+	X(">>",          subr_rshift,      2, "d d",   "logical right shift an integer")\
+	X("/",           subr_div,         2, "a a",   "divide operation")\
+	X("=",           subr_eq,          2, "A A",   "equality operation")\
+	X(">",           subr_greater,     2, "A A",   "greater operation")\
+	X("<",           subr_less,        2, "A A",   "less than operation")\
+	X("%",           subr_mod,         2, "d d",   "modulo operation")\
+	X("*",           subr_prod,        2, "a a",   "multiply two numbers")\
+	X("-",           subr_sub,         2, "a a",   "subtract two numbers")\
+	X("+",           subr_sum,         2, "a a",   "add two numbers")\
+	X("type-of",     subr_typeof,      1, "A",     "return an integer representing the type of an object")
 
 #define X(NAME, SUBR, VALIDATION, DOCSTRING) static lisp_cell_t * SUBR (lisp_t *l, lisp_cell_t *args);
 SUBROUTINE_XLIST /*function prototypes for all of the built-in subroutines*/
 #undef X
 
+#define SUBR_PARAMS1 lisp_cell_t *
+#define SUBR_PARAMS2 lisp_cell_t *, lisp_cell_t *
+#define SUBR_PARAMS3 lisp_cell_t *, lisp_cell_t *, lisp_cell_t *
+#define X(NAME, SUBR, ARITY, VALIDATION, DOCSTRING)\
+	static lisp_cell_t * SUBR (lisp_t *l, SUBR_PARAMS ## ARITY);\
+	static lisp_cell_t * SUBR ## _list (lisp_t *l, lisp_cell_t *args);
+DIRECT_SUBROUTINE_XLIST /*prototypes for both versions of the direct subroutines*/
+#undef X
+
+/**@brief define the version of a direct subroutine that takes its arguments
+ * as a list, which is what modules and apply see, the list has been
+ * validated already so it has the right length*/
+#define SUBR_SHIM(SUBR, ARITY)\
+	static lisp_cell_t * SUBR ## _list (lisp_t *l, lisp_cell_t *args) {\
+		return SUBR (l, SUBR_ARGS ## ARITY (args));\
+	}
+#define SUBR_ARGS1(A) car(A)
+#define SUBR_ARGS2(A) car(A), CADR(A)
+#define SUBR_ARGS3(A) car(A), CADR(A), CADR(cdr(A))
+
 #define X(NAME, SUBR, VALIDATION, DOCSTRING) { NAME, VALIDATION, MK_DOCSTR(NAME, DOCSTRING), SUBR },
 static const lisp_module_subroutines_t primitives[] = {
         SUBROUTINE_XLIST /*all of the subr functions*/
@@ -108,6 +137,19 @@ static const lisp_module_subroutines_t primitives[] = {
 };
 #undef X
 
+#define X(NAME, SUBR, ARITY, VALIDATION, DOCSTRING)\
+	{ NAME, VALIDATION, MK_DOCSTR(NAME, DOCSTRING), (lisp_subr_direct) SUBR, SUBR ## _list },
+/**@brief the subroutines that take their arguments directly*/
+static const struct direct_subroutines {
+	const char *name, *validate, *docstring;
+	lisp_subr_direct p;
+	lisp_subr_func shim;
+} direct_primitives[] = {
+        DIRECT_SUBROUTINE_XLIST
+        {NULL, NULL, NULL, NULL, NULL}
+};
+#undef X
+
 /**< X-Macros of all built in integers*/
 #define INTEGER_XLIST\
 	X("*seek-cur*",     SEEK_CUR)     X("*seek-set*",    SEEK_SET)\
@@ -122,7 +164,7 @@ static const lisp_module_subroutines_t primitives[] = {
 	X("*eof*",          EOF)          X("*sig-abrt*",     SIGABRT)\
 	X("*sig-fpe*",      SIGFPE)       X("*sig-ill*",      SIGILL)\
 	X("*sig-int*",      SIGINT)       X("*sig-segv*",     SIGSEGV)\
-	X("*sig-term*",     SIGTERM)
+	X("*sig-term*",     SIGTERM)      X("*macro*",        MACRO)
 
 #define X(NAME, VAL) { NAME, VAL },
 /**@brief A list of all integer values to be made available to the
@@ -133,15 +175,19 @@ static const struct integer_list { char *name; intptr_t val; } integers[] = {
 };
 #undef X
 
-#define X(CNAME, LNAME) static lisp_cell_t _ ## CNAME = { SYMBOL, 0, 1, 0, 0, .p[0].v = LNAME};
+/*special cells are symbols, so they have room for a length and a hash,
+ *which are filled in when they are added to the symbol table, and for a
+ *top level binding, which is never set as they are shared by interpreters*/
+#define X(CNAME, LNAME) static struct { lisp_cell_t c; cell_data_t len, hash, global; } _ ## CNAME =\
+	{ { SYMBOL, 0, 1, 0, 0, .p[0].v = LNAME}, { NULL }, { NULL }, { NULL } };
 CELL_XLIST /*structs for special cells*/
 #undef X
 
-#define X(CNAME, NOT_USED) static lisp_cell_t * CNAME = & _ ## CNAME;
+#define X(CNAME, NOT_USED) static lisp_cell_t * CNAME = & _ ## CNAME .c;
 CELL_XLIST /*pointers to structs for special cells*/
 #undef X
 
-#define X(CNAME, NOT_USED) { & _ ## CNAME },
+#define X(CNAME, NOT_USED) { & _ ## CNAME .c },
 /**@brief a list of all the special symbols**/
 static const struct special_cell_list { lisp_cell_t *internal; } special_cells[] = {
         CELL_XLIST
@@ -155,8 +201,11 @@ CELL_XLIST /**< defines functions to get a lisp "cell" for the built in special
 
 static lisp_cell_t *forced_add_symbol(lisp_t *l, lisp_cell_t *ob) {
 	assert(l && ob);
+	const size_t len = strlen(get_sym(ob));
+	ob->p[1].v = (void *)len;
+	ob->p[2].v = (void *)(uintptr_t)hash_string(get_sym(ob), len);
         assert(hash_lookup(get_hash(l->all_symbols), get_sym(ob)) == NULL);
-        if(hash_insert(get_hash(l->all_symbols), get_sym(ob), ob) < 0)
+        if(hash_insert_hashed(get_hash(l->all_symbols), get_sym(ob), get_sym_hash(ob), ob) < 0)
 		return NULL;
         return l->tee;
 }
@@ -173,6 +222,14 @@ lisp_t *lisp_init(void) {
 	lisp_set_log_level(l, LISP_LOG_LEVEL_ERROR);
 
         l->gc_off = 1;
+        l->gc_mode = USE_CELL_HEAP ? LISP_GC_GENERATIONAL : LISP_GC_FULL;
+        l->gc_next = USE_CELL_HEAP ? GC_NURSERY_SIZE : SIZE_MAX;
+        l->gc_budget = GC_SLICE_BUDGET;
+        l->gc_threshold = l->gc_heap_min = GC_HEAP_MIN;
+        l->gc_heap_max = GC_HEAP_MAX;
+        l->gc_growth = GC_GROWTH;
+        l->max_depth = MAX_RECURSION_DEPTH;
+        l->max_vm_stack = MAX_VM_STACK;
         if(!(l->buf = calloc(DEFAULT_LEN, 1))) goto fail;
         l->buf_allocated = DEFAULT_LEN;
         if(!(l->gc_stack = calloc(DEFAULT_LEN, sizeof(*l->gc_stack))))
@@ -181,6 +238,9 @@ lisp_t *lisp_init(void) {
 
 #define X(CNAME, LNAME) l-> CNAME = CNAME;
 CELL_XLIST
+#undef X
+#define X(CNAME) CNAME->form = FORM_ ## CNAME;
+FORM_XLIST
 #undef X
         assert(MAX_RECURSION_DEPTH < INT_MAX);
 
@@ -192,6 +252,7 @@ CELL_XLIST
                 goto fail;
         if(!(l->top_hash = mk_hash(l, hash_create(DEFAULT_LEN))))
                 goto fail;
+        get_hash(l->top_hash)->top = 1;
          set_cdr(l->top_env, cons(l, l->top_hash, cdr(l->top_env)));
 
         /* Special care has to be taken with the input and output objects
@@ -228,6 +289,13 @@ CELL_XLIST
                                         mk_int(l, integers[i].val)))
                         goto fail;
 	lisp_add_module_subroutines(l, primitives, 0);
+        for(i = 0; direct_primitives[i].name; i++)
+                if(!lisp_add_subr_direct(l, direct_primitives[i].name,
+                                        direct_primitives[i].p,
+                                        direct_primitives[i].shim,
+                                        direct_primitives[i].validate,
+                                        direct_primitives[i].docstring))
+                        goto fail;
         l->gc_off = 0;
         return l;
 fail:   l->gc_off = 0;
@@ -235,29 +303,39 @@ fail:   l->gc_off = 0;
         return NULL;
 }
 
-static lisp_cell_t *subr_band(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, (uintptr_t)get_int(car(args)) & (uintptr_t)get_int(CADR(args)));
+static lisp_cell_t *subr_band(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
+	return mk_int(l, (uintptr_t)get_int(x) & (uintptr_t)get_int(y));
 }
+SUBR_SHIM(subr_band, 2)
 
-static lisp_cell_t *subr_bor(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, (uintptr_t)get_int(car(args)) | (uintptr_t)get_int(CADR(args)));
+static lisp_cell_t *subr_bor(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
+	return mk_int(l, (uintptr_t)get_int(x) | (uintptr_t)get_int(y));
 }
+SUBR_SHIM(subr_bor, 2)
 
-static lisp_cell_t *subr_bxor(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, (uintptr_t)get_int(car(args)) ^ (uintptr_t)get_int(CADR(args)));
+static lisp_cell_t *subr_bxor(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
+	return mk_int(l, (uintptr_t)get_int(x) ^ (uintptr_t)get_int(y));
 }
+SUBR_SHIM(subr_bxor, 2)
 
-static lisp_cell_t *subr_lshift(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, (uintptr_t)get_int(car(args)) << (uintptr_t)get_int(CADR(args)));
+/**@brief only the low bits of a shift count are used, as most machines do,
+ * so no count is undefined behaviour*/
+#define SHIFT_MASK (sizeof(uintptr_t) * CHAR_BIT - 1)
+
+static lisp_cell_t *subr_lshift(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
+	return mk_int(l, (uintptr_t)get_int(x) << ((uintptr_t)get_int(y) & SHIFT_MASK));
 }
+SUBR_SHIM(subr_lshift, 2)
 
-static lisp_cell_t *subr_rshift(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, (uintptr_t)get_int(car(args)) >> (uintptr_t)get_int(CADR(args)));
+static lisp_cell_t *subr_rshift(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
+	return mk_int(l, (uintptr_t)get_int(x) >> ((uintptr_t)get_int(y) & SHIFT_MASK));
 }
+SUBR_SHIM(subr_rshift, 2)
 
-static lisp_cell_t *subr_binv(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, ~get_int(car(args)));
+static lisp_cell_t *subr_binv(lisp_t * l, lisp_cell_t * x) {
+	return mk_int(l, ~get_int(x));
 }
+SUBR_SHIM(subr_binv, 1)
 
 /** For numerical operations
  * @todo Floating point numbers should infect the operation:
@@ -265,59 +343,56 @@ static lisp_cell_t *subr_binv(lisp_t * l, lisp_cell_t * args) {
  * @todo Add in overloads for user defined types
  * @todo Take an arbitrary number of arguments */
 
-static lisp_cell_t *subr_sum(lisp_t * l, lisp_cell_t * args) {
-	lisp_cell_t *x = car(args), *y = CADR(args);
+static lisp_cell_t *subr_sum(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
 	if (is_int(x))
 		return mk_int(l, get_int(x) + get_a2i(y));
 	return mk_float(l, get_float(x) + get_a2f(y));
 }
+SUBR_SHIM(subr_sum, 2)
 
-static lisp_cell_t *subr_sub(lisp_t * l, lisp_cell_t * args) {
-	lisp_cell_t *x = car(args), *y = CADR(args);
+static lisp_cell_t *subr_sub(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
 	if (is_int(x))
 		return mk_int(l, get_int(x) - get_a2i(y));
 	return mk_float(l, get_float(x) - get_a2f(y));
 }
+SUBR_SHIM(subr_sub, 2)
 
-static lisp_cell_t *subr_prod(lisp_t * l, lisp_cell_t * args) {
-	lisp_cell_t *x = car(args), *y = CADR(args);
+static lisp_cell_t *subr_prod(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
 	if (is_int(x))
 		return mk_int(l, get_int(x) * get_a2i(y));
 	return mk_float(l, get_float(x) * get_a2f(y));
 }
+SUBR_SHIM(subr_prod, 2)
 
-static lisp_cell_t *subr_mod(lisp_t * l, lisp_cell_t * args) {
+static lisp_cell_t *subr_mod(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
 	intptr_t dividend, divisor;
-	dividend = get_int(car(args));
-	divisor = get_int(CADR(args));
+	dividend = get_int(x);
+	divisor = get_int(y);
 	if (!divisor || (dividend == INTPTR_MIN && divisor == -1))
-		LISP_RECOVER(l, "\"invalid divisor values\"\n '%S", args);
+		LISP_RECOVER(l, "\"invalid divisor values\"\n '%S", mk_list(l, x, y, NULL));
 	return mk_int(l, dividend % divisor);
 }
+SUBR_SHIM(subr_mod, 2)
 
-static lisp_cell_t *subr_div(lisp_t * l, lisp_cell_t * args) {
+static lisp_cell_t *subr_div(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
 	lisp_float_t dividend, divisor;
-	if (is_int(car(args))) {
+	if (is_int(x)) {
 		intptr_t dividend, divisor;
-		dividend = get_int(car(args));
-		divisor = get_a2i(CADR(args));
+		dividend = get_int(x);
+		divisor = get_a2i(y);
 		if (!divisor || (dividend == INTPTR_MIN && divisor == -1))
-			LISP_RECOVER(l, "\"invalid divisor values\"\n '%S", args);
+			LISP_RECOVER(l, "\"invalid divisor values\"\n '%S", mk_list(l, x, y, NULL));
 		return mk_int(l, dividend / divisor);
 	}
-	dividend = get_float(car(args));
-	divisor = get_a2f(CADR(args));
+	dividend = get_float(x);
+	divisor = get_a2f(y);
 	if (divisor == 0.)
-		LISP_RECOVER(l, "\"division by zero\"\n '%S", args);
+		LISP_RECOVER(l, "\"division by zero\"\n '%S", mk_list(l, x, y, NULL));
 	return mk_float(l, dividend / divisor);
 }
+SUBR_SHIM(subr_div, 2)
 
-static lisp_cell_t *subr_greater(lisp_t * l, lisp_cell_t * args) {
-	lisp_cell_t *x, *y;
-	if (!lisp_check_length(args, 2))
-		goto fail;
-	x = car(args);
-	y = CADR(args);
+static lisp_cell_t *subr_greater(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
 	if (is_arith(x) && is_arith(y)) {
 		return (is_floating(x) ? get_float(x) : get_int(x)) >
 		    (is_floating(y) ? get_float(y) : get_int(y)) ? l->tee : l->nil;
@@ -327,16 +402,12 @@ static lisp_cell_t *subr_greater(lisp_t * l, lisp_cell_t * args) {
 			return memcmp(get_str(x), get_str(y), lx) > 0 ? l->tee : l->nil;
 		return lx > ly ? l->tee : l->nil;
 	}
- fail:	LISP_RECOVER(l, "\"expected (number number) or (string string)\"\n '%S", args);
+	LISP_RECOVER(l, "\"expected (number number) or (string string)\"\n '%S", mk_list(l, x, y, NULL));
 	return l->error;
 }
+SUBR_SHIM(subr_greater, 2)
 
-static lisp_cell_t *subr_less(lisp_t * l, lisp_cell_t * args) {
-	lisp_cell_t *x, *y;
-	if (!lisp_check_length(args, 2))
-		goto fail;
-	x = car(args);
-	y = CADR(args);
+static lisp_cell_t *subr_less(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
 	if (is_arith(x) && is_arith(y)) {
 		return (is_floating(x) ? get_float(x) : get_int(x)) <
 		    (is_floating(y) ? get_float(y) : get_int(y)) ? l->tee : l->nil;
@@ -346,11 +417,12 @@ static lisp_cell_t *subr_less(lisp_t * l, lisp_cell_t * args) {
 			return memcmp(get_str(x), get_str(y), lx) < 0 ? l->tee : l->nil;
 		return lx < ly ? l->tee : l->nil;
 	}
- fail:	LISP_RECOVER(l, "\"expected (number number) or (string string)\"\n '%S", args);
+	LISP_RECOVER(l, "\"expected (number number) or (string string)\"\n '%S", mk_list(l, x, y, NULL));
 	return l->error;
 }
+SUBR_SHIM(subr_less, 2)
 
-static lisp_cell_t *subr_eq(lisp_t * l, lisp_cell_t * args) {
+static lisp_cell_t *subr_eq(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
 	/**@warning Most versions of equality treat the floating
 	 * point value NaN specially, NaN does not equal NaN,
 	 * disregarding the reflexive property that is usually
@@ -359,10 +431,9 @@ static lisp_cell_t *subr_eq(lisp_t * l, lisp_cell_t * args) {
 	 * meaning NaN == NaN, but only on some platforms! (the
 	 * size of a lisp float could be greater than or less
 	 * than a pointer. What should be done needs to be decided. */
-	lisp_cell_t *x, *y;
-	x = car(args);
-	y = CADR(args);
-	if (get_int(x) == get_int(y))
+	if (is_int(x) || is_int(y)) /*a small integer is not a pointer to compare*/
+		return is_int(x) && is_int(y) && get_int(x) == get_int(y) ? l->tee : l->nil;
+	if (x == y)
 		return l->tee;
 	if (is_floating(x) && is_floating(y))
 		return get_float(x) == get_float(y) ? l->tee : l->nil;
@@ -377,65 +448,109 @@ static lisp_cell_t *subr_eq(lisp_t * l, lisp_cell_t * args) {
 
 	return l->nil;
 }
+SUBR_SHIM(subr_eq, 2)
+
+/**@brief The primitives subr_foldable allows, which only look at the
+ * numbers they are given, "integer" is set for those that only take
+ * integers and "divide" for those that fail on a zero divisor*/
+static const struct {
+	lisp_subr_func func;
+	unsigned integer :1, divide :1;
+} foldable[] = {
+	{ subr_sum_list,  0, 0 }, { subr_sub_list,    0, 0 },
+	{ subr_prod_list, 0, 0 }, { subr_div_list,    0, 1 },
+	{ subr_mod_list,  1, 1 }, { subr_band_list,   1, 0 },
+	{ subr_bor_list,  1, 0 }, { subr_bxor_list,   1, 0 },
+	{ subr_binv_list, 1, 0 }, { subr_lshift_list, 1, 0 },
+	{ subr_rshift_list, 1, 0 }, { subr_eq_list,   0, 0 },
+	{ subr_less_list, 0, 0 }, { subr_greater_list, 0, 0 },
+};
+
+int subr_foldable(lisp_cell_t * subr, lisp_cell_t ** argv, size_t n) {
+	assert(subr && is_subr(subr) && argv);
+	for (size_t i = 0; i < sizeof(foldable) / sizeof(foldable[0]); i++) {
+		if (foldable[i].func != get_subr(subr))
+			continue;
+		if (n != get_length(subr))
+			return 0;
+		for (size_t j = 0; j < n; j++)
+			if (!is_arith(argv[j]) || (foldable[i].integer && !is_int(argv[j])))
+				return 0;
+		if (foldable[i].divide && (is_int(argv[0]) ? /*see subr_div and subr_mod*/
+				!get_a2i(argv[1]) || (get_int(argv[0]) == INTPTR_MIN && get_a2i(argv[1]) == -1) :
+				get_a2f(argv[1]) == 0.))
+			return 0;
+		return 1;
+	}
+	return 0;
+}
 
-static lisp_cell_t *subr_cons(lisp_t * l, lisp_cell_t * args) {
-	return cons(l, car(args), CADR(args));
+static lisp_cell_t *subr_cons(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
+	return cons(l, x, y);
 }
+SUBR_SHIM(subr_cons, 2)
 
 static lisp_cell_t *subr_copy(lisp_t * l, lisp_cell_t * args) {
 	return lisp_copy(l, car(args));
 }
 
-static lisp_cell_t *subr_car(lisp_t * l, lisp_cell_t * args) {
-	if(is_nil(car(args)))
+static lisp_cell_t *subr_car(lisp_t * l, lisp_cell_t * x) {
+	if(is_nil(x))
 		return l->nil;
-	return CAAR(args);
+	return car(x);
 }
+SUBR_SHIM(subr_car, 1)
 
-static lisp_cell_t *subr_cdr(lisp_t * l, lisp_cell_t * args) {
-	if(is_nil(car(args)))
+static lisp_cell_t *subr_cdr(lisp_t * l, lisp_cell_t * x) {
+	if(is_nil(x))
 		return l->nil;
-	return CDAR(args);
+	return cdr(x);
 }
+SUBR_SHIM(subr_cdr, 1)
 
-static lisp_cell_t *subr_setcar(lisp_t * l, lisp_cell_t * args) {
+static lisp_cell_t *subr_setcar(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
 	UNUSED(l);
-	set_car(car(args), CADR(args));
-	return car(args);
+	set_car(x, y);
+	return x;
 }
+SUBR_SHIM(subr_setcar, 2)
 
-static lisp_cell_t *subr_setcdr(lisp_t * l, lisp_cell_t * args) {
+static lisp_cell_t *subr_setcdr(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
 	UNUSED(l);
-	lisp_cell_t *c = car(args);
-	set_cdr(c, CADR(args));
-	return car(args);
+	set_cdr(x, y);
+	return x;
 }
+SUBR_SHIM(subr_setcdr, 2)
 
 static lisp_cell_t *subr_match(lisp_t * l, lisp_cell_t * args) {
 	return match(get_sym(car(args)), get_sym(CADR(args))) ? l->tee : l->nil;
 }
 
-static lisp_cell_t *subr_scons(lisp_t * l, lisp_cell_t * args) {
+static lisp_cell_t *subr_scons(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
 	char *ret;
-	ret = CONCATENATE(get_str(car(args)), get_str(CADR(args)));
+	ret = CONCATENATE(get_str(x), get_str(y));
 	return mk_str(l, ret);
 }
+SUBR_SHIM(subr_scons, 2)
 
-static lisp_cell_t *subr_scar(lisp_t * l, lisp_cell_t * args) {
+static lisp_cell_t *subr_scar(lisp_t * l, lisp_cell_t * x) {
 	char c[2] = { '\0', '\0' };
-	c[0] = get_str(car(args))[0];
+	c[0] = get_str(x)[0];
 	return mk_str(l, lisp_strdup(l, c));
 }
+SUBR_SHIM(subr_scar, 1)
 
-static lisp_cell_t *subr_scdr(lisp_t * l, lisp_cell_t * args) {
-	if (!(get_str(car(args))[0]))
+static lisp_cell_t *subr_scdr(lisp_t * l, lisp_cell_t * x) {
+	if (!(get_str(x)[0]))
 		mk_str(l, lisp_strdup(l, ""));
-	return mk_str(l, lisp_strdup(l, &get_str(car(args))[1]));;
+	return mk_str(l, lisp_strdup(l, &get_str(x)[1]));;
 }
+SUBR_SHIM(subr_scdr, 1)
 
 static lisp_cell_t *subr_eval(lisp_t * l, lisp_cell_t * args) {
 	lisp_cell_t *x = NULL;
 	int restore_used, r, errors_halt = l->errors_halt;
+	size_t vm_stack_save = l->vm_stack_used; /*activations an error abandons are left above this*/
 	jmp_buf restore;
 	l->errors_halt = 0;
 	if (l->recover_init) {
@@ -444,7 +559,7 @@ static lisp_cell_t *subr_eval(lisp_t * l, lisp_cell_t * args) {
 	}
 	l->recover_init = 1;
 	if ((r = setjmp(l->recover))) {
-		LISP_RECOVER_RESTORE(restore_used, l, restore);
+		LISP_RECOVER_RESTORE(restore_used, l, restore, vm_stack_save);
 		l->errors_halt = errors_halt;
 		return l->error;
 	}
@@ -452,12 +567,12 @@ static lisp_cell_t *subr_eval(lisp_t * l, lisp_cell_t * args) {
 	if (lisp_check_length(args, 1))
 		x = eval(l, l->cur_depth, car(args), l->top_env);
 	if (lisp_check_length(args, 2)) {
-		if (!is_cons(CADR(args)))
+		if (!is_cons(CADR(args)) && TYPE_OF(CADR(args)) != FRAME)
 			LISP_RECOVER(l, "\"expected a-list\"\n '%S", args);
 		x = eval(l, l->cur_depth, car(args), CADR(args));
 	}
 
-	LISP_RECOVER_RESTORE(restore_used, l, restore);
+	LISP_RECOVER_RESTORE(restore_used, l, restore, vm_stack_save);
 	if (!x)
 		LISP_RECOVER(l, "\"expected (expr) or (expr environment)\"\n '%S", args);
 	l->errors_halt = errors_halt;
@@ -479,9 +594,10 @@ static lisp_cell_t *subr_trace(lisp_t * l, lisp_cell_t * args) {
 	return l->tee;
 }
 
-static lisp_cell_t *subr_length(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, (intptr_t) get_length(car(args)));
+static lisp_cell_t *subr_length(lisp_t * l, lisp_cell_t * x) {
+	return mk_int(l, (intptr_t) get_length(x));
 }
+SUBR_SHIM(subr_length, 1)
 
 static lisp_cell_t *subr_inp(lisp_t * l, lisp_cell_t * args) {
 	return is_in(car(args)) ? l->tee : l->nil;
@@ -535,8 +651,9 @@ static lisp_cell_t *subr_getdelim(lisp_t * l, lisp_cell_t * args) {
 static lisp_cell_t *subr_read(lisp_t * l, lisp_cell_t * args) {
 	lisp_cell_t *x;
 	int restore_used, r, errors_halt = l->errors_halt;
+	size_t vm_stack_save = l->vm_stack_used;
 	jmp_buf restore;
-	char *s;
+	io_t *volatile sin = NULL; /*port made here to read a string from*/
 	l->errors_halt = 0;
 	if (l->recover_init) {	/*store exception state */
 		memcpy(restore, l->recover, sizeof(jmp_buf));
@@ -544,19 +661,17 @@ static lisp_cell_t *subr_read(lisp_t * l, lisp_cell_t * args) {
 	}
 	l->recover_init = 1;
 	if ((r = setjmp(l->recover))) {	/*handle exception in reader */
-		LISP_RECOVER_RESTORE(restore_used, l, restore);
+		io_close(sin);
+		LISP_RECOVER_RESTORE(restore_used, l, restore, vm_stack_save);
 		l->errors_halt = errors_halt;
 		return l->error;
 	}
-	s = NULL;
 	x = NULL;
-	io_t *i = NULL;
-	if (!(i = is_in(car(args)) ? get_io(car(args)) : io_sin(get_str(car(args)), get_length(car(args)))))
+	if (!is_in(car(args)) && !(sin = io_sin(get_str(car(args)), get_length(car(args)))))
 		lisp_out_of_memory(l);
-	x = (x = reader(l, i)) ? x : l->error;
-	if (s)
-		io_close(i);
-	LISP_RECOVER_RESTORE(restore_used, l, restore);
+	x = (x = reader(l, sin ? sin : get_io(car(args)))) ? x : l->error;
+	io_close(sin);
+	LISP_RECOVER_RESTORE(restore_used, l, restore, vm_stack_save);
 	l->errors_halt = errors_halt;
 	return x;
 }
@@ -614,17 +729,27 @@ static lisp_cell_t *subr_rename(lisp_t * l, lisp_cell_t * args) {
 	return rename(get_str(car(args)), get_str(CADR(args))) ? l->nil : l->tee;
 }
 
-static lisp_cell_t *subr_hash_lookup(lisp_t * l, lisp_cell_t * args) { /*arbitrary expressions could be used as keys if they are serialized to strings first*/
-	lisp_cell_t *x;
-	return (x = hash_lookup(get_hash(car(args)), get_sym(CADR(args)))) ? x : l->nil;
+static lisp_cell_t *subr_hash_lookup(lisp_t * l, lisp_cell_t * h, lisp_cell_t * key) { /*arbitrary expressions could be used as keys if they are serialized to strings first*/
+	lisp_cell_t *x = is_sym(key) ?
+		hash_lookup_hashed(get_hash(h), get_sym(key), get_sym_hash(key)) :
+		hash_lookup(get_hash(h), get_str(key));
+	return x ? x : l->nil;
 }
+SUBR_SHIM(subr_hash_lookup, 2)
 
-static lisp_cell_t *subr_hash_insert(lisp_t * l, lisp_cell_t * args) {
-	if (hash_insert(get_hash(car(args)),
-			get_sym(CADR(args)), cons(l, CADR(args), CADR(cdr(args)))))
+static lisp_cell_t *subr_hash_insert(lisp_t * l, lisp_cell_t * h, lisp_cell_t * key, lisp_cell_t * val) {
+	if (get_hash(h)->top) { /*keep the binding held in the symbol in step*/
+		lisp_extend_top(l, is_sym(key) ? key : lisp_intern(l, get_str(key)), val);
+		return h;
+	}
+	val = cons(l, key, val);
+	if ((is_sym(key) ?
+		hash_insert_hashed(get_hash(h), get_sym(key), get_sym_hash(key), val) :
+		hash_insert(get_hash(h), get_str(key), val)) < 0)
 		lisp_out_of_memory(l);
-	return car(args);
+	return h;
 }
+SUBR_SHIM(subr_hash_insert, 3)
 
 static lisp_cell_t *subr_hash_create(lisp_t * l, lisp_cell_t * args) {
 	hash_table_t *ht = NULL;
@@ -664,9 +789,9 @@ static lisp_cell_t *subr_coerce(lisp_t * l, lisp_cell_t * args) {
 lisp_cell_t *lisp_coerce(lisp_t * l, lisp_type type, lisp_cell_t *from) {
 	char *fltend = NULL;
 	intptr_t d = 0;
-	size_t i = 0, j;
+	size_t i = 0;
 	lisp_cell_t *x, *y, *head;
-	if (type == from->type)
+	if (type == TYPE_OF(from))
 		return from;
 	switch (type) {
 	case INTEGER:
@@ -700,15 +825,14 @@ lisp_cell_t *lisp_coerce(lisp_t * l, lisp_type type, lisp_cell_t *from) {
 			hash_entry_t *cur;
 			hash_table_t *h = get_hash(from);
 			head = x = cons(l, l->nil, l->nil);
-			for (j = 0, i = 0; i < h->len; i++)
-				if (h->table[i])
-					for (cur = h->table[i]; cur; cur = cur->next, j++) {
-						lisp_cell_t *tmp = (lisp_cell_t *) cur->val;
-						if (!is_cons(tmp))	/*handle special case for all_symbols hash */
-							tmp = cons(l, tmp, tmp);
-						set_cdr(x, cons(l, tmp, l->nil));
-						x = cdr(x);
-					}
+			for (i = 0; i < hash_bin_count(h); i++)
+				if ((cur = hash_bin(h, i))) {
+					lisp_cell_t *tmp = (lisp_cell_t *) cur->val;
+					if (!is_cons(tmp))	/*handle special case for all_symbols hash */
+						tmp = cons(l, tmp, tmp);
+					set_cdr(x, cons(l, tmp, l->nil));
+					x = cdr(x);
+				}
 			return cdr(head);
 		}
 		break;
@@ -744,7 +868,7 @@ lisp_cell_t *lisp_coerce(lisp_t * l, lisp_type type, lisp_cell_t *from) {
 	case SYMBOL:
 		if (is_str(from))
 			if (!strpbrk(get_str(from), " `,!;#()\t\n\r'\"\\"))
-				return lisp_intern(l, lisp_strdup(l, get_str(from)));
+				return lisp_intern(l, get_str(from));
 		break;
 	case HASH:
 		if (is_cons(from))	/*hash from list */
@@ -775,8 +899,23 @@ static lisp_cell_t *subr_assoc(lisp_t * l, lisp_cell_t * args) {
 	return lisp_assoc(car(args), CADR(args));
 }
 
-static lisp_cell_t *subr_typeof(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, car(args)->type);
+static lisp_cell_t *subr_typeof(lisp_t * l, lisp_cell_t * x) {
+	return mk_int(l, TYPE_OF(x));
+}
+SUBR_SHIM(subr_typeof, 1)
+
+const char *lisp_type_name(unsigned type) {
+	static const char *names[] = {
+		[SYMBOL] = "symbol",     [INTEGER] = "integer",
+		[CONS]   = "cons",       [PROC]    = "procedure",
+		[SUBR]   = "primitive",  [STRING]  = "string",
+		[IO]     = "io",         [HASH]    = "hash",
+		[FPROC]  = "f-procedure", [FLOAT]  = "float",
+		[USERDEF] = "user-defined", [FRAME]  = "frame",
+		[REF]    = "reference",  [CODE]    = "code",
+		[MACRO]  = "macro"
+	};
+	return type < sizeof(names)/sizeof(names[0]) ? names[type] : NULL;
 }
 
 static lisp_cell_t *subr_close(lisp_t * l, lisp_cell_t * args) {
@@ -792,7 +931,7 @@ static lisp_cell_t *subr_reverse(lisp_t * l, lisp_cell_t * args) {
 		goto fail;
 	if (l->nil == car(args))
 		return l->nil;
-	switch (car(args)->type) {
+	switch (TYPE_OF(car(args))) {
 	case STRING:
 		{
 			char *s = lisp_strdup(l, get_str(car(args)));
@@ -822,23 +961,22 @@ static lisp_cell_t *subr_reverse(lisp_t * l, lisp_cell_t * args) {
 			size_t i;
 			hash_table_t *new = hash_create(len);
 			hash_entry_t *cur;
-			for(i = 0; i < old->len; i++)
-				if(old->table[i])
-					for(cur = old->table[i]; cur; cur = cur->next) {
-						lisp_cell_t *key, *val;
-						/**@warning weird hash stuff*/
-						if(is_cons(cur->val) && is_asciiz(cdr(cur->val))) {
-							key = cdr(cur->val);
-							val = car(cur->val);
-						} else if(!is_cons(cur->val) && is_asciiz(cur->val)) {
-							key = cur->val;
-							val = mk_str(l, lisp_strdup(l, cur->key));
-						} else {
-							goto hfail;
-						}
-						if(hash_insert(new, get_str(key), cons(l, key, val)) < 0)
-							lisp_out_of_memory(l);
+			for(i = 0; i < hash_bin_count(old); i++)
+				if((cur = hash_bin(old, i))) {
+					lisp_cell_t *key, *val;
+					/**@warning weird hash stuff*/
+					if(is_cons(cur->val) && is_asciiz(cdr(cur->val))) {
+						key = cdr(cur->val);
+						val = car(cur->val);
+					} else if(!is_cons(cur->val) && is_asciiz(cur->val)) {
+						key = cur->val;
+						val = mk_str(l, lisp_strdup(l, cur->key));
+					} else {
+						goto hfail;
 					}
+					if(hash_insert(new, get_str(key), cons(l, key, val)) < 0)
+						lisp_out_of_memory(l);
+				}
 			return mk_hash(l, new);
 hfail:
 			hash_destroy(new);
@@ -1081,6 +1219,37 @@ static lisp_cell_t *subr_depth(lisp_t * l, lisp_cell_t * args) {
 	return mk_int(l, l->cur_depth);
 }
 
+static lisp_cell_t *subr_procedure_tier(lisp_t * l, lisp_cell_t * args) {
+	static const char *names[] = {
+		[TIER_INTERPRETED] = "interpreted", [TIER_COMPILED] = "compiled",
+		[TIER_OPTIMIZED]   = "optimized",   [TIER_NATIVE]   = "native"
+	};
+	lisp_cell_t *proc = car(args);
+	return mk_list(l, mk_int(l, (intptr_t)get_proc_calls(proc)),
+			lisp_intern(l, names[vm_tier(proc)]), NULL);
+}
+
+static lisp_cell_t *subr_tiers(lisp_t * l, lisp_cell_t * args) {
+	intptr_t optimize = get_int(car(args)), native = get_int(CADR(args));
+	if (optimize < 0 || native < 0)
+		LISP_RECOVER(l, "%r\"expected non-negative call counts\"\n %m%S%t", args);
+	lisp_set_tiers(l, optimize, native);
+	return l->tee;
+}
+
+static lisp_cell_t *subr_recursion_limits(lisp_t * l, lisp_cell_t * args) {
+	size_t depth, stack;
+	if (lisp_check_length(args, 2) && is_int(car(args)) && (is_int(CADR(args)) || is_nil(CADR(args)))) {
+		intptr_t d = get_int(car(args)), s = is_nil(CADR(args)) ? 1 : get_int(CADR(args));
+		if (d <= 0 || s <= 0 || lisp_set_recursion_limits(l, d, is_nil(CADR(args)) ? SIZE_MAX : (size_t)s) < 0)
+			LISP_RECOVER(l, "%r\"invalid recursion limits\"\n %m%S%t", args);
+	} else if (!lisp_check_length(args, 0)) {
+		LISP_RECOVER(l, "%r\"expected () or (integer integer-or-nil)\"\n %m%S%t", args);
+	}
+	lisp_get_recursion_limits(l, &depth, &stack);
+	return cons(l, mk_int(l, depth), cons(l, stack > INTPTR_MAX ? l->nil : mk_int(l, stack), l->nil));
+}
+
 static lisp_cell_t *subr_raw(lisp_t * l, lisp_cell_t * args) {
 	return mk_int(l, (intptr_t) get_raw(car(args)));
 }
@@ -0,0 +1,206 @@
+/** @file     bench.c
+ *  @brief    micro benchmarks for the liblisp interpreter
+ *  @author   Richard Howe (2015)
+ *  @license  LGPL v2.1 or Later
+ *            <https://www.gnu.org/licenses/old-licenses/lgpl-2.1.en.html>
+ *  @email    howe.r.j.89@gmail.com
+ *
+ *  Each benchmark is run in a freshly initialized interpreter and timed
+ *  with clock(), so the numbers reported are processor time. These
+ *  programs are meant for comparing one build of the library against
+ *  another on the same machine, not for comparing against other
+ *  interpreters. Benchmarks can be selected by name on the command line,
+ *  by default all of them are run. **/
+
+#include "liblisp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+	const char *name; /**< name used to select this benchmark*/
+	const char *desc; /**< what the benchmark exercises*/
+	const char *prog; /**< program to evaluate, a single expression*/
+	const char *setup; /**< evaluated before timing starts, may be NULL*/
+	int (*native)(void); /**< run instead of prog if not NULL, prints its own results*/
+} benchmark_t;
+
+static uint32_t djb2_hash(const char *s, size_t len)
+{
+	return djb2(s, len);
+}
+
+static uint32_t xxh64_hash(const char *s, size_t len)
+{
+	uint64_t h = xxh64(s, len, 0);
+	return h ^ (h >> 32); /*folded as the hash tables do*/
+}
+
+static const struct { const char *name; uint32_t (*hash)(const char *, size_t); } hashes[] = {
+	{ "djb2", djb2_hash }, { "xxh64", xxh64_hash }, { NULL, NULL }
+};
+
+static const char *words[] = {
+	"list", "hash", "string", "char", "vector", "file", "port", "symbol", "number", "env",
+	"cons", "proc", "value", "key", "table", "length", "index", "buffer", "line", "error", NULL
+};
+
+/**@brief make one of the key sets, names like those found in lisp programs,
+ * decimal numbers and file paths
+ * @return number of keys made, or zero on failure*/
+static size_t make_keys(int set, char ***keys)
+{
+	size_t n = 0, max = 100000;
+	char buf[128];
+	if (!(*keys = calloc(max, sizeof(**keys))))
+		return 0;
+	for (size_t i = 0; words[i]; i++)
+		for (size_t j = 0; words[j]; j++)
+			for (size_t k = 0; k < (set == 0 ? 22 : set == 1 ? 250 : 50); k++) {
+				if (set == 0 && k < 20)
+					sprintf(buf, "%s-%s-%s", words[i], words[j], words[k]);
+				else if (set == 0)
+					sprintf(buf, k == 20 ? "*%s-%s*" : "%s->%s", words[i], words[j]);
+				else if (set == 1)
+					sprintf(buf, "%zu", n);
+				else
+					sprintf(buf, "/usr/lib/lisp/%s/%s-%zu.lsp", words[i], words[j], k);
+				if (!((*keys)[n++] = lstrdup(buf)))
+					return 0;
+			}
+	return n;
+}
+
+static volatile uint32_t sink; /**< keeps results that are only timed*/
+
+static double power(double x, size_t n)
+{
+	double r = 1;
+	for (; n; n >>= 1, x *= x)
+		if (n & 1)
+			r *= x;
+	return r;
+}
+
+static int hash_string_bench(void)
+{
+	static const char *sets[] = { "names", "numbers", "paths" };
+	for (int set = 0; set < 3; set++) {
+		char **keys = NULL;
+		size_t n = make_keys(set, &keys), bins = 8, *lens;
+		unsigned char *used;
+		if (!n || !(lens = calloc(n, sizeof(*lens))))
+			return -1;
+		for (size_t i = 0; i < n; i++)
+			lens[i] = strlen(keys[i]);
+		while (bins * 3 < n * 4) /*as full as a hash table gets*/
+			bins *= 2;
+		if (!(used = calloc(bins, 1)))
+			return -1;
+		for (size_t h = 0; hashes[h].name; h++) {
+			size_t collisions = 0;
+			uint32_t sum = 0;
+			memset(used, 0, bins);
+			for (size_t i = 0; i < n; i++) {
+				uint32_t b = hashes[h].hash(keys[i], lens[i]) & (bins - 1);
+				collisions += used[b];
+				used[b] = 1;
+			}
+			clock_t start = clock();
+			for (int r = 0; r < 100; r++)
+				for (size_t i = 0; i < n; i++)
+					sum += hashes[h].hash(keys[i], lens[i]);
+			double t = ((double)(clock() - start)) / CLOCKS_PER_SEC;
+			/*the collisions a random function would give, for comparison*/
+			double ideal = n - bins * (1 - power(1 - 1.0 / bins, n));
+			printf("  %-8s %-6s %6zu keys %6zu collisions (random %6.0f) %6.2f ns/key\n",
+				sets[set], hashes[h].name, n, collisions, ideal, t * 1e9 / (n * 100.0));
+			sink = sum;
+		}
+		for (size_t i = 0; i < n; i++)
+			free(keys[i]);
+		free(keys);
+		free(lens);
+		free(used);
+	}
+	return 0;
+}
+
+#define BUILD "(define build (lambda (n acc) (if (> n 0) (build (- n 1) (cons n acc)) acc)))"
+#define KEYS "(progn (define keys nil) (define i 0)"\
+	" (while (< i 200000) (setq i (+ i 1)) (setq keys (cons (coerce *string* (* i 7919)) keys))))"
+#define WALK(BODY) "(progn (define k keys) (while k " BODY " (setq k (cdr k))) t)"
+
+static const benchmark_t benchmarks[] = {
+	{ "cons", "short lived cons cells, mostly garbage",
+	  "(progn " BUILD
+	  " (define i 0)"
+	  " (while (< i 3000) (setq i (+ i 1)) (build 1000 nil)) i)", NULL, NULL },
+	{ "retain", "garbage produced while a large structure stays live",
+	  "(progn " BUILD
+	  " (define keep (build 300000 nil))"
+	  " (define i 0)"
+	  " (while (< i 2000) (setq i (+ i 1)) (build 1000 nil)) i)", NULL, NULL },
+	{ "fib", "procedure calls and integer arithmetic",
+	  "(progn (define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))) (fib 24))", NULL, NULL },
+	{ "tak", "deep mutual recursion with three arguments",
+	  "(progn (define tak (lambda (x y z) (if (< y x) (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y)) z)))"
+	  " (tak 22 16 8))", NULL, NULL },
+	{ "loop", "calls made by eval itself, in a loop outside of any procedure",
+	  "(progn (define i 0) (define s 0) (while (< i 300000) (setq i (+ i 1)) (setq s (+ s (* i 2)))) s)", NULL, NULL },
+	{ "hash-insert", "insert 200000 new string keys into a hash, five times",
+	  "(progn (define j 0) (while (< j 5) (setq j (+ j 1))"
+	  " (define h (hash-create)) " WALK("(hash-insert h (car k) j)") ") t)", KEYS, NULL },
+	{ "hash-lookup", "look up 200000 string keys in a hash, ten times",
+	  "(progn (define j 0) (while (< j 10) (setq j (+ j 1)) " WALK("(hash-lookup h (car k))") ") t)",
+	  "(progn " KEYS " (define h (hash-create)) " WALK("(hash-insert h (car k) t)") ")", NULL },
+	{ "hash-string", "quality and speed of string hashes over some key sets",
+	  NULL, NULL, hash_string_bench },
+	{ NULL, NULL, NULL, NULL, NULL }
+};
+
+static int run(const benchmark_t *b)
+{
+	lisp_t *l;
+	lisp_cell_t *r;
+	clock_t start, end;
+	if (b->native) {
+		printf("%-12s %s\n", b->name, b->desc);
+		return b->native();
+	}
+	if (!(l = lisp_init())) {
+		fprintf(stderr, "lisp_init failed\n");
+		return -1;
+	}
+	if (b->setup && (!(r = lisp_eval_string(l, b->setup)) || r == gsym_error())) {
+		fprintf(stderr, "%s: setup failed\n", b->name);
+		lisp_destroy(l);
+		return -1;
+	}
+	start = clock();
+	r = lisp_eval_string(l, b->prog);
+	end = clock();
+	if (!r || r == gsym_error()) {
+		fprintf(stderr, "%s: evaluation failed\n", b->name);
+		lisp_destroy(l);
+		return -1;
+	}
+	printf("%-12s %8.3fs  %s\n", b->name, ((double)(end - start)) / CLOCKS_PER_SEC, b->desc);
+	lisp_destroy(l);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int failed = 0;
+	for (size_t i = 0; benchmarks[i].name; i++) {
+		int selected = argc < 2;
+		for (int j = 1; j < argc; j++)
+			if (!strcmp(argv[j], benchmarks[i].name))
+				selected = 1;
+		if (selected && run(&benchmarks[i]) < 0)
+			failed++;
+	}
+	return failed;
+}
@@ -168,6 +168,45 @@ static int sstrcmp(const char *s1, const char *s2)
 	return strcmp(s1, s2);
 }
 
+static size_t entries;
+static void *count_entry(const char *key, void *val)
+{
+	(void)key, (void)val;
+	entries++;
+	return NULL;
+}
+
+/**@brief build a list of a given length with the collector off, the list
+ *        is too long to build quickly in lisp*/
+static lisp_cell_t *subr_long_list(lisp_t *l, lisp_cell_t *args)
+{
+	lisp_cell_t *r = gsym_nil(), *one = mk_int(l, 1);
+	lisp_gc_off(l);
+	for (intptr_t i = get_int(car(args)); i > 0; i--)
+		r = cons(l, one, r);
+	lisp_gc_on(l);
+	return r;
+}
+
+/**@brief what the native compiler below turns procedures into, the
+ *        result is off by one so it can be told apart from the byte code*/
+static lisp_cell_t *subr_native_square(lisp_t *l, lisp_cell_t *args)
+{
+	intptr_t x = get_int(car(args));
+	return mk_int(l, x * x + 1);
+}
+
+static unsigned native_compiles = 0;
+
+/**@brief a native compiler for testing tiered execution, which compiles
+ *        every procedure into the same subroutine*/
+static lisp_cell_t *native_compiler(lisp_t *l, lisp_cell_t *proc)
+{
+	UNUSED(proc);
+	native_compiles++;
+	return mk_subr(l, subr_native_square, "d", NULL);
+}
+
 int main(int argc, char **argv)
 {
 	if (argc > 1)
@@ -254,6 +293,13 @@ int main(int argc, char **argv)
 		/*should not collide */
 		test(djb2("heliotropes", strlen("heliotropes")) !=
 		     djb2("serafins", strlen("serafins")));
+
+		/*reference values for XXH64, for the short and the striped paths*/
+		test(xxh64("", 0, 0) == UINT64_C(0xEF46DB3751D8E999));
+		test(xxh64("a", 1, 0) == UINT64_C(0xD24EC4F1A98C6E5B));
+		test(xxh64("abc", 3, 0) == UINT64_C(0x44BC2CF5AD770999));
+		test(xxh64("Nobody inspects the spammish repetition", 39, 0) == UINT64_C(0xFBCEA83C8A378BF1));
+		test(xxh64("heliotropes", 11, 0) != xxh64("neurospora", 10, 0));
 	}
 
 	{ /*io.c test */
@@ -355,7 +401,39 @@ int main(int argc, char **argv)
 		test(!sstrcmp("", hash_lookup(h, "nil")));
 		test(!sstrcmp("z", hash_lookup(h, "a")));
 		test(hash_get_load_factor(h) <= 0.75f);
+		state(hash_destroy(h));
+	}
 
+	{ /* hash.c growing a table while it is in use */
+		static char keys[20000][8];
+		hash_table_t *h = NULL, *c = NULL;
+		volatile int found = 1;
+		state(h = hash_create(1));
+		return_if(!h);
+		for (int i = 0; i < 20000; i++) { /*the table is often part way through growing*/
+			sprintf(keys[i], "%d", i);
+			if (hash_insert(h, keys[i], keys[i]) < 0 || hash_insert(h, keys[i / 2], keys[i / 2]) < 0)
+				found = 0;
+			if (hash_lookup(h, keys[i / 3]) != keys[i / 3])
+				found = 0;
+			if (!(i % 997)) {
+				entries = 0;
+				hash_foreach(h, count_entry);
+				found = found && entries == (size_t)i + 1;
+			}
+		}
+		for (int i = 0; i < 20000; i++)
+			if (hash_lookup(h, keys[i]) != keys[i])
+				found = 0;
+		test(found);
+		test(!hash_lookup(h, "20000") && !hash_lookup(h, "-1"));
+		test(hash_get_load_factor(h) <= 0.75f);
+		state(entries = 0);
+		state(hash_foreach(h, count_entry));
+		test(entries == 20000);
+		state(c = hash_copy(h));
+		test(c && hash_lookup(c, "12345") == keys[12345]);
+		state(hash_destroy(c));
 		state(hash_destroy(h));
 	}
 
@@ -375,29 +453,346 @@ int main(int argc, char **argv)
 		test(get_int(lisp_eval_string(l, "(* 3 2)")) == 6);
 
 		lisp_cell_t *x = NULL, *y = NULL, *z = NULL;
+		char *serial = NULL;
 		char *t = NULL;
-		state(x = lisp_intern(l, lstrdup_or_abort("foo")));
-		state(y = lisp_intern(l, t = lstrdup_or_abort("foo")));	/*this one needs freeing! */
-		state(z = lisp_intern(l, lstrdup_or_abort("bar")));
+		state(x = lisp_intern(l, "foo"));
+		state(y = lisp_intern(l, t = lstrdup_or_abort("foo")));
+		state(z = lisp_intern(l, "bar"));
 		test(x == y && x != NULL);
 		test(x != z);
-		free(t);	/*free the non-interned string */
+		test(get_sym(y) != t && !strcmp(get_sym(y), "foo")); /*names are copied*/
+		free(t);
+		test(lisp_intern(l, "foo") == x); /*found again by the hash it keeps*/
 
 		test(is_proc(lisp_eval_string(l, "(define square (lambda (x) (* x x)))")));
 		test(get_int(lisp_eval_string(l, "(square 4)")) == 16);
 
+		lisp_cell_t *kept = NULL;
+		state(kept = lisp_eval_string(l, "(define kept (cons 1 (cons 2.5 (cons \"three\" nil))))"));
+		state(lisp_eval_string(l, "(define build (lambda (n acc) (if (> n 0) (build (- n 1) (cons n acc)) acc)))"));
+		test(get_length(lisp_eval_string(l, "(build 20000 nil)")) == 20000);
+		state(lisp_gc_mark_and_sweep(l));
+		test(kept == lisp_eval_string(l, "kept"));
+		test(get_int(car(kept)) == 1 && get_float(CADR(kept)) == 2.5);
+		test(!strcmp(get_str(CADDR(kept)), "three"));
+
+		/*only the full collector is available without the cell heap*/
+		int heap = !lisp_gc_set_mode(l, LISP_GC_GENERATIONAL);
+		test(lisp_gc_get_mode(l) == (heap ? LISP_GC_GENERATIONAL : LISP_GC_FULL));
+		state(lisp_eval_string(l, "(define old-hash (hash-create))"));
+		state(lisp_gc_mark_and_sweep(l));
+		/*only the old hash and the old binding of "kept" refer to the new cells*/
+		test(get_int(lisp_eval_string(l,
+			"(progn (hash-insert old-hash \"young\" (cons 3 4))"
+			"       (setq kept (cons 5 6))"
+			"       (build 50000 nil)"
+			"       (+ (cdr (cdr (hash-lookup old-hash \"young\"))) (cdr kept)))")) == 10);
+		test(!lisp_gc_set_mode(l, LISP_GC_FULL));
+		test(lisp_gc_get_mode(l) == LISP_GC_FULL);
+		test(get_length(lisp_eval_string(l, "(build 50000 nil)")) == 50000);
+		size_t heap_min = 0, heap_max = 0;
+		state(lisp_gc_get_heap_limits(l, &heap_min, &heap_max));
+		test(heap_min > 0 && heap_min <= heap_max);
+		test(lisp_gc_set_heap_limits(l, 2, 1) < 0);
+		test(lisp_gc_set_growth(l, 1.0) < 0);
+		test(!lisp_gc_set_growth(l, 1.5));
+		test(lisp_gc_get_growth(l) == 1.5);
+		test(!lisp_gc_set_heap_limits(l, 1 << 16, 1 << 17)); /*collect very often*/
+
+		test(heap ? !lisp_gc_set_mode(l, LISP_GC_INCREMENTAL) : lisp_gc_set_mode(l, LISP_GC_INCREMENTAL) < 0);
+		state(lisp_gc_set_budget(l, 64));
+		test(lisp_gc_get_budget(l) == 64);
+		/*existing objects are moved into cells that might have been traced*/
+		test(get_int(lisp_eval_string(l,
+			"(progn (define a (build 10 nil)) (define b (build 20 nil)) (define c (build 30 nil))"
+			"       (define tmp nil) (define j 0)"
+			"       (while (< j 200)"
+			"         (setq j (+ j 1))"
+			"         (setq tmp a) (setq a b) (setq b c) (setq c tmp) (setq tmp nil)"
+			"         (hash-insert old-hash \"young\" (cons j (+ j 1)))"
+			"         (setq kept (cons j (build 100 nil))))"
+			"       (+ (length a) (+ (cdr (cdr (hash-lookup old-hash \"young\"))) (car kept))))")) == 431);
+		state(lisp_gc_mark_and_sweep(l));
+		state(lisp_gc_set_budget(l, 0));
+		test(lisp_gc_get_budget(l) > 64);
+		test(!lisp_gc_set_heap_limits(l, heap_min, heap_max));
+		test(!lisp_gc_set_growth(l, 2.0));
+		test(heap ? !lisp_gc_set_mode(l, LISP_GC_GENERATIONAL) : lisp_gc_get_mode(l) == LISP_GC_FULL);
+		test(get_int(car(lisp_eval_string(l, "kept"))) == 200);
+
+		/*marking a long list must not use a stack frame per element*/
+		state(lisp_add_subr(l, "long-list", subr_long_list, "d", NULL));
+		test(get_int(lisp_eval_string(l, "(progn (define long (long-list 10000000)) (length long))")) == 10000000);
+		state(lisp_gc_mark_and_sweep(l));
+		test(get_int(lisp_eval_string(l, "(length long)")) == 10000000);
+		state(lisp_eval_string(l, "(setq long nil)"));
+		state(lisp_gc_mark_and_sweep(l));
+
+		lisp_gc_stats_t stats;
+		intptr_t cons_type = get_int(lisp_eval_string(l, "*cons*"));
+		state(lisp_gc_get_stats(l, &stats));
+		test(stats.full && (!heap || (stats.minor && stats.incremental)));
+		test(stats.pauses >= stats.full + stats.minor);
+		test(stats.pause_max <= stats.pause_total);
+		test(stats.allocated[cons_type] > 10000000 && stats.freed[cons_type] > 10000000);
+		test(stats.allocated_bytes[cons_type] > stats.freed_bytes[cons_type]);
+		test(stats.live[cons_type] > 0);
+		test(stats.gc_stack_max > 0);
+		test(!sstrcmp(lisp_type_name(cons_type), "cons"));
+		test(!lisp_type_name(0) && !lisp_type_name(LISP_GC_STATS_TYPES));
+
+		/*symbols are looked up with the hash they keep, strings are hashed*/
+		test(get_int(cdr(lisp_eval_string(l, "(progn (hash-insert old-hash \"sym\" 7) (hash-lookup old-hash 'sym))"))) == 7);
+		test(get_int(cdr(lisp_eval_string(l, "(progn (hash-insert old-hash 'sym 8) (hash-lookup old-hash \"sym\"))"))) == 8);
+		test(get_int(lisp_eval_string(l, "(progn (define a-new-global 9) a-new-global)")) == 9);
+
+		/*small integers are held in the pointer, large ones are allocated*/
+		intptr_t int_type = get_int(lisp_eval_string(l, "*integer*"));
+		test(mk_int(l, 42) == mk_int(l, 42) && get_int(mk_int(l, -42)) == -42);
+		test(mk_int(l, INTPTR_MAX) != mk_int(l, INTPTR_MAX));
+		test(is_int(mk_int(l, INTPTR_MIN)) && get_int(mk_int(l, INTPTR_MIN)) == INTPTR_MIN);
+		test(!is_cons(mk_int(l, 1)) && !is_closed(mk_int(l, 1)));
+		test(get_int(lisp_eval_string(l, "(type-of 1)")) == int_type);
+		test(gsym_tee() == lisp_eval_string(l, "(eq 3 (- 5 2))"));
+		test(get_int(lisp_eval_string(l, "(<< 1 65)")) == 2); /*only the low bits of a count are used*/
+		test(get_int(lisp_eval_string(l, "(>> 4 -1)")) == 0);
+		test(gsym_nil() == lisp_eval_string(l, "(eq 5 (cons 2 nil))"));
+		test(gsym_nil() == lisp_eval_string(l, "(eq (cons 1 2) (cons 1 2))")); /*the same integer car*/
+		test(gsym_nil() == lisp_eval_string(l, "((lambda () (= (cons 1 2) (cons 1 3))))"));
+		test(gsym_tee() == lisp_eval_string(l, "(eq \"ab\" \"ab\")"));
+		state(lisp_gc_get_stats(l, &stats));
+		size_t ints = stats.allocated[int_type];
+		test(get_int(lisp_eval_string(l, "(progn (define i 0) (while (< i 100000) (setq i (+ i 1))) i)")) == 100000);
+		state(lisp_gc_get_stats(l, &stats));
+		test(stats.allocated[int_type] == ints);
+
+		/*most floats are held in the pointer as well, on 64-bit targets*/
+		intptr_t float_type = get_int(lisp_eval_string(l, "*float*"));
+		test(get_float(mk_float(l, 2.5)) == 2.5 && get_float(mk_float(l, -0.0)) == 0.0);
+		test(get_float(mk_float(l, 1e300)) == 1e300 && get_float(mk_float(l, -1e-300)) == -1e-300);
+		test(is_floating(mk_float(l, 0.0)) && !is_int(mk_float(l, 0.5)));
+		test(get_int(lisp_eval_string(l, "(type-of 0.5)")) == float_type);
+		test(gsym_tee() == lisp_eval_string(l, "(eq 0.25 (* 0.5 0.5))"));
+		state(lisp_gc_get_stats(l, &stats));
+		size_t floats = stats.allocated[float_type];
+		test(get_float(lisp_eval_string(l, "(progn (define f 0.0) (setq i 0) (while (< i 1000) (setq i (+ i 1)) (setq f (+ f 0.5))) f)")) == 500.0);
+		state(lisp_gc_get_stats(l, &stats));
+		test(sizeof(void*) < 8 || stats.allocated[float_type] == floats);
+
+		/*variables bound by procedures and let are kept in frames*/
+		state(lisp_eval_string(l, "(define make-counter (lambda (n) (lambda () (setq n (+ n 1)) n)))"));
+		state(lisp_eval_string(l, "(define counter (make-counter 10))"));
+		test(get_int(lisp_eval_string(l, "(progn (counter) (counter))")) == 12);
+		test(get_int(lisp_eval_string(l, "(let (x 1) (y (+ x 1)) (x (* y 10)) (+ x y))")) == 22);
+		test(get_int(lisp_eval_string(l, "((lambda (a . rest) (+ a (length rest))) 1 2 3)")) == 3);
+		test(get_int(lisp_eval_string(l, "((lambda (x) ((lambda (y) (eval 'x (environment))) 2)) 5)")) == 5);
+		test(!sstrcmp(lisp_type_name(get_int(lisp_eval_string(l, "((lambda (x) (type-of (environment))) 1)"))), "frame"));
+		test(gsym_error() == lisp_eval_string(l, "((lambda (a b) a) 1)"));
+		state(lisp_eval_string(l, "(define uses-later (lambda (y) (later y)))"));
+		state(lisp_eval_string(l, "(define later (flambda \"\" (x) x))"));
+		test(is_sym(car(lisp_eval_string(l, "(uses-later 1)")))); /*F-expressions get symbols*/
+
+		/*procedures are compiled to byte code when first called*/
+		state(lisp_eval_string(l, "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"));
+		test(get_int(lisp_eval_string(l, "(fib 20)")) == 6765);
+		state(lisp_eval_string(l, "(define count-down (lambda (n) (cond ((= n 0) 'done) (t (let (m (- n 1)) (count-down m))))))"));
+		test(is_sym(lisp_eval_string(l, "(count-down 100000)"))); /*tail calls do not grow the stack*/
+		test(get_int(lisp_eval_string(l, "((lambda (n) (let (s 0) (progn (while (> n 0) (setq s (+ s n)) (setq n (- n 1))) s))) 100)")) == 5050);
+		test(get_int(lisp_eval_string(l, "((lambda (x) ((if x car cdr) '(1 2))) t)")) == 1);
+		test(get_int(lisp_eval_string(l, "(progn (counter) (make-counter 0) (counter))")) == 14);
+		test(get_int(lisp_eval_string(l, "((compile \"\" (x) (* x 3)) 4)")) == 12);
+		test(gsym_error() == lisp_eval_string(l, "((lambda (x) (car x)) 1)"));
+		test(get_int(lisp_eval_string(l, "(fib 10)")) == 55); /*and still runs after an error*/
+
+		/*recursion is limited by the stack of the virtual machine, not the C stack*/
+		state(lisp_eval_string(l, "(define upto (lambda (n) (if (= n 0) nil (cons n (upto (- n 1))))))"));
+		test(get_int(lisp_eval_string(l, "(length (upto 100000))")) == 100000);
+		test(get_int(lisp_eval_string(l, "(length (eval '(upto 100000)))")) == 100000);
+		state(lisp_eval_string(l, "(define forever (lambda (n) (+ 1 (forever n))))"));
+		test(gsym_error() == lisp_eval_string(l, "(forever 0)"));
+		test(get_int(lisp_eval_string(l, "(fib 10)")) == 55);
+
+		/*closures keep only the variables they use, if those do not change*/
+		state(lisp_eval_string(l, "(define make-adder (lambda (n big) (lambda (x) (+ x n))))"));
+		lisp_cell_t *adder = lisp_eval_string(l, "(make-adder 5 (upto 1000))"), *copy;
+		test(get_int(lisp_eval_string(l, "((make-adder 5 nil) 10)")) == 15);
+		test(get_proc_env(lisp_eval_string(l, "((lambda (big) (lambda (x) (* x 2))) (upto 1000))")) == lisp_environment(l));
+		state(lisp_add_cell(l, "copied-adder", copy = lisp_copy(l, adder)));
+		test(get_proc_env(copy) != get_proc_env(adder));
+		test(get_int(lisp_eval_string(l, "(copied-adder 1)")) == 6);
+		test(get_int(lisp_eval_string(l, "((((lambda (a) (lambda (b) (lambda (c) (+ a (+ b c))))) 1) 2) 3)")) == 6);
+		test(get_int(lisp_eval_string(l, "((lambda (v) (let (get (lambda () v)) (set (lambda (x) (setq v x))) (progn (set 9) (get)))) 1)")) == 9);
+		test(get_int(lisp_eval_string(l, "((lambda (n) (let (down (lambda (k) (if (= k 0) n (down (- k 1))))) (down 10))) 42)")) == 42);
+		test(get_int(lisp_eval_string(l, "(progn (counter) (counter))")) == 16);
+		lisp_cell_t *shadowed = lisp_eval_string(l, "(let (+ -) (lambda (a b) (+ a b)))");
+		test(lisp_lookup(l, lisp_intern(l, "+"), get_proc_env(shadowed)) == lisp_eval_string(l, "-"));
+		test(lisp_lookup(l, lisp_intern(l, "+"), lisp_environment(l)) == lisp_eval_string(l, "+"));
+		test(!lisp_lookup(l, lisp_intern(l, "not-bound-anywhere"), get_proc_env(shadowed)));
+		state(lisp_eval_string(l, "(define later (lambda () 0))"));
+		state(lisp_eval_string(l, "(define see-later (lambda (x) (let (f (lambda () x)) (progn (later) (f)))))"));
+		test(get_int(lisp_eval_string(l, "(see-later 1)")) == 1);
+		state(lisp_eval_string(l, "(define later (macro \"\" () (cons 'setq (cons 'x (cons 5 nil)))))"));
+		test(get_int(lisp_eval_string(l, "(see-later 1)")) == 5); /*a call that became a macro*/
+		test(get_int(lisp_eval_string(l, "((lambda (x m) (let (f (lambda () x)) (progn (m) (f)))) 1 later)")) == 5);
+
+		/*symbols hold their top level binding, which define changes in place*/
+		state(lisp_eval_string(l, "(define a-global 1)"));
+		state(lisp_eval_string(l, "(define get-a-global (lambda () a-global))"));
+		test(get_int(lisp_eval_string(l, "(get-a-global)")) == 1);
+		state(lisp_eval_string(l, "(define a-global 2)"));
+		test(get_int(lisp_eval_string(l, "(get-a-global)")) == 2);
+		test(get_int(lisp_eval_string(l, "(progn ((lambda () (setq a-global 3))) a-global)")) == 3);
+		test(get_int(lisp_eval_string(l, "((lambda (a-global) (get-a-global)) 4)")) == 3);
+		state(lisp_eval_string(l, "(hash-insert (car (cdr (top-environment))) 'a-global 5)"));
+		test(get_int(lisp_eval_string(l, "(get-a-global)")) == 5);
+
+		/*primitives with a fixed arity are passed their arguments directly*/
+		test(get_int(lisp_eval_string(l, "(+ 2 3)")) == 5);
+		test(get_int(lisp_eval_string(l, "(apply + '(2 3))")) == 5); /*a list goes to the shim*/
+		test(get_int(lisp_eval_string(l, "((lambda (x) (cdr (hash-lookup (hash-insert x 'k 7) \"k\"))) (hash-create))")) == 7);
+		test(gsym_error() == lisp_eval_string(l, "(+ 'a 1)"));
+		test(gsym_error() == lisp_eval_string(l, "(+ 1)"));
+		test(gsym_error() == lisp_eval_string(l, "((lambda (x) (cons x)) 1)"));
+		test(gsym_error() == lisp_eval_string(l, "(get-char *output*)")); /*a port, but not an input port*/
+		test(is_cons(lisp_eval_string(l, "(read \"(1 2)\")"))); /*an input port or a string*/
+		test(lisp_validate_args(l, "", 2, "Z d", mk_list(l, gsym_nil(), mk_int(l, 1), NULL), 0));
+		test(!lisp_validate_args(l, "", 2, "Z d", mk_list(l, mk_int(l, 1), mk_int(l, 1), NULL), 0));
+
+		/*procedures keep their arity, so applying them makes no list*/
+		test(get_length(lisp_eval_string(l, "((lambda (a . r) (cons a r)) 1 2 3)")) == 3);
+		test(gsym_error() == lisp_eval_string(l, "((lambda (x y) (+ x y)) 1)"));
+		test(get_int(lisp_eval_string(l, "((copy (lambda (x y) (+ x y))) 1 2)")) == 3);
+		test(get_int(lisp_eval_string(l, "((flambda \"\" (x) (length x) (car (car x))) (4 5))")) == 4);
+
+		/*macros are expanded once, where they are called*/
+		state(lisp_eval_string(l, "(define expansions 0)"));
+		state(lisp_eval_string(l, "(define unless (macro (c x) (setq expansions (+ expansions 1)) (cons 'if (cons c (cons nil (cons x nil))))))"));
+		test(is_macro(lisp_eval_string(l, "unless")));
+		test(get_int(lisp_eval_string(l, "(unless nil 5)")) == 5);
+		state(lisp_eval_string(l, "(define use-unless (lambda (x) (unless x 7)))"));
+		test(get_int(lisp_eval_string(l, "(progn (use-unless nil) (use-unless nil))")) == 7);
+		test(is_nil(lisp_eval_string(l, "(use-unless t)")));
+		test(get_int(lisp_eval_string(l, "(let (i 0) (progn (while (< i 5) (unless nil (setq i (+ i 1)))) i))")) == 5);
+		test(get_int(lisp_eval_string(l, "expansions")) == 3);
+
+		/*"compile" optimizes, with what the top level bindings it uses are bound to*/
+		test(get_int(lisp_eval_string(l, "((compile \"\" (x) (+ x (* 2 (- 5 2)))) 1)")) == 7);
+		test(get_int(lisp_eval_string(l, "((compile \"\" (x) (if (< 2 1) (no-such-procedure x) x)) 3)")) == 3);
+		test(get_int(lisp_eval_string(l, "((compile \"\" (x) (cond ((= 1 2) 0) ((> 1 0) (* x 2)) (t 1))) 3)")) == 6);
+		test(gsym_error() == lisp_eval_string(l, "((compile \"\" () (/ 1 0)))")); /*not worked out*/
+		state(lisp_eval_string(l, "(define square (lambda (x) (* x x)))"));
+		state(lisp_eval_string(l, "(define sum-squares (compile \"\" (x y) (+ (square x) (square (let (x y) x)))))"));
+		test(get_int(lisp_eval_string(l, "(sum-squares 3 4)")) == 25);
+		state(lisp_eval_string(l, "(define square (lambda (x) x))"));
+		test(get_int(lisp_eval_string(l, "(sum-squares 3 4)")) == 7); /*optimized again*/
+		test(get_int(lisp_eval_string(l, "((compile \"\" (n) (fib n)) 10)")) == 55); /*recursive, so called*/
+		test(get_int(lisp_eval_string(l, "((compile \"\" (x) (get-a-global)) 0)")) == 5);
+		{
+			io_t *notes = io_sout(1), *logging = lisp_get_logging(l);
+			lisp_set_logging(l, notes);
+			lisp_set_log_level(l, LISP_LOG_LEVEL_NOTE);
+			state(lisp_eval_string(l, "(compile \"\" (x) (+ x not-yet-defined))"));
+			lisp_set_log_level(l, LISP_LOG_LEVEL_ERROR);
+			lisp_set_logging(l, logging);
+			test(strstr(io_get_string(notes), "not-yet-defined") != NULL);
+			free(io_get_string(notes));
+			state(io_close(notes));
+		}
+
+		/*procedures go up through the tiers as they are called*/
+		state(lisp_eval_string(l, "(define cube (lambda (x) (* x (* x x))))"));
+		test(!strcmp((serial = lisp_serialize(l, lisp_eval_string(l, "(procedure-tier cube)"))), "(0 interpreted)"));
+		state(free(serial));
+		test(get_int(lisp_eval_string(l, "(cube 2)")) == 8);
+		test(!strcmp((serial = lisp_serialize(l, lisp_eval_string(l, "(procedure-tier cube)"))), "(1 compiled)"));
+		state(free(serial));
+		state(lisp_set_native_compiler(l, native_compiler));
+		state(lisp_eval_string(l, "(tiers 2 3)"));
+		test(get_int(lisp_eval_string(l, "(cube 2)")) == 8);
+		test(!strcmp((serial = lisp_serialize(l, lisp_eval_string(l, "(procedure-tier cube)"))), "(2 optimized)"));
+		state(free(serial));
+		test(native_compiles == 0);
+		test(get_int(lisp_eval_string(l, "(cube 2)")) == 5);
+		test(get_int(lisp_eval_string(l, "((lambda (x) (cube x)) 3)")) == 10); /*from byte code*/
+		test(get_float(lisp_eval_string(l, "(cube 2.0)")) == 8.0); /*which the subroutine does not take*/
+		test(native_compiles == 1);
+		state(lisp_eval_string(l, "(define cube-helper (lambda (x) x))"));
+		state(lisp_eval_string(l, "(define cube-helper (lambda (x) (+ x 1)))"));
+		test(get_int(lisp_eval_string(l, "(cube 2)")) == 5); /*compiled again*/
+		test(native_compiles == 2);
+		test(gsym_error() == lisp_eval_string(l, "(tiers -1 0)"));
+		state(lisp_eval_string(l, "(tiers 0 0)"));
+		state(lisp_eval_string(l, "(define cube-helper (lambda (x) x))"));
+		test(get_int(lisp_eval_string(l, "(cube 2)")) == 8); /*and dropped when it is out of date*/
+		state(lisp_set_native_compiler(l, NULL));
+
+		/*optimized code copies in the procedures it calls, until they change*/
+		state(lisp_eval_string(l, "(define callee (lambda (x) (+ x 1)))"));
+		state(lisp_eval_string(l, "(define caller (compile \"\" (x) (callee x)))"));
+		test(get_int(lisp_eval_string(l, "(caller 1)")) == 2);
+		state(lisp_eval_string(l, "(define callee (lambda (x) (+ x 2)))"));
+		test(get_int(lisp_eval_string(l, "(caller 1)")) == 3);
+		state(lisp_eval_string(l, "(setq callee (lambda (x) (+ x 3)))"));
+		test(get_int(lisp_eval_string(l, "(caller 1)")) == 4);
+		test(!strcmp((serial = lisp_serialize(l, lisp_eval_string(l, "(procedure-tier caller)"))), "(3 optimized)"));
+		state(free(serial));
+
+		/*recursion is as deep as the limits allow, and works again after it
+		 *has gone too deep, in the REPL too*/
+		size_t depth_limit, stack_limit;
+		state(lisp_get_recursion_limits(l, &depth_limit, &stack_limit));
+		test(depth_limit == 4096);
+		test(lisp_set_recursion_limits(l, 0, 1 << 16) < 0);
+		test(lisp_set_recursion_limits(l, 64, 0) < 0);
+		test(!lisp_set_recursion_limits(l, 64, 1 << 16));
+		state(lisp_eval_string(l, "(define deep (lambda (n) (if (= n 0) 0 (+ 1 (deep (- n 1))))))"));
+		test(gsym_error() == lisp_eval_string(l, "(deep 100000)"));
+		test(get_int(lisp_eval_string(l, "(deep 10)")) == 10);
+		state(lisp_eval_string(l, "(define eval-deep (lambda (n) (if (= n 0) 0 (+ 1 (eval (cons 'eval-deep (cons (- n 1) nil)))))))"));
+		test(gsym_error() == lisp_eval_string(l, "(eval-deep 100)"));
+		test(get_int(lisp_eval_string(l, "(eval-deep 10)")) == 10);
+		test(!strcmp((serial = lisp_serialize(l, lisp_eval_string(l, "(recursion-limits 200 nil)"))), "(200 nil)"));
+		state(free(serial));
+		test(get_int(lisp_eval_string(l, "(eval-deep 100)")) == 100);
+		test(get_int(lisp_eval_string(l, "(deep 100000)")) == 100000);
+		test(gsym_error() == lisp_eval_string(l, "(recursion-limits 0 1)"));
+		test(!lisp_set_recursion_limits(l, depth_limit, 1 << 12));
+		state(lisp_eval_string(l, "(define car-of (lambda (x) (car x)))"));
+		state(lisp_eval_string(l, "(define caught 0)"));
+		test(get_int(lisp_eval_string(l, "(progn (while (< caught 2000) (eval '(car-of 1)) (setq caught (+ caught 1))) (deep 100))")) == 100);
+		test(!lisp_set_recursion_limits(l, depth_limit, 1 << 16));
+		{
+			io_t *input = lisp_get_input(l), *output = lisp_get_output(l), *logging = lisp_get_logging(l);
+			io_t *in = io_sin("(deep 100000) (deep 10)", 23), *out = io_sout(64), *errors = io_sout(64);
+			lisp_set_input(l, in);
+			lisp_set_output(l, out);
+			lisp_set_logging(l, errors);
+			test(lisp_repl(l, "", 0) > 0);
+			lisp_set_input(l, input);
+			lisp_set_output(l, output);
+			lisp_set_logging(l, logging);
+			test(strstr(io_get_string(errors), "recursion-depth-reached") != NULL);
+			test(!strcmp(io_get_string(out), "10\n"));
+			free(io_get_string(out));
+			free(io_get_string(errors));
+			state(io_close(in));
+			state(io_close(out));
+			state(io_close(errors));
+		}
+		test(!lisp_set_recursion_limits(l, depth_limit, stack_limit));
+
 		test(!is_list(cons(l, gsym_tee(), gsym_tee())));
 		test(is_list(cons(l, gsym_tee(), gsym_nil())));
 		test(!is_list(cons(l, gsym_nil(), cons(l, gsym_tee(), gsym_tee()))));
 		test(is_list(mk_list(l, gsym_tee(), gsym_nil(), gsym_tee(), NULL)));
 
 		test(gsym_error() == lisp_eval_string(l, "(> 'a 1)"));
+		test(gsym_error() == lisp_eval_string(l, "(1 2)")); /*the head is an immediate, not a form*/
 		test(is_sym(x));
 		test(is_asciiz(x));
 		test(!is_str(x));
 		test(gsym_error() == lisp_eval_string(l, "(eval (cons quote 0))"));
 
-		char *serial = NULL;
 		test(!strcmp((serial = lisp_serialize(l, cons(l, gsym_tee(), gsym_error()))), "(t . error)"));
 		state(free(serial));
 
@@ -89,6 +89,78 @@ uint32_t djb2(const char *s, size_t len) {
 	return h;
 }
 
+#define XXH_P1 UINT64_C(0x9E3779B185EBCA87)
+#define XXH_P2 UINT64_C(0xC2B2AE3D27D4EB4F)
+#define XXH_P3 UINT64_C(0x165667B19E3779F9)
+#define XXH_P4 UINT64_C(0x85EBCA77C2B2AE63)
+#define XXH_P5 UINT64_C(0x27D4EB2F165667C5)
+#define XXH_ROTL(X, N) (((X) << (N)) | ((X) >> (64 - (N))))
+
+/*the input is read in little endian order a byte at a time, compilers turn
+ *this into a single load on machines where that is the same thing*/
+static uint64_t xxh_read64(const uint8_t *p) {
+	return (uint64_t)p[0]       | (uint64_t)p[1] << 8  | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+	       (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static uint64_t xxh_read32(const uint8_t *p) {
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+	acc += input * XXH_P2;
+	acc  = XXH_ROTL(acc, 31);
+	return acc * XXH_P1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+	acc ^= xxh_round(0, val);
+	return acc * XXH_P1 + XXH_P4;
+}
+
+uint64_t xxh64(const void *s, size_t len, uint64_t seed) {
+	assert(s);
+	const uint8_t *p = s, *end = p + len;
+	uint64_t h;
+	if (len >= 32) { /*four independent lanes of eight bytes*/
+		uint64_t v1 = seed + XXH_P1 + XXH_P2, v2 = seed + XXH_P2,
+			 v3 = seed, v4 = seed - XXH_P1;
+		for (; end - p >= 32; p += 32) {
+			v1 = xxh_round(v1, xxh_read64(p));
+			v2 = xxh_round(v2, xxh_read64(p + 8));
+			v3 = xxh_round(v3, xxh_read64(p + 16));
+			v4 = xxh_round(v4, xxh_read64(p + 24));
+		}
+		h = XXH_ROTL(v1, 1) + XXH_ROTL(v2, 7) + XXH_ROTL(v3, 12) + XXH_ROTL(v4, 18);
+		h = xxh_merge(h, v1);
+		h = xxh_merge(h, v2);
+		h = xxh_merge(h, v3);
+		h = xxh_merge(h, v4);
+	} else {
+		h = seed + XXH_P5;
+	}
+	h += len;
+	for (; end - p >= 8; p += 8) {
+		h ^= xxh_round(0, xxh_read64(p));
+		h  = XXH_ROTL(h, 27) * XXH_P1 + XXH_P4;
+	}
+	if (end - p >= 4) {
+		h ^= xxh_read32(p) * XXH_P1;
+		h  = XXH_ROTL(h, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= *p * XXH_P5;
+		h  = XXH_ROTL(h, 11) * XXH_P1;
+	}
+	h ^= h >> 33; /*avalanche, so every input bit affects the low bits*/
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
 char *getadelim(FILE * in, int delim) {
 	assert(in);
 	io_t io_in;
@@ -18,32 +18,75 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <assert.h>
 
+/*Objects are sorted into classes for validation, a format character
+ *accepts a set of classes, so checking an argument is a single test of
+ *its class against a mask. Ports are in the port class and in the class
+ *for each direction they have, closed objects are in no class at all.*/
+enum validation_class {
+	VC_INTEGER = 1u << 0,  VC_SYMBOL = 1u << 1,  VC_NIL     = 1u << 2,
+	VC_TEE     = 1u << 3,  VC_CONS   = 1u << 4,  VC_PROC    = 1u << 5,
+	VC_SUBR    = 1u << 6,  VC_STRING = 1u << 7,  VC_IO      = 1u << 8,
+	VC_IN      = 1u << 9,  VC_OUT    = 1u << 10, VC_HASH    = 1u << 11,
+	VC_FPROC   = 1u << 12, VC_FLOAT  = 1u << 13, VC_USERDEF = 1u << 14,
+	VC_OTHER   = 1u << 15,
+	VC_SYMBOLS = VC_SYMBOL | VC_NIL | VC_TEE, /*nil and t are symbols too*/
+	VC_ANY     = 0xFFFFu
+};
+
 #define LISP_VALIDATE_ARGS_XLIST\
-        X('s', "symbol",            is_sym(x))\
-        X('d', "integer",           is_int(x))\
-        X('c', "cons",              is_cons(x))\
-        X('L', "cons-or-nil",       is_cons(x) || is_nil(x))\
-        X('p', "procedure",         is_proc(x))\
-        X('r', "subroutine",        is_subr(x))\
-        X('S', "string",            is_str(x))\
-        X('P', "io-port",           is_io(x))\
-        X('h', "hash",              is_hash(x))\
-        X('F', "f-expr",            is_fproc(x))\
-        X('f', "float",             is_floating(x))\
-        X('u', "user-defined",      is_userdef(x))\
-        X('b', "t-or-nil",          is_nil(x) || x == gsym_tee())\
-        X('i', "input-port",        is_in(x))\
-        X('o', "output-port",       is_out(x))\
-        X('Z', "symbol-or-string",  is_asciiz(x))\
-        X('M', "symbol-or-cons",    is_cons(x) || is_sym(x))\
-        X('a', "integer-or-float",  is_arith(x))\
-        X('x', "function",          is_func(x))\
-        X('I', "input-port-or-string", is_in(x) || is_str(x))\
-        X('l', "defined-procedure", is_proc(x) || is_fproc(x))\
-        X('C', "symbol-string-or-integer", is_asciiz(x) || is_int(x))\
-        X('A', "any-expression",    1)
+        X('s', "symbol",            VC_SYMBOLS)\
+        X('d', "integer",           VC_INTEGER)\
+        X('c', "cons",              VC_CONS)\
+        X('L', "cons-or-nil",       VC_CONS | VC_NIL)\
+        X('p', "procedure",         VC_PROC)\
+        X('r', "subroutine",        VC_SUBR)\
+        X('S', "string",            VC_STRING)\
+        X('P', "io-port",           VC_IO)\
+        X('h', "hash",              VC_HASH)\
+        X('F', "f-expr",            VC_FPROC)\
+        X('f', "float",             VC_FLOAT)\
+        X('u', "user-defined",      VC_USERDEF)\
+        X('b', "t-or-nil",          VC_NIL | VC_TEE)\
+        X('i', "input-port",        VC_IN)\
+        X('o', "output-port",       VC_OUT)\
+        X('Z', "symbol-or-string",  VC_SYMBOLS | VC_STRING)\
+        X('M', "symbol-or-cons",    VC_SYMBOLS | VC_CONS)\
+        X('a', "integer-or-float",  VC_INTEGER | VC_FLOAT)\
+        X('x', "function",          VC_PROC | VC_FPROC | VC_SUBR)\
+        X('I', "input-port-or-string", VC_IN | VC_STRING)\
+        X('l', "defined-procedure", VC_PROC | VC_FPROC)\
+        X('C', "symbol-string-or-integer", VC_SYMBOLS | VC_STRING | VC_INTEGER)\
+        X('A', "any-expression",    VC_ANY)
+
+/**@brief the classes each format character accepts, an invalid format
+ * character accepts none so validating against it always fails*/
+static const uint32_t format_masks[UCHAR_MAX + 1] = {
+#define X(CHAR, STRING, MASK) [(unsigned char)(CHAR)] = (MASK),
+	LISP_VALIDATE_ARGS_XLIST
+#undef X
+};
+
+static uint32_t validation_class(lisp_cell_t *x) {
+	if (is_closed(x))
+		return 0;
+	switch (TYPE_OF(x)) {
+	case INTEGER: return VC_INTEGER;
+	case SYMBOL:  return is_nil(x) ? VC_NIL : x == gsym_tee() ? VC_TEE : VC_SYMBOL;
+	case CONS:    return VC_CONS;
+	case PROC:    return VC_PROC;
+	case SUBR:    return VC_SUBR;
+	case STRING:  return VC_STRING;
+	case IO:      return VC_IO | (is_in(x) ? VC_IN : 0) | (is_out(x) ? VC_OUT : 0);
+	case HASH:    return VC_HASH;
+	case FPROC:   return VC_FPROC;
+	case FLOAT:   return VC_FLOAT;
+	case USERDEF: return VC_USERDEF;
+	default:      return VC_OTHER;
+	}
+}
 
 static int print_type_string(lisp_t *l, const char *msg, unsigned len, const char *fmt, lisp_cell_t *args) {
         const char *s = NULL, *head = fmt;
@@ -57,7 +100,7 @@ static int print_type_string(lisp_t *l, const char *msg, unsigned len, const cha
                 s = "";
                 switch(c) {
                 case ' ': continue;
-#define X(CHAR, STRING, ACTION) case (CHAR): s = (STRING); break;
+#define X(CHAR, STRING, MASK) case (CHAR): s = (STRING); break;
                 LISP_VALIDATE_ARGS_XLIST
 #undef X
                 default: LISP_RECOVER(l, "\"invalid format string\" \"%s\" %S))", head, args);
@@ -79,46 +122,91 @@ size_t lisp_validate_arg_count(const char *fmt) {
 	return i;
 }
 
-int lisp_validate_cell(lisp_t * l, lisp_cell_t * x, lisp_cell_t * args, int recover) {
+uint32_t *lisp_validate_compile(lisp_t *l, const char *fmt, size_t len) {
+	assert(l && fmt);
+	uint32_t *masks;
+	if (!len)
+		return NULL;
+	masks = lisp_calloc(l, len * sizeof(*masks));
+	for (size_t i = 0; i < len; i++) {
+		while (isspace(*fmt))
+			fmt++;
+		const char *token = fmt;
+		while (*fmt && !isspace(*fmt))
+			fmt++;
+		if (fmt - token == 1) /*groups of format characters are not supported*/
+			masks[i] = format_masks[(unsigned char)*token];
+	}
+	return masks;
+}
+
+/**@brief report a primitive being called with invalid arguments*/
+static int validation_error(lisp_t *l, lisp_cell_t *x, lisp_cell_t *args, int recover) {
+	char *msg = get_str(get_func_docstring(x));
+	print_type_string(l, msg ? msg : "", get_length(x), get_func_format(x), args);
+	if (recover)
+		lisp_throw(l, 1);
+	return 0;
+}
+
+int lisp_check_cell(lisp_cell_t * x, lisp_cell_t * args) {
 	assert(x && is_func(x));
-	lisp_cell_t *ds = get_func_docstring(x);
-	char *msg = get_str(ds);
-	msg = msg ? msg : "";
-	char *fmt = get_func_format(x);
-	if (!fmt)
+	if (!get_func_format(x))
 		return 1;	/*as there is no validation string, its up to the function */
-	return lisp_validate_args(l, msg, get_length(x), fmt, args, recover);
+	const uint32_t *masks = get_subr_validation(x);
+	const size_t len = get_length(x);
+	if (!lisp_check_length(args, len))
+		return 0;
+	for (size_t i = 0; i < len; i++, args = cdr(args))
+		if (!(validation_class(car(args)) & masks[i]))
+			return 0;
+	return 1;
+}
+
+int lisp_check_argv(lisp_cell_t * subr, lisp_cell_t ** argv, size_t n) {
+	assert(subr && is_subr(subr) && argv);
+	const uint32_t *masks = get_subr_validation(subr);
+	if (!get_func_format(subr))
+		return 1;
+	if (n != get_length(subr))
+		return 0;
+	for (size_t i = 0; i < n; i++)
+		if (!(validation_class(argv[i]) & masks[i]))
+			return 0;
+	return 1;
+}
+
+int lisp_validate_cell(lisp_t * l, lisp_cell_t * x, lisp_cell_t * args, int recover) {
+	if (lisp_check_cell(x, args))
+		return 1;
+	return validation_error(l, x, args, recover);
+}
+
+int lisp_validate_argv(lisp_t * l, lisp_cell_t * subr, lisp_cell_t ** argv, size_t n, int recover) {
+	assert(l);
+	if (lisp_check_argv(subr, argv, n))
+		return 1;
+	/*the error is reported as if the arguments had been in a list*/
+	lisp_cell_t *args = gsym_nil();
+	while (n)
+		args = cons(l, argv[--n], args);
+	return validation_error(l, subr, args, recover);
 }
 
 int lisp_validate_args(lisp_t * l, const char *msg, unsigned len, const char *fmt, lisp_cell_t * args, int recover) {
 	assert(l && fmt && args && msg);
-	int v = 1;
-	char c = 0;
-	const char *fmt_head = NULL;
-	assert(l && fmt && args);
+	unsigned char c = 0;
+	const char *fmt_head = fmt;
 	lisp_cell_t *args_head = args;
-	fmt_head = fmt;
 	if (!lisp_check_length(args, len))
 		goto fail;
 	while ((c = *fmt++)) {
-		if (is_nil(args) || !v || is_closed(car(args)))
-			goto fail;
-		v = 0;
-		lisp_cell_t *x = car(args);
-		switch (c) {
-		case ' ':
-			v = 1;
+		if (c == ' ')
 			continue;
-#define X(CHAR, STRING, ACTION) case (CHAR): v = ACTION; break;
-			LISP_VALIDATE_ARGS_XLIST
-#undef X
-		default:
-			LISP_RECOVER(l, "\"%s\"", "invalid validation format");
-		}
+		if (is_nil(args) || !(validation_class(car(args)) & format_masks[c]))
+			goto fail;
 		args = cdr(args);
 	}
-	if (!v)
-		goto fail;
 	return 1;
  fail:
         print_type_string(l, msg, len, fmt_head, args_head);
@@ -126,4 +214,3 @@ int lisp_validate_args(lisp_t * l, const char *msg, unsigned len, const char *fm
 		lisp_throw(l, 1);
 	return 0;
 }
-
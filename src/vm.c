@@ -0,0 +1,1177 @@
+/** @file       vm.c
+ *  @brief      A byte code compiler and virtual machine for procedures
+ *  @author     Richard Howe (2015)
+ *  @license    LGPL v2.1 or Later
+ *  @email      howe.r.j.89@gmail.com
+ *
+ *  The body of a procedure is compiled the first time it is applied, once
+ *  its variables have been resolved (see resolve in eval.c), into code for
+ *  a small stack machine. Special forms are turned into jumps and frame
+ *  operations when the code is compiled instead of being recognized each
+ *  time they are run, and calls from one compiled procedure to another do
+ *  not go back through eval or use any of the C stack. Each activation is
+ *  kept on the stack of the machine along with the values being worked
+ *  on, the collector finds everything the machine is using there. That
+ *  stack is allocated and grows as needed, so how deep procedures can
+ *  recurse is only limited by how far it may grow, not by the recursion
+ *  depth allowed on the C stack, which only counts what does use the C
+ *  stack: eval, and the primitives and special forms that call it. Both
+ *  limits are set by lisp_set_recursion_limits.
+ *
+ *  Anything the compiler does not deal with, such as an F-expression, a
+ *  macro or a form the evaluator would reject, is compiled into an
+ *  instruction that hands it to eval, so any code can be compiled and
+ *  errors are reported as they were before.
+ *
+ *  Procedures made by "compile" are optimized as they are compiled (see
+ *  vm_optimize), which relies on what their top level variables are bound
+ *  to not changing, so it is only done when asked for. Should a variable
+ *  bound to a procedure or primitive be bound to something else the code
+ *  is optimized again the next time it is called (see LISP_REBIND). **/
+#include "liblisp.h"
+#include "private.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**@brief Dispatch instructions with a table of label addresses, a GNU C
+ * extension, instead of a switch, each instruction then jumps straight to
+ * the next which branch predictors handle far better.*/
+#ifndef USE_COMPUTED_GOTO
+#ifdef __GNUC__
+#define USE_COMPUTED_GOTO (1)
+#else
+#define USE_COMPUTED_GOTO (0)
+#endif
+#endif
+
+/**@brief The instructions, the operands of each follow it in the code.
+ *
+ *	CONST   cell                  push a cell
+ *	LOOKUP  symbol                push the value of a variable found by name
+ *	LOCAL   slot ref              push a variable in the innermost frame
+ *	LOAD    depth slot ref        push a variable in an enclosing frame
+ *	LOADG   ref                   push a variable that is not in a frame
+ *	SET     depth slot ref form   set a variable to the value on top
+ *	DEFINE  symbol                define a top level variable as the top
+ *	POP                           drop the top
+ *	JUMP    target                continue at target
+ *	JUMPNIL target                pop the top, continue at target if nil
+ *	ENTER   count names           make the frame of a "let" the environment
+ *	INLINE  count names env       pop values into a new frame in env, push
+ *	                              the environment and use the frame instead
+ *	EXIT                          go back to the environment under the top
+ *	SLOT    slot                  bring a variable of that frame into scope
+ *	BIND    slot                  pop the top into the variable
+ *	LEAVE                         go back to the environment before ENTER
+ *	CLOSURE args body doc code    push a new procedure
+ *	CAPTURE count names refs args body doc code
+ *	                              push a new procedure with the variables
+ *	                              in refs copied into a frame of its own
+ *	EVAL    expression            push the result of eval
+ *	FCHECK  args head target      apply what is on top if its arguments are
+ *	                              not evaluated and continue at target
+ *	CALL    count                 apply a function to the values above it
+ *	TCALL   count                 as CALL, in place of the current activation
+ *	RETURN                        return the top to the caller
+ *
+ * "ref" is the REF the variable was resolved to, which is used to find it
+ * by name if the frames are not laid out as expected.*/
+#define VM_OP_XLIST\
+	X(CONST)  X(LOOKUP)  X(LOCAL)   X(LOAD)   X(LOADG)\
+	X(SET)    X(DEFINE)  X(POP)     X(JUMP)   X(JUMPNIL)\
+	X(ENTER)  X(SLOT)    X(BIND)    X(LEAVE)  X(CLOSURE)\
+	X(EVAL)   X(FCHECK)  X(CALL)    X(TCALL)  X(RETURN)\
+	X(INLINE) X(EXIT)    X(CAPTURE)
+
+typedef enum {
+#define X(OP) OP_ ## OP,
+	VM_OP_XLIST
+#undef X
+} vm_op_t;
+
+typedef union {
+	intptr_t n;     /**< an instruction, a number or a position in the code*/
+	lisp_cell_t *c; /**< a cell*/
+} vm_word_t; /**< one word of compiled code*/
+
+typedef struct {
+	size_t stack,  /**< most values the code has on the stack at once*/
+	       fixed,  /**< arguments the procedure cannot do without*/
+	       count,  /**< variables its arguments are bound to, see function_args*/
+	       length; /**< words of code*/
+	size_t rebound; /**< l->rebound when it was compiled, see LISP_REBIND*/
+	unsigned optimized :1, /**< compiled by vm_optimize*/
+		 captured :1;  /**< has a CAPTURE, see compile_lambda*/
+	vm_word_t code[]; /**< the instructions, each followed by its operands*/
+} vm_code_t; /**< what a CODE cell holds*/
+
+/**@brief An activation on the stack of the machine is this many cells
+ * holding the activation it returns to and where in its code, followed by
+ * the CODE being run and the environment it is being run in. Positions are
+ * kept as integers held in the cell pointer so the collector skips them.*/
+#define VM_FRAME (4)
+#define VM_INT(N)     ((lisp_cell_t *)(((uintptr_t)(N) << 1) | FIXNUM_TAG))
+#define VM_GET_INT(X) ((size_t)((uintptr_t)(X) >> 1))
+
+/**@brief Most cons cells the body of a procedure can have for it to be
+ * copied in place of calls to it, see compile_inline*/
+#define VM_INLINE_MAX (48)
+
+/********************************* compiler ***********************************/
+
+/**@brief A frame the code being compiled runs in that is made by the
+ * procedure being compiled, for each of these there is a frame between the
+ * code and the environment of the procedure, innermost first. What is
+ * further out than the last of them is not known about.*/
+typedef struct vm_scope {
+	lisp_cell_t *code;         /**< what the frame is made for, a body or the
+				     arguments of a "let", NULL if none of its
+				     variables are assigned after being bound*/
+	size_t bound;              /**< variables that have been given a value*/
+	const struct vm_scope *up; /**< enclosing frame, or NULL*/
+	unsigned let :1;           /**< "code" is the arguments of a "let"*/
+} vm_scope_t;
+
+typedef struct {
+	lisp_t *l;        /**< interpreter the code is compiled for*/
+	vm_word_t *code;  /**< code compiled so far*/
+	size_t used,      /**< words of code in use*/
+	       allocated, /**< words allocated for the code*/
+	       depth,     /**< values on the stack at this point of the code*/
+	       stack;     /**< most values on the stack at any point*/
+	lisp_cell_t *cells, /**< every cell the code refers to*/
+		    *env;   /**< environment of the procedure being compiled*/
+	const vm_scope_t *scope; /**< frames the code runs in, see vm_scope_t*/
+	unsigned optimize :1, /**< see vm_optimize*/
+		 inlining :1, /**< compiling a body copied by compile_inline*/
+		 captured :1; /**< a CAPTURE has been compiled*/
+} compiler_t;
+
+static size_t emit(compiler_t *c, intptr_t n) {
+	if (c->used == c->allocated) {
+		size_t allocated = c->allocated ? c->allocated * 2 : SMALL_DEFAULT_LEN;
+		vm_word_t *code = realloc(c->code, allocated * sizeof(*code));
+		if (!code) {
+			free(c->code);
+			lisp_out_of_memory(c->l);
+		}
+		c->code = code;
+		c->allocated = allocated;
+	}
+	c->code[c->used].n = n;
+	return c->used++;
+}
+
+static void emit_cell(compiler_t *c, lisp_cell_t *x) {
+	size_t at = emit(c, 0); /*which might move the code*/
+	c->code[at].c = x;
+	if (!IS_IMMEDIATE(x)) /*the list is on the garbage collection stack*/
+		c->cells = cons(c->l, x, c->cells);
+}
+
+/**@brief emit an instruction that changes the number of values on the
+ * stack by "effect"*/
+static void emit_op(compiler_t *c, vm_op_t op, intptr_t effect) {
+	emit(c, op);
+	c->depth += effect;
+	if (c->depth > c->stack)
+		c->stack = c->depth;
+}
+
+/**@brief emit a jump whose target is filled in later by patch, jumps
+ * to the same place can be chained together through their targets*/
+static size_t emit_jump(compiler_t *c, vm_op_t op, size_t chain) {
+	emit_op(c, op, op == OP_JUMPNIL ? -1 : 0);
+	return emit(c, chain);
+}
+
+/**@brief point a chain of jumps at the end of the code*/
+static void patch(compiler_t *c, size_t chain) {
+	while (chain) {
+		size_t next = c->code[chain].n;
+		c->code[chain].n = c->used;
+		chain = next;
+	}
+}
+
+static void compile_const(compiler_t *c, lisp_cell_t *x) {
+	emit_op(c, OP_CONST, 1);
+	emit_cell(c, x);
+}
+
+static void compile_eval(compiler_t *c, lisp_cell_t *exp) {
+	emit_op(c, OP_EVAL, 1);
+	emit_cell(c, exp);
+}
+
+static void compile_return(compiler_t *c, int tail) {
+	if (tail)
+		emit_op(c, OP_RETURN, -1);
+}
+
+static int is_proper_list(lisp_cell_t *x) {
+	for (; is_cons(x); x = cdr(x))
+		;
+	return is_nil(x);
+}
+
+static lisp_cell_t *mk_code(const compiler_t *outer, lisp_cell_t *args, lisp_cell_t *body, const vm_scope_t *up);
+static void compile(compiler_t *c, lisp_cell_t *exp, int tail);
+
+/**@brief what a variable resolved to a REF outside of every frame is bound
+ * to when the code is compiled, which is where it is found when the code
+ * is run as the frames the procedure is given end in the same environment
+ * @return the value or NULL if it is unbound or not such a variable*/
+static lisp_cell_t *global(compiler_t *c, lisp_cell_t *ref) {
+	lisp_cell_t *env = c->env, *holder;
+	size_t field;
+	if (TYPE_OF(ref) != REF || get_ref_slot(ref) != REF_FREE)
+		return NULL;
+	while (TYPE_OF(env) == FRAME)
+		env = get_frame_parent(env);
+	holder = env_find(get_ref_sym(ref), env, &field);
+	return holder ? holder->p[field].v : NULL;
+}
+
+/**@brief the value of an expression if it can be known when the code is
+ * compiled, which it is for constants, quoted data, an "if" whose test is
+ * known and calls to primitives subr_foldable allows on arguments that
+ * are known, through variables bound to the primitive at the time
+ * @return the value, or NULL if it is only known when the code is run*/
+static lisp_cell_t *fold(compiler_t *c, lisp_cell_t *exp) {
+	lisp_t *l = c->l;
+	lisp_cell_t *argv[SUBR_DIRECT_MAX], *f, *args;
+	size_t n = 0;
+	if (TYPE_OF(exp) == REF || is_sym(exp))
+		return is_nil(exp) ? exp : NULL;
+	if (!is_cons(exp))
+		return exp;
+	if (!exp->resolved)
+		return car(exp) == l->quote && is_cons(cdr(exp)) ? CADR(exp) : NULL;
+	args = cdr(exp);
+	if (car(exp) == l->iif) {
+		if (!lisp_check_length(args, 3) || !(f = fold(c, car(args))))
+			return NULL;
+		return fold(c, is_nil(f) ? CADDR(args) : CADR(args));
+	}
+	if (!(f = global(c, car(exp))) || !is_subr(f))
+		return NULL;
+	for (; is_cons(args); args = cdr(args))
+		if (n == SUBR_DIRECT_MAX || !(argv[n++] = fold(c, car(args))))
+			return NULL;
+	if (!is_nil(args) || !subr_foldable(f, argv, n))
+		return NULL;
+	return subr_call(l, f, argv, n);
+}
+
+/**@brief compile a list of expressions run one after another, the last
+ * of which gives the value*/
+static void compile_sequence(compiler_t *c, lisp_cell_t *exps, int tail) {
+	if (is_nil(exps)) {
+		compile_const(c, c->l->nil);
+		compile_return(c, tail);
+		return;
+	}
+	for (; !is_nil(cdr(exps)); exps = cdr(exps)) {
+		compile(c, car(exps), 0);
+		emit_op(c, OP_POP, -1);
+	}
+	compile(c, car(exps), tail);
+}
+
+static void compile_if(compiler_t *c, lisp_cell_t *args, int tail) {
+	size_t depth = c->depth, otherwise, end = 0;
+	lisp_cell_t *test;
+	if (c->optimize && (test = fold(c, car(args)))) { /*one branch is never taken*/
+		compile(c, is_nil(test) ? CADDR(args) : CADR(args), tail);
+		return;
+	}
+	compile(c, car(args), 0);
+	otherwise = emit_jump(c, OP_JUMPNIL, 0);
+	compile(c, CADR(args), tail);
+	if (!tail)
+		end = emit_jump(c, OP_JUMP, 0);
+	c->depth = depth;
+	patch(c, otherwise);
+	compile(c, CADDR(args), tail);
+	patch(c, end);
+}
+
+/**@brief only the first expression after the test of a clause is used, and
+ * a clause that is not a list ends the "cond", as eval has it*/
+static void compile_cond(compiler_t *c, lisp_cell_t *args, int tail) {
+	size_t depth = c->depth, end = 0;
+	for (; is_cons(args) && is_cons(car(args)); args = cdr(args)) {
+		lisp_cell_t *test = c->optimize ? fold(c, CAAR(args)) : NULL;
+		if (test && is_nil(test)) /*a clause that is never taken*/
+			continue;
+		if (test) { /*one that always is, and the rest never are*/
+			compile(c, CADAR(args), tail);
+			patch(c, end);
+			return;
+		}
+		compile(c, CAAR(args), 0);
+		size_t next = emit_jump(c, OP_JUMPNIL, 0);
+		compile(c, CADAR(args), tail);
+		if (!tail)
+			end = emit_jump(c, OP_JUMP, end);
+		c->depth = depth;
+		patch(c, next);
+	}
+	compile_const(c, c->l->nil);
+	compile_return(c, tail);
+	patch(c, end);
+}
+
+static void compile_while(compiler_t *c, lisp_cell_t *args, int tail) {
+	size_t loop = c->used, end;
+	compile(c, car(args), 0);
+	end = emit_jump(c, OP_JUMPNIL, 0);
+	for (args = cdr(args); is_cons(args); args = cdr(args)) {
+		compile(c, car(args), 0);
+		emit_op(c, OP_POP, -1);
+	}
+	emit_op(c, OP_JUMP, 0);
+	emit(c, loop);
+	patch(c, end);
+	compile_const(c, c->l->nil);
+	compile_return(c, tail);
+}
+
+/**@brief the variables of a "let" are bound in one frame, each comes into
+ * scope just before the expression it is bound to is run*/
+static void compile_let(compiler_t *c, lisp_cell_t *args, int tail) {
+	vm_scope_t frame = { .code = args, .up = c->scope, .let = 1 };
+	emit_op(c, OP_ENTER, 0);
+	emit(c, get_length(args) - 1);
+	emit_cell(c, args);
+	c->scope = &frame;
+	for (; !is_nil(cdr(args)); args = cdr(args), frame.bound++) {
+		emit_op(c, OP_SLOT, 0);
+		emit(c, frame.bound);
+		compile(c, CADAR(args), 0);
+		emit_op(c, OP_BIND, -1);
+		emit(c, frame.bound);
+	}
+	compile(c, car(args), tail);
+	c->scope = frame.up;
+	if (!tail)
+		emit_op(c, OP_LEAVE, 0);
+}
+
+/**@brief What vm_walk is looking for in the code it is walking*/
+typedef struct vm_walker {
+	compiler_t *c;
+	/**@brief called for a REF to a variable in a frame outside of the
+	 * code being walked, "depth" counts frames out from where the walk
+	 * began, "assign" is non zero if it is being set
+	 * @return zero to stop the walk*/
+	int (*visit)(struct vm_walker *w, lisp_cell_t *ref, size_t depth, int assign);
+	lisp_cell_t *environment, /**< symbol of the primitive that gives the
+				    environment it is called in to eval*/
+		    *vars; /**< see closure_visit*/
+	size_t slot;       /**< see assign_visit*/
+} vm_walker_t;
+
+static int vm_walk(vm_walker_t *w, lisp_cell_t *exp, size_t inner);
+
+static int vm_walk_list(vm_walker_t *w, lisp_cell_t *exps, size_t inner) {
+	for (; is_cons(exps); exps = cdr(exps))
+		if (!vm_walk(w, car(exps), inner))
+			return 0;
+	return is_nil(exps);
+}
+
+/**@brief walk the bindings and body of a "let", from inside its frame*/
+static int vm_walk_let(vm_walker_t *w, lisp_cell_t *args, size_t inner) {
+	for (; !is_nil(cdr(args)); args = cdr(args))
+		if (!vm_walk(w, CADAR(args), inner))
+			return 0;
+	return vm_walk(w, car(args), inner);
+}
+
+/**@brief can a call through "head" only be to a procedure or primitive,
+ * which is so for a lambda and, until LISP_REBIND says otherwise, for a
+ * top level variable bound to one when the code is compiled. Anything else
+ * could be a macro or F-expression that FCHECK hands to eval.*/
+static int known_call(compiler_t *c, lisp_cell_t *head) {
+	lisp_cell_t *f;
+	if (is_cons(head))
+		return head->resolved && car(head) == c->l->lambda;
+	f = global(c, head);
+	return f && (TYPE_OF(f) == PROC || TYPE_OF(f) == SUBR);
+}
+
+/**@brief Walk resolved code that is inside "inner" frames it makes itself,
+ * calling w->visit for each variable of a frame outside of those.
+ * @return zero if the walk was stopped, or if there is anything in the
+ * code that is left to eval, that asks for its environment or that calls
+ * what might not be a procedure or primitive, any of which can get at any
+ * variable by name*/
+static int vm_walk(vm_walker_t *w, lisp_cell_t *exp, size_t inner) {
+	lisp_t *l = w->c->l;
+	lisp_cell_t *first, *args;
+	if (TYPE_OF(exp) == REF) {
+		if (get_ref_slot(exp) == REF_FREE)
+			return get_ref_sym(exp) != w->environment;
+		if (get_ref_depth(exp) < inner)
+			return 1;
+		return w->visit(w, exp, get_ref_depth(exp) - inner, 0);
+	}
+	if (!is_cons(exp))
+		return !is_sym(exp) || is_nil(exp);
+	if (!exp->resolved)
+		return car(exp) == l->quote;
+	first = car(exp);
+	args = cdr(exp);
+	if (!is_sym(first) || is_nil(first))
+		return known_call(w->c, first) && vm_walk_list(w, exp, inner);
+	if (first == l->iif || first == l->progn || first == l->dowhile)
+		return vm_walk_list(w, args, inner);
+	if (first == l->cond) {
+		for (; is_cons(args); args = cdr(args))
+			if (!vm_walk_list(w, car(args), inner))
+				return 0;
+		return is_nil(args);
+	}
+	if (first == l->lambda) {
+		if (!is_nil(car(args)) && is_str(car(args)))
+			args = cdr(args);
+		return vm_walk_list(w, cdr(args), inner + !is_nil(car(args)));
+	}
+	if (first == l->let)
+		return vm_walk_let(w, args, inner + 1);
+	if (first == l->setq && TYPE_OF(car(args)) == REF) {
+		lisp_cell_t *ref = car(args);
+		if (get_ref_slot(ref) != REF_FREE && get_ref_depth(ref) >= inner)
+			if (!w->visit(w, ref, get_ref_depth(ref) - inner, 1))
+				return 0;
+		return vm_walk(w, CADR(args), inner);
+	}
+	if (first == l->define)
+		return vm_walk(w, CADR(args), inner);
+	return 0; /*a special form that is left to eval*/
+}
+
+static int assign_visit(vm_walker_t *w, lisp_cell_t *ref, size_t depth, int assign) {
+	return !assign || depth || get_ref_slot(ref) != w->slot;
+}
+
+/**@brief might a variable of the frame "s" is for be set after it has been
+ * bound, by the code the frame is made for or any closure made in it*/
+static int assigned(compiler_t *c, const vm_scope_t *s, size_t slot) {
+	vm_walker_t w = { .c = c, .visit = assign_visit, .slot = slot,
+		.environment = lisp_intern(c->l, "environment") };
+	if (!s->code)
+		return 0;
+	return !(s->let ? vm_walk_let(&w, s->code, 0) : vm_walk_list(&w, s->code, 0));
+}
+
+/**@brief add a variable a closure uses to those copied into it, which it
+ * can only be if it is in a frame made by the procedure being compiled,
+ * has its value by the time the closure is made and keeps it*/
+static int closure_visit(vm_walker_t *w, lisp_cell_t *ref, size_t depth, int assign) {
+	const vm_scope_t *s = w->c->scope;
+	size_t slot = get_ref_slot(ref);
+	if (assign)
+		return 0;
+	for (lisp_cell_t *v = w->vars; is_cons(v); v = cdr(v))
+		if (get_ref_depth(car(v)) == depth && get_ref_slot(car(v)) == slot)
+			return 1;
+	for (size_t i = depth; s && i; i--)
+		s = s->up;
+	if (!s || slot >= s->bound || assigned(w->c, s, slot))
+		return 0;
+	w->vars = cons(w->c->l, mk_ref(w->c->l, get_ref_sym(ref), depth, slot), w->vars);
+	return 1;
+}
+
+/**@brief copy resolved code in the body of a closure, inside "inner"
+ * frames of its own, so the variables in "vars" are found in the frame
+ * CAPTURE copies them into, which follows those*/
+static lisp_cell_t *closure_code(lisp_t *l, lisp_cell_t *exp, size_t inner, lisp_cell_t *vars) {
+	if (TYPE_OF(exp) == REF) {
+		size_t depth = get_ref_depth(exp), slot = get_ref_slot(exp), i = 0;
+		if (slot == REF_FREE)
+			return mk_ref(l, get_ref_sym(exp), inner + !is_nil(vars), REF_FREE);
+		if (depth < inner)
+			return exp;
+		for (; is_cons(vars); vars = cdr(vars), i++)
+			if (get_ref_depth(car(vars)) == depth - inner && get_ref_slot(car(vars)) == slot)
+				break;
+		return mk_ref(l, get_ref_sym(exp), inner, i);
+	}
+	if (!is_cons(exp) || !exp->resolved)
+		return exp;
+	if (car(exp) == l->lambda) {
+		lisp_cell_t *args = cdr(exp), *doc = NULL;
+		if (!is_nil(car(args)) && is_str(car(args))) {
+			doc = car(args);
+			args = cdr(args);
+		}
+		args = rcons(l, car(args), closure_code(l, cdr(args), inner + !is_nil(car(args)), vars));
+		return rcons(l, car(exp), doc ? rcons(l, doc, args) : args);
+	}
+	if (car(exp) == l->let)
+		return rcons(l, car(exp), closure_code(l, cdr(exp), inner + 1, vars));
+	return rcons(l, closure_code(l, car(exp), inner, vars), closure_code(l, cdr(exp), inner, vars));
+}
+
+/**@brief A procedure made here would keep every frame it is made in alive,
+ * as well as make lookups of the variables in them walk through each of
+ * those frames. If all it uses of them are variables that keep the value
+ * they have when it is made, only those are copied into a frame of its
+ * own by CAPTURE, with its code changed to find them there. Otherwise, or
+ * if it has anything that is left to eval, CLOSURE makes it with the
+ * environment as it is. As that relies on the calls made around it not
+ * being to macros (see known_call), the code is compiled again once a
+ * top level variable is bound to something else.*/
+static void compile_lambda(compiler_t *c, lisp_cell_t *args, int tail) {
+	lisp_t *l = c->l;
+	lisp_cell_t *doc = l->empty_docstr, *body, *vars = l->nil, *names = l->nil;
+	vm_walker_t w = { .c = c, .visit = closure_visit, .vars = l->nil,
+		.environment = lisp_intern(l, "environment") };
+	vm_scope_t copied = { .code = NULL };
+	if (!is_nil(car(args)) && is_str(car(args))) {
+		doc = car(args);
+		args = cdr(args);
+	}
+	if (c->inlining || !vm_walk_list(&w, cdr(args), !is_nil(car(args)))) {
+		emit_op(c, OP_CLOSURE, 1);
+		emit_cell(c, car(args));
+		emit_cell(c, cdr(args));
+		emit_cell(c, doc);
+		emit_cell(c, mk_code(c, car(args), cdr(args), c->scope));
+		compile_return(c, tail);
+		return;
+	}
+	for (; is_cons(w.vars); w.vars = cdr(w.vars), copied.bound++) {
+		vars = cons(l, car(w.vars), vars);
+		names = cons(l, get_ref_sym(car(w.vars)), names);
+	}
+	body = closure_code(l, cdr(args), !is_nil(car(args)), vars);
+	c->captured = 1;
+	emit_op(c, OP_CAPTURE, 1);
+	emit(c, copied.bound);
+	emit_cell(c, names);
+	emit_cell(c, vars);
+	emit_cell(c, car(args));
+	emit_cell(c, body);
+	emit_cell(c, doc);
+	emit_cell(c, mk_code(c, car(args), body, copied.bound ? &copied : NULL));
+	compile_return(c, tail);
+}
+
+/**@brief compile a reference to a variable, what is known about where it
+ * is picks the instruction used*/
+static void compile_ref(compiler_t *c, lisp_cell_t *ref) {
+	size_t depth = get_ref_depth(ref), slot = get_ref_slot(ref);
+	if (slot == REF_FREE) {
+		if (c->optimize && !global(c, ref))
+			lisp_log_note(c->l, "'compile \"unbound variable\" '%s", get_sym(get_ref_sym(ref)));
+		emit_op(c, OP_LOADG, 1);
+	} else if (!depth) {
+		emit_op(c, OP_LOCAL, 1);
+		emit(c, slot);
+	} else {
+		emit_op(c, OP_LOAD, 1);
+		emit(c, depth);
+		emit(c, slot);
+	}
+	emit_cell(c, ref);
+}
+
+/**@brief compile the application of a function, what the head turns out
+ * to be is only known when the code is run, if the arguments are not to
+ * be evaluated FCHECK hands the call to eval*/
+static void compile_call(compiler_t *c, lisp_cell_t *head, lisp_cell_t *args, int tail) {
+	size_t n = 0, skip;
+	compile(c, head, 0);
+	emit_op(c, OP_FCHECK, 0);
+	emit_cell(c, args);
+	emit_cell(c, head);
+	skip = emit(c, 0);
+	for (; is_cons(args); args = cdr(args), n++)
+		compile(c, car(args), 0);
+	emit_op(c, tail ? OP_TCALL : OP_CALL, -(intptr_t)n);
+	emit(c, n);
+	patch(c, skip);
+	compile_return(c, tail);
+}
+
+/**@brief is an expression no bigger than "budget" cons cells, not counting
+ * those used up already, and without any mention of the symbol "self"*/
+static int inlinable(lisp_cell_t *exp, lisp_cell_t *self, size_t *budget) {
+	for (; is_cons(exp); exp = cdr(exp)) {
+		if (!*budget || !inlinable(car(exp), self, budget))
+			return 0;
+		--*budget;
+	}
+	return (TYPE_OF(exp) == REF ? get_ref_sym(exp) : exp) != self;
+}
+
+/**@brief Copy the body of a small procedure in place of a call to it,
+ * which has to be to what a top level variable is bound to when the code
+ * is compiled, with as many arguments as it has variables. Its arguments
+ * are bound by INLINE in a frame whose parent is the environment of the
+ * procedure, so the body runs as it would if it had been called, and it
+ * must not call itself through the same variable. Calls in a copied body
+ * are not inlined themselves, which also stops a procedure being copied
+ * into itself through others.
+ * @return non zero if the call has been compiled*/
+static int compile_inline(compiler_t *c, lisp_cell_t *head, lisp_cell_t *args, int tail) {
+	lisp_cell_t *f = global(c, head), *env = c->env, *body;
+	size_t n = get_length(args), budget = VM_INLINE_MAX;
+	const vm_scope_t *scope = c->scope;
+	if (c->inlining || !f || !is_proc(f) || get_proc_count(f) != n || get_proc_fixed(f) != n)
+		return 0;
+	if (!inlinable(get_proc_code(f), get_ref_sym(head), &budget))
+		return 0;
+	budget = VM_INLINE_MAX; /*macros it uses might have been expanded*/
+	if (!inlinable(body = proc_resolve(c->l, f), get_ref_sym(head), &budget) || !is_proper_list(body))
+		return 0;
+	for (; is_cons(args); args = cdr(args))
+		compile(c, car(args), 0);
+	emit_op(c, OP_INLINE, 1 - (intptr_t)n);
+	emit(c, n);
+	emit_cell(c, get_proc_args(f));
+	emit_cell(c, get_proc_env(f));
+	c->inlining = 1;
+	c->env = get_proc_env(f);
+	c->scope = NULL; /*closures made in the copied body are not flattened*/
+	compile_sequence(c, body, tail);
+	c->inlining = 0;
+	c->env = env;
+	c->scope = scope;
+	if (!tail)
+		emit_op(c, OP_EXIT, -1);
+	return 1;
+}
+
+/**@brief compile resolved code, which has been checked by the resolver
+ * for most of the forms handled here*/
+static void compile_form(compiler_t *c, lisp_cell_t *exp, int tail) {
+	lisp_t *l = c->l;
+	lisp_cell_t *first = car(exp), *args = cdr(exp);
+	if (!is_proper_list(args))
+		goto fallback;
+	if (first == l->iif) {
+		if (get_length(args) != 3)
+			goto fallback;
+		compile_if(c, args, tail);
+	} else if (first == l->progn) {
+		compile_sequence(c, args, tail);
+	} else if (first == l->dowhile) {
+		if (!is_cons(args))
+			goto fallback;
+		compile_while(c, args, tail);
+	} else if (first == l->cond) {
+		for (lisp_cell_t *t = args; is_cons(t) && is_cons(car(t)); t = cdr(t))
+			if (!is_cons(CDAR(t)))
+				goto fallback;
+		compile_cond(c, args, tail);
+	} else if (first == l->let) {
+		compile_let(c, args, tail);
+	} else if (first == l->lambda) {
+		compile_lambda(c, args, tail);
+	} else if (first == l->setq && TYPE_OF(car(args)) == REF) {
+		compile(c, CADR(args), 0);
+		emit_op(c, OP_SET, 0);
+		emit(c, get_ref_depth(car(args)));
+		emit(c, get_ref_slot(car(args)));
+		emit_cell(c, car(args));
+		emit_cell(c, args);
+		compile_return(c, tail);
+	} else if (first == l->define) {
+		compile(c, CADR(args), 0);
+		emit_op(c, OP_DEFINE, 0);
+		emit_cell(c, car(args));
+		compile_return(c, tail);
+	} else if (is_sym(first) && !is_nil(first)) {
+		goto fallback; /*a special form that is left to eval*/
+	} else if (!c->optimize || !compile_inline(c, first, args, tail)) {
+		compile_call(c, first, args, tail);
+	}
+	return;
+fallback:
+	compile_eval(c, exp);
+	compile_return(c, tail);
+}
+
+static void compile(compiler_t *c, lisp_cell_t *exp, int tail) {
+	lisp_t *l = c->l;
+	if (TYPE_OF(exp) == REF) {
+		compile_ref(c, exp);
+	} else if (is_sym(exp)) {
+		if (is_nil(exp)) {
+			compile_const(c, exp);
+		} else { /*code that was not resolved*/
+			emit_op(c, OP_LOOKUP, 1);
+			emit_cell(c, exp);
+		}
+	} else if (!is_cons(exp)) {
+		compile_const(c, exp);
+	} else if (exp->resolved) {
+		lisp_cell_t *value;
+		if (!c->optimize || !(value = fold(c, exp))) {
+			compile_form(c, exp, tail);
+			return;
+		}
+		compile_const(c, value);
+	} else if (car(exp) == l->quote && is_cons(cdr(exp))) {
+		compile_const(c, CADR(exp));
+	} else {
+		compile_eval(c, exp);
+	}
+	compile_return(c, tail);
+}
+
+/**@brief compile the resolved body of a procedure taking the arguments
+ * "args" into a new CODE cell, as "outer" compiles code, "up" is what is
+ * known of the frames the procedure is made in*/
+static lisp_cell_t *mk_code(const compiler_t *outer, lisp_cell_t *args, lisp_cell_t *body, const vm_scope_t *up) {
+	lisp_t *l = outer->l;
+	compiler_t c = { .l = l, .cells = l->nil, .env = outer->env, .scope = up,
+		.optimize = outer->optimize, .inlining = outer->inlining };
+	vm_scope_t frame = { .code = body, .up = up };
+	vm_code_t *code;
+	lisp_cell_t *x;
+	for (x = args; is_cons(x); x = cdr(x))
+		frame.bound++;
+	frame.bound += !is_nil(x);
+	if (frame.bound)
+		c.scope = &frame;
+	if (is_proper_list(body)) {
+		compile_sequence(&c, body, 1);
+	} else { /*eval reports the error*/
+		compile_eval(&c, cons(l, l->progn, body));
+		compile_return(&c, 1);
+	}
+	if (!(code = malloc(sizeof(*code) + c.used * sizeof(code->code[0])))) {
+		free(c.code);
+		lisp_out_of_memory(l);
+	}
+	memcpy(code->code, c.code, c.used * sizeof(code->code[0]));
+	free(c.code);
+	code->stack = c.stack;
+	code->length = c.used;
+	code->optimized = c.optimize;
+	code->captured = c.captured;
+	code->rebound = l->rebound;
+	code->count = frame.bound;
+	code->fixed = frame.bound - !is_nil(x);
+	x = lisp_gc_alloc(l, CODE, CODE_FIELDS);
+	x->p[0].v = code;
+	x->p[1].v = c.cells;
+	return lisp_gc_add(l, x);
+}
+
+static lisp_cell_t *compile_proc(lisp_t *l, lisp_cell_t *proc, int optimize) {
+	const compiler_t outer = { .l = l, .env = get_proc_env(proc), .optimize = optimize };
+	lisp_cell_t *body = proc->p[3].v ? proc_resolve(l, proc) : proc_body(l, proc);
+	lisp_cell_t *code = mk_code(&outer, get_proc_args(proc), body, NULL);
+	LISP_GC_BARRIER(proc);
+	proc->p[3].v = code;
+	return code;
+}
+
+lisp_cell_t *vm_compile(lisp_t *l, lisp_cell_t *proc) {
+	assert(l && proc && is_proc(proc));
+	lisp_cell_t *code = proc->p[3].v;
+	vm_code_t *c;
+	if (!code || TYPE_OF(code) != CODE)
+		return compile_proc(l, proc, 0);
+	c = code->p[0].v;
+	if ((c->optimized || c->captured) && c->rebound != l->rebound)
+		return compile_proc(l, proc, c->optimized);
+	return code;
+}
+
+lisp_cell_t *vm_optimize(lisp_t *l, lisp_cell_t *proc) {
+	assert(l && proc && is_proc(proc));
+	return compile_proc(l, proc, 1);
+}
+
+proc_tier_t vm_tier(lisp_cell_t *proc) {
+	assert(proc && is_proc(proc));
+	lisp_cell_t *code = proc->p[3].v;
+	if (get_proc_native(proc) && is_subr(get_proc_native(proc)))
+		return TIER_NATIVE;
+	if (!code || TYPE_OF(code) != CODE)
+		return TIER_INTERPRETED;
+	return ((vm_code_t *)code->p[0].v)->optimized ? TIER_OPTIMIZED : TIER_COMPILED;
+}
+
+/**@brief Count a call to a procedure, which is promoted to the next tier
+ * once it has been called as often as lisp_set_tiers asks. A procedure that
+ * is running keeps the CODE it started with on the stack, so it can be
+ * compiled again while it is running. The native compiler is only tried
+ * once, nil is kept if it fails, and only for procedures that do not take a
+ * list of the rest of their arguments, as vm_enter gives the subroutine the
+ * arguments bound in the frame. Callers only use the subroutine if it
+ * accepts the arguments, and run the byte code otherwise, as it may have
+ * been made for integers alone. The native compiler may build in what top
+ * level variables are bound to, as the optimizer does, so the subroutine
+ * is dropped once LISP_REBIND says one of those has changed and the
+ * procedure is compiled to machine code again.
+ * @return the subroutine to call instead, or NULL*/
+static inline lisp_cell_t *vm_promote(lisp_t *l, lisp_cell_t *proc) {
+	assert(l && proc && is_proc(proc));
+	size_t calls = (size_t)proc->p[6].v + 1;
+	lisp_cell_t *native = proc->p[7].v;
+	proc->p[6].v = (void *)calls; /*not a cell, so no barrier is needed*/
+	if (native && is_subr(native) && (size_t)proc->p[8].v != l->rebound)
+		native = proc->p[7].v = NULL; /*out of date*/
+	if (!l->tier_optimize && !l->tier_native && !native)
+		return NULL; /*which is how it usually is*/
+	if (l->tier_optimize && calls >= l->tier_optimize && vm_tier(proc) < TIER_OPTIMIZED)
+		vm_optimize(l, proc);
+	if (l->tier_native && calls >= l->tier_native && !native && l->native_compiler
+			&& get_proc_count(proc) == get_proc_fixed(proc)) {
+		proc->p[7].v = l->nil; /*tried, even if the compiler calls it*/
+		lisp_gc_add(l, proc);
+		if ((native = l->native_compiler(l, proc)) && is_subr(native)) {
+			LISP_GC_BARRIER(proc);
+			proc->p[7].v = native;
+			proc->p[8].v = (void *)l->rebound;
+		}
+	}
+	return native && is_subr(native) ? native : NULL;
+}
+
+/***************************** virtual machine ********************************/
+
+/**@brief make sure the stack has room for at least "size" cells*/
+static void vm_reserve(lisp_t *l, size_t size) {
+	if (size <= l->vm_stack_allocated)
+		return;
+	size_t allocated = l->vm_stack_allocated ? l->vm_stack_allocated : DEFAULT_LEN;
+	while (allocated < size)
+		allocated *= 2;
+	lisp_cell_t **stack = realloc(l->vm_stack, allocated * sizeof(*stack));
+	if (!stack)
+		lisp_out_of_memory(l);
+	l->vm_stack = stack;
+	l->vm_stack_allocated = allocated;
+}
+
+static lisp_cell_t *vm_list(lisp_t *l, lisp_cell_t **vals, size_t n) {
+	lisp_cell_t *r = l->nil;
+	while (n)
+		r = cons(l, vals[--n], r);
+	return r;
+}
+
+/**@brief bind the arguments of a procedure taken from the stack, as
+ * function_args does*/
+static lisp_cell_t *vm_args(lisp_t *l, lisp_cell_t *proc, const vm_code_t *code, lisp_cell_t **vals, size_t n) {
+	lisp_cell_t *f, *rest = l->nil;
+	if (n < code->fixed)
+		LISP_RECOVER(l, "%y'argument-count-error%t\n %S\n '%S", proc, vm_list(l, vals, n));
+	if (!code->count)
+		return get_proc_env(proc);
+	if (code->count > code->fixed) /*made first, so "f" is still young*/
+		rest = vm_list(l, vals + code->fixed, n - code->fixed);
+	f = mk_frame(l, get_proc_env(proc), get_proc_args(proc), code->count, code->count);
+	for (size_t i = 0; i < code->fixed; i++)
+		f->p[FRAME_HEADER + i].v = vals[i];
+	if (code->count > code->fixed)
+		f->p[FRAME_HEADER + code->fixed].v = rest;
+	return f;
+}
+
+/**@brief find the frame a variable resolved to "depth" and "slot" is in,
+ * if the environment is as the resolver expected it to be
+ * @return the frame, or NULL if the variable has to be found with ref_find*/
+static inline lisp_cell_t *vm_frame(lisp_cell_t *env, size_t depth, size_t slot) {
+	for (; depth; depth--) {
+		if (TYPE_OF(env) != FRAME)
+			return NULL;
+		env = env->p[0].v;
+	}
+	return TYPE_OF(env) == FRAME && slot < (size_t)env->p[2].v ? env : NULL;
+}
+
+static lisp_cell_t *vm_load(lisp_t *l, lisp_cell_t *ref, lisp_cell_t *env) {
+	size_t field;
+	lisp_cell_t *holder = ref_find(ref, env, &field);
+	if (!holder)
+		LISP_RECOVER(l, "%r\"unbound symbol\"\n %y'%s%t", get_sym(get_ref_sym(ref)));
+	return holder->p[field].v;
+}
+
+/**@brief Run compiled code until the activation it starts with returns,
+ * everything in use is kept on l->vm_stack. Before anything that could
+ * allocate, and so run the collector, the top of the stack is stored in
+ * l->vm_stack_used (VM_SAVE), as the collector only looks below it, and
+ * after anything that could run more code the stack is reloaded (VM_LOAD),
+ * as it might have been moved to make it bigger.*/
+static lisp_cell_t *vm_run(lisp_t *l, unsigned depth, lisp_cell_t *proc_code, lisp_cell_t *env) {
+	size_t gc_stack_save = l->gc_stack_used, base = l->vm_stack_used, sp, bp, n, field;
+	size_t calls = 0; /*activations this has on the stack*/
+	vm_code_t *code = proc_code->p[0].v;
+	vm_word_t *pc = code->code;
+	lisp_cell_t **stk, *x, *y;
+#define VM_SAVE() (l->vm_stack_used = sp)
+#define VM_LOAD() (stk = l->vm_stack)
+#define VM_KEEP() (l->gc_stack_used = gc_stack_save) /*everything is on the stack*/
+#define VM_SIGNAL()\
+	do { if (l->sig) { l->sig = 0; lisp_throw(l, 1); } } while(0)
+#if USE_COMPUTED_GOTO
+	static const void *dispatch[] = {
+#define X(OP) __extension__ &&VM_ ## OP,
+		VM_OP_XLIST
+#undef X
+	};
+#define VM_CASE(OP) VM_ ## OP:
+#define VM_NEXT __extension__ ({ goto *dispatch[(pc++)->n]; })
+#define VM_DISPATCH VM_NEXT;
+#else
+#define VM_CASE(OP) case OP_ ## OP:
+#define VM_NEXT continue
+#define VM_DISPATCH for (;;) switch ((pc++)->n)
+#endif
+	vm_reserve(l, base + VM_FRAME + code->stack);
+	VM_LOAD();
+	stk[base] = VM_INT(0);
+	stk[base + 1] = VM_INT(0);
+	stk[base + 2] = proc_code;
+	stk[base + 3] = env;
+	bp = sp = base + VM_FRAME;
+	VM_SAVE();
+
+	VM_DISPATCH {
+	VM_CASE(CONST)
+		stk[sp++] = (pc++)->c;
+		VM_NEXT;
+	VM_CASE(LOOKUP)
+		if (!(x = env_find(pc->c, env, &field)))
+			LISP_RECOVER(l, "%r\"unbound symbol\"\n %y'%s%t", get_sym(pc->c));
+		stk[sp++] = x->p[field].v;
+		pc++;
+		VM_NEXT;
+	VM_CASE(LOCAL)
+		if ((x = vm_frame(env, 0, pc[0].n)))
+			stk[sp++] = x->p[FRAME_HEADER + pc[0].n].v;
+		else
+			stk[sp++] = vm_load(l, pc[1].c, env);
+		pc += 2;
+		VM_NEXT;
+	VM_CASE(LOAD)
+		if ((x = vm_frame(env, pc[0].n, pc[1].n)))
+			stk[sp++] = x->p[FRAME_HEADER + pc[1].n].v;
+		else
+			stk[sp++] = vm_load(l, pc[2].c, env);
+		pc += 3;
+		VM_NEXT;
+	VM_CASE(LOADG)
+		stk[sp++] = vm_load(l, (pc++)->c, env);
+		VM_NEXT;
+	VM_CASE(SET)
+		if ((x = vm_frame(env, pc[0].n, pc[1].n)))
+			field = FRAME_HEADER + pc[1].n;
+		else if (!(x = ref_find(pc[2].c, env, &field)))
+			LISP_RECOVER(l, "%y'setq\n %r\"undefined variable\"%t\n '%S", pc[3].c);
+		else if (TYPE_OF(x) != FRAME)
+			LISP_REBIND(l, x->p[field].v);
+		LISP_GC_BARRIER(x);
+		x->p[field].v = stk[sp - 1];
+		pc += 4;
+		VM_NEXT;
+	VM_CASE(DEFINE)
+		VM_SAVE();
+		lisp_extend_top(l, (pc++)->c, stk[sp - 1]);
+		VM_KEEP();
+		VM_NEXT;
+	VM_CASE(POP)
+		sp--;
+		VM_NEXT;
+	VM_CASE(JUMP)
+		VM_SIGNAL();
+		pc = code->code + pc->n;
+		VM_NEXT;
+	VM_CASE(JUMPNIL)
+		pc = stk[--sp] == l->nil ? code->code + pc->n : pc + 1;
+		VM_NEXT;
+	VM_CASE(ENTER)
+		VM_SAVE();
+		stk[bp - 1] = env = mk_frame(l, env, pc[1].c, pc[0].n, 0);
+		VM_KEEP();
+		pc += 2;
+		VM_NEXT;
+	VM_CASE(SLOT)
+		env->p[2].v = (void *)((pc++)->n + 1);
+		VM_NEXT;
+	VM_CASE(BIND)
+		LISP_GC_BARRIER(env);
+		env->p[FRAME_HEADER + (pc++)->n].v = stk[--sp];
+		VM_NEXT;
+	VM_CASE(LEAVE)
+		stk[bp - 1] = env = get_frame_parent(env);
+		VM_NEXT;
+	VM_CASE(INLINE)
+		n = pc[0].n;
+		x = pc[2].c;
+		if (n) { /*as vm_args binds them*/
+			VM_SAVE();
+			x = mk_frame(l, x, pc[1].c, n, n);
+			for (size_t i = 0; i < n; i++)
+				x->p[FRAME_HEADER + i].v = stk[sp - n + i];
+			VM_KEEP();
+		}
+		sp -= n;
+		stk[sp++] = env;
+		stk[bp - 1] = env = x;
+		pc += 3;
+		VM_NEXT;
+	VM_CASE(EXIT)
+		stk[bp - 1] = env = stk[sp - 2];
+		stk[sp - 2] = stk[sp - 1];
+		sp--;
+		VM_NEXT;
+	VM_CASE(CLOSURE)
+		VM_SAVE();
+		x = mk_proc(l, pc[0].c, pc[1].c, env, pc[2].c);
+		x->p[3].v = pc[3].c; /*shared by every procedure made here*/
+		stk[sp++] = x;
+		VM_KEEP();
+		pc += 4;
+		VM_NEXT;
+	VM_CASE(CAPTURE)
+		n = pc[0].n;
+		for (y = env; TYPE_OF(y) == FRAME; y = get_frame_parent(y))
+			;
+		VM_SAVE();
+		if (n) {
+			y = mk_frame(l, y, pc[1].c, n, n);
+			x = pc[2].c;
+			for (size_t i = 0; i < n; i++, x = cdr(x)) {
+				size_t depth = get_ref_depth(car(x)), slot = get_ref_slot(car(x));
+				lisp_cell_t *f = vm_frame(env, depth, slot);
+				y->p[FRAME_HEADER + i].v = f ? f->p[FRAME_HEADER + slot].v : vm_load(l, car(x), env);
+			}
+		}
+		x = mk_proc(l, pc[3].c, pc[4].c, y, pc[5].c);
+		x->p[3].v = pc[6].c;
+		stk[sp++] = x;
+		VM_KEEP();
+		pc += 7;
+		VM_NEXT;
+	VM_CASE(EVAL)
+		VM_SAVE();
+		x = eval(l, depth + 1, (pc++)->c, env);
+		VM_LOAD();
+		stk[sp++] = x;
+		VM_KEEP();
+		VM_NEXT;
+	VM_CASE(FCHECK)
+		x = stk[sp - 1];
+		if (TYPE_OF(x) == PROC || TYPE_OF(x) == SUBR) {
+			pc += 3;
+			VM_NEXT;
+		}
+		/*an F-expression, a macro that was not known when the code was
+		 *compiled, or what a computed head turns out to be could be a
+		 *special form, which eval deals with as it always has*/
+		if (TYPE_OF(x) != FPROC && TYPE_OF(x) != MACRO && !(is_sym(x) && is_cons(pc[1].c)))
+			LISP_RECOVER(l, "%r\"not a procedure\"%t\n '%S", pc[1].c);
+		VM_SAVE();
+		x = eval(l, depth + 1, cons(l, x, pc[0].c), env);
+		VM_LOAD();
+		stk[sp - 1] = x;
+		VM_KEEP();
+		pc = code->code + pc[2].n;
+		VM_NEXT;
+	VM_CASE(CALL)
+	VM_CASE(TCALL)
+		n = pc->n;
+		x = stk[sp - n - 1];
+		VM_SIGNAL();
+		VM_SAVE();
+		if (TYPE_OF(x) == PROC && (y = vm_promote(l, x))) {
+			VM_LOAD(); /*the native compiler could have run code*/
+			if (lisp_check_argv(y, stk + sp - n, n))
+				x = y;
+		}
+		if (TYPE_OF(x) == SUBR) {
+			l->cur_depth = depth;
+			l->cur_env = env;
+			y = subr_call(l, x, stk + sp - n, n);
+			VM_LOAD();
+			sp -= n;
+			stk[sp - 1] = y;
+			VM_KEEP();
+			if (pc[-1].n == OP_TCALL)
+				goto ret;
+			pc++;
+			VM_NEXT;
+		}
+		y = vm_compile(l, x);
+		VM_LOAD(); /*expanding a macro in the body runs code*/
+		env = vm_args(l, x, y->p[0].v, stk + sp - n, n);
+		if (pc[-1].n == OP_CALL) { /*the new activation takes the place of the call*/
+			calls++;
+			if (sp > l->max_vm_stack)
+				LISP_RECOVER(l, "%y'recursion-depth-reached%t %d", (intptr_t)calls);
+			sp -= n + 1;
+			vm_reserve(l, sp + VM_FRAME);
+			VM_LOAD();
+			stk[sp] = VM_INT(bp);
+			stk[sp + 1] = VM_INT(pc + 1 - code->code);
+			bp = sp + VM_FRAME;
+		}
+		code = y->p[0].v;
+		vm_reserve(l, bp + code->stack);
+		VM_LOAD();
+		stk[bp - 2] = y;
+		stk[bp - 1] = env;
+		sp = bp;
+		pc = code->code;
+		VM_KEEP();
+		VM_NEXT;
+	VM_CASE(RETURN)
+	ret:
+		x = stk[sp - 1];
+		if (bp == base + VM_FRAME) {
+			l->vm_stack_used = base;
+			VM_KEEP();
+			return lisp_gc_add(l, x);
+		}
+		sp = bp - VM_FRAME;
+		bp = VM_GET_INT(stk[sp]);
+		code = stk[bp - 2]->p[0].v;
+		pc = code->code + VM_GET_INT(stk[sp + 1]);
+		env = stk[bp - 1];
+		stk[sp++] = x;
+		calls--;
+		VM_NEXT;
+	}
+#undef VM_SAVE
+#undef VM_LOAD
+#undef VM_KEEP
+#undef VM_SIGNAL
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_DISPATCH
+	FATAL("internal inconsistency: reached the unreachable");
+	return NULL;
+}
+
+lisp_cell_t *vm_apply(lisp_t *l, unsigned depth, lisp_cell_t *proc, lisp_cell_t *vals) {
+	assert(l && proc && is_proc(proc) && vals);
+	return vm_enter(l, depth, proc, function_args(l, proc, vals));
+}
+
+lisp_cell_t *vm_enter(lisp_t *l, unsigned depth, lisp_cell_t *proc, lisp_cell_t *env) {
+	assert(l && proc && is_proc(proc) && env);
+	lisp_cell_t *code, *native = vm_promote(l, proc), *args = l->nil;
+	if (native) { /*which is given the arguments bound in the frame*/
+		for (size_t i = get_proc_count(proc); i; i--)
+			args = cons(l, env->p[FRAME_HEADER + i - 1].v, args);
+		if (lisp_check_cell(native, args))
+			return (*get_subr(native)) (l, args);
+	}
+	code = vm_compile(l, proc);
+	return vm_run(l, depth + 1, code, env); /*a level deeper on the C stack*/
+}